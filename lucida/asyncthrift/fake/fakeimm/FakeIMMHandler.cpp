@@ -1,4 +1,5 @@
 #include "FakeIMMHandler.h"
+#include "../../../common/Stats.h"
 
 #include <folly/futures/Future.h>
 #include <thrift/lib/cpp2/async/HeaderClientChannel.h>
@@ -93,4 +94,10 @@ folly::Future<std::unique_ptr<std::string>> FakeImmHandler::future_infer
 	return future;
 }
 
+folly::Future<std::unique_ptr<std::map<std::string, int64_t>>>
+FakeImmHandler::future_getCounters() {
+	return folly::makeFuture(folly::make_unique<std::map<std::string, int64_t>>(
+			Stats::instance().counters()));
+}
+
 }
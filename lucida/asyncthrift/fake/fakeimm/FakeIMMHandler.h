@@ -31,5 +31,8 @@ public:
 
 	folly::Future<std::unique_ptr<std::string>> future_infer
 	(std::unique_ptr<std::string> LUCID, std::unique_ptr< ::cpp2::QuerySpec> query);
+
+	folly::Future<std::unique_ptr<std::map<std::string, int64_t>>>
+	future_getCounters();
 };
 }
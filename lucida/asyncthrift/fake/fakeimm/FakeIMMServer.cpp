@@ -23,6 +23,10 @@ DEFINE_string(CMD_hostname,
 		"Hostname of the server (default: localhost)");
 
 #include "FakeIMMHandler.h"
+#include "../../../common/SignalWatcher.h"
+#include "../../../common/Stats.h"
+#include "../../../common/ThriftStats.h"
+#include <csignal>
 
 using namespace folly;
 using namespace apache::thrift;
@@ -59,6 +63,12 @@ int main(int argc, char* argv[]) {
 	std::cout << "IMM at 8082" << std::endl;
 	google::InitGoogleLogging(argv[0]);
 	google::ParseCommandLineFlags(&argc, &argv, true);
+	SignalWatcher signals({SIGUSR1});
+	installThriftStats();
+	// kill -USR1 prints the stats
+	signals.on(SIGUSR1, []() {
+		cout << Stats::instance().dump() << std::flush;
+	});
 
 	auto handler = std::make_shared<FakeImmHandler>();
 	auto server = folly::make_unique<ThriftServer>();
@@ -1,6 +1,8 @@
 package calendar;
 
+import java.util.HashMap;
 import java.util.List;
+import java.util.Map;
 import java.io.File;
 import java.util.ArrayList;
 
@@ -73,6 +75,56 @@ public class CAServiceHandler {
 
 
 	    }
+
+	    /**
+	     * Parses every query string in the query, one after another.
+		 * @param LUCID ID of Lucida user
+		 * @param query query
+	     */
+	    @Override
+	    public List<String> inferBatch(String LUCID, QuerySpec query) {
+	    	List<String> results = new ArrayList<String>();
+	    	for (QueryInput input : query.content) {
+	    		for (String query_data : input.data) {
+	    			List<QueryInput> content = new ArrayList<QueryInput>();
+	    			List<String> data = new ArrayList<String>();
+	    			data.add(query_data);
+	    			content.add(new QueryInput(input.type, data, input.tags));
+	    			results.add(infer(LUCID, new QuerySpec(query.name, content)));
+	    		}
+	    	}
+	    	return results;
+	    }
+
+	    /**
+	     * Parses every frame of a stream as its own query, the service keeps
+	     * no per-stream state.
+		 * @param LUCID ID of Lucida user
+		 * @param stream name of the stream
+		 * @param frame query
+	     */
+	    @Override
+	    public String inferFrame(String LUCID, String stream, QuerySpec frame) {
+	    	return infer(LUCID, frame);
+	    }
+
+	    @Override
+	    public void closeStream(String LUCID, String stream) {
+	    }
+
+	    /**
+	     * Reports the memory use of the JVM, the service keeps no other
+	     * counters.
+	     */
+	    @Override
+	    public Map<String, Long> getCounters() {
+	    	Runtime runtime = Runtime.getRuntime();
+	    	Map<String, Long> counters = new HashMap<String, Long>();
+	    	counters.put("heap_used_bytes",
+	    			runtime.totalMemory() - runtime.freeMemory());
+	    	counters.put("heap_max_bytes", runtime.maxMemory());
+	    	return counters;
+	    }
 	}
 
 	public static class AsyncCAServiceHandler implements LucidaService.AsyncIface {
@@ -100,5 +152,32 @@ public class CAServiceHandler {
 			print("Async Infer");
 			resultHandler.onComplete(handler.infer(LUCID, query));
 		}
+
+		@Override
+		public void inferBatch(String LUCID, QuerySpec query, AsyncMethodCallback resultHandler)
+				throws TException {
+			print("Async Infer Batch");
+			resultHandler.onComplete(handler.inferBatch(LUCID, query));
+		}
+
+		@Override
+		public void inferFrame(String LUCID, String stream, QuerySpec frame,
+				AsyncMethodCallback resultHandler) throws TException {
+			print("Async Infer Frame");
+			resultHandler.onComplete(handler.inferFrame(LUCID, stream, frame));
+		}
+
+		@Override
+		public void closeStream(String LUCID, String stream, AsyncMethodCallback resultHandler)
+				throws TException {
+			handler.closeStream(LUCID, stream);
+			resultHandler.onComplete(null);
+		}
+
+		@Override
+		public void getCounters(AsyncMethodCallback resultHandler)
+				throws TException {
+			resultHandler.onComplete(handler.getCounters());
+		}
 	}
 }
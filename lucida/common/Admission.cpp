@@ -0,0 +1,231 @@
+#include "Admission.h"
+
+#include <algorithm>
+#include <sstream>
+#include <vector>
+
+#include <gflags/gflags.h>
+#include <thrift/lib/cpp/TApplicationException.h>
+
+#include "Stats.h"
+
+DEFINE_int32(max_in_flight, 64,
+             "Maximum number of requests worked on at a time (default: 64)");
+
+DEFINE_int32(max_pending, 256,
+             "Maximum number of requests waiting to be worked on, more are "
+             "rejected (default: 256)");
+
+DEFINE_int64(default_timeout_ms, 0,
+             "Deadline of requests that do not carry one, in ms after "
+             "arrival, 0 for none (default: 0)");
+
+using apache::thrift::TApplicationException;
+
+namespace cpp2 {
+
+namespace {
+
+struct AdmissionStats {
+  Counter& admitted;
+  Counter& rejected;
+  Counter& expired;
+  Histogram& wait_us;
+};
+
+AdmissionStats& stats() {
+  static AdmissionStats stats{
+    Stats::instance().counter("admission.admitted"),
+    Stats::instance().counter("admission.rejected"),
+    Stats::instance().counter("admission.expired"),
+    Stats::instance().histogram("admission_wait_us"),
+  };
+  return stats;
+}
+
+// starts queued by the releases nested in the outermost one on this thread,
+// null outside of a release
+thread_local std::deque<std::function<void()>>* tl_starts = nullptr;
+
+} // namespace
+
+Deadline deadlineAfter(int64_t timeout_ms) {
+  if (timeout_ms <= 0) {
+    timeout_ms = FLAGS_default_timeout_ms;
+  }
+  if (timeout_ms <= 0) {
+    return Deadline::max();
+  }
+  return std::chrono::steady_clock::now() +
+      std::chrono::milliseconds(timeout_ms);
+}
+
+bool expired(Deadline deadline) {
+  return deadline != Deadline::max() &&
+      std::chrono::steady_clock::now() > deadline;
+}
+
+folly::exception_wrapper overloadedError() {
+  return folly::make_exception_wrapper<TApplicationException>(
+      TApplicationException::LOADSHEDDING, "server overloaded");
+}
+
+folly::exception_wrapper expiredError() {
+  return folly::make_exception_wrapper<TApplicationException>(
+      TApplicationException::TIMEOUT, "deadline exceeded");
+}
+
+bool isExpiredError(const folly::exception_wrapper& error) {
+  bool timeout = false;
+  error.with_exception<TApplicationException>(
+      [&](const TApplicationException& e) {
+        timeout = e.getType() == TApplicationException::TIMEOUT;
+      });
+  return timeout;
+}
+
+Admission::Admission()
+    : max_in_flight_(std::max(1, FLAGS_max_in_flight)),
+      max_pending_(std::max(0, FLAGS_max_pending)),
+      in_flight_(0),
+      stop_(false),
+      admitted_(0),
+      rejected_(0),
+      expired_(0),
+      expirer_([this]() { expireLoop(); }) {
+}
+
+Admission::~Admission() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  expiry_cv_.notify_one();
+  expirer_.join();
+}
+
+bool Admission::admit(Deadline deadline, std::function<void()> start,
+    std::function<void()> expire) {
+  if (expired(deadline)) {
+    ++expired_;
+    stats().expired.add();
+    expire();
+    return true;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (in_flight_ >= max_in_flight_) {
+      if (pending_.size() >= max_pending_) {
+        ++rejected_;
+        stats().rejected.add();
+        return false;
+      }
+      pending_.push_back(Waiter{deadline, std::chrono::steady_clock::now(),
+          std::move(start), std::move(expire)});
+      if (deadline != Deadline::max()) {
+        expiry_cv_.notify_one();
+      }
+      return true;
+    }
+    ++in_flight_;
+  }
+  ++admitted_;
+  stats().admitted.add();
+  stats().wait_us.add(0);
+  start();
+  return true;
+}
+
+void Admission::release() {
+  std::vector<std::function<void()>> expires;
+  std::function<void()> start;
+  std::chrono::steady_clock::time_point queued;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    --in_flight_;
+    while (!pending_.empty()) {
+      Waiter waiter = std::move(pending_.front());
+      pending_.pop_front();
+      if (expired(waiter.deadline)) {
+        expires.push_back(std::move(waiter.expire));
+        continue;
+      }
+      ++in_flight_;
+      start = std::move(waiter.start);
+      queued = waiter.queued;
+      break;
+    }
+  }
+  expired_ += expires.size();
+  stats().expired.add(expires.size());
+  for (auto& expire : expires) {
+    expire();
+  }
+  if (!start) {
+    return;
+  }
+  ++admitted_;
+  stats().admitted.add();
+  stats().wait_us.add(std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - queued).count());
+  if (tl_starts != nullptr) {
+    tl_starts->push_back(std::move(start));
+    return;
+  }
+  std::deque<std::function<void()>> starts;
+  starts.push_back(std::move(start));
+  tl_starts = &starts;
+  while (!starts.empty()) {
+    std::function<void()> next = std::move(starts.front());
+    starts.pop_front();
+    next();
+  }
+  tl_starts = nullptr;
+}
+
+void Admission::expireLoop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stop_) {
+    // arrival order is not deadline order, and there are at most
+    // --max_pending waiters to look at
+    Deadline next = Deadline::max();
+    for (const auto& waiter : pending_) {
+      next = std::min(next, waiter.deadline);
+    }
+    if (next == Deadline::max()) {
+      expiry_cv_.wait(lock);
+    } else {
+      // expired() holds only once the deadline is past
+      expiry_cv_.wait_until(lock, next + std::chrono::microseconds(1));
+    }
+
+    std::vector<std::function<void()>> expires;
+    for (auto it = pending_.begin(); it != pending_.end(); ) {
+      if (expired(it->deadline)) {
+        expires.push_back(std::move(it->expire));
+        it = pending_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    if (expires.empty()) {
+      continue;
+    }
+    lock.unlock();
+    expired_ += expires.size();
+    stats().expired.add(expires.size());
+    for (auto& expire : expires) {
+      expire();
+    }
+    lock.lock();
+  }
+}
+
+std::string Admission::report() const {
+  std::ostringstream out;
+  out << "admission: admitted=" << admitted() << " rejected=" << rejected()
+      << " expired=" << expiredCount();
+  return out.str();
+}
+
+} // namespace cpp2
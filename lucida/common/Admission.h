@@ -0,0 +1,123 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include <folly/ExceptionWrapper.h>
+#include <folly/futures/Future.h>
+
+namespace cpp2 {
+
+typedef std::chrono::steady_clock::time_point Deadline;
+
+// Deadline for a request with a budget of timeout_ms from now. Requests
+// without a budget (0) get --default_timeout_ms, no deadline if that is 0
+// as well.
+Deadline deadlineAfter(int64_t timeout_ms);
+
+bool expired(Deadline deadline);
+
+// Error for requests rejected because the server is overloaded, a Thrift
+// LOADSHEDDING application exception.
+folly::exception_wrapper overloadedError();
+// Error for requests dropped because their deadline passed, a Thrift TIMEOUT
+// application exception.
+folly::exception_wrapper expiredError();
+// True if error is an expiredError().
+bool isExpiredError(const folly::exception_wrapper& error);
+
+// Admission control in front of a server's request handling. At most
+// --max_in_flight requests are worked on at a time and at most --max_pending
+// more wait for a slot, in arrival order. Anything beyond that fails right
+// away with overloadedError() instead of queueing without bound, and a
+// request whose deadline passes while it waits is failed with
+// expiredError() by a timer thread as soon as it does, before any work is
+// done for it. The counters of all instances are also summed up in Stats
+// under admission.*, along with the time requests wait for a slot as
+// admission_wait_us.
+class Admission {
+ public:
+  Admission();
+  ~Admission();
+
+  // Runs work once a slot is free and completes the returned future with
+  // its result. The slot is held until that future completes.
+  template <typename T>
+  folly::Future<T> run(Deadline deadline,
+      std::function<folly::Future<T>()> work) {
+    auto promise = std::make_shared<folly::Promise<T>>();
+    auto future = promise->getFuture();
+    bool admitted = admit(deadline,
+        [this, promise, work]() {
+          folly::makeFutureWith(work).then(
+              [this, promise](folly::Try<T>&& result) {
+            release();
+            promise->setTry(std::move(result));
+          });
+        },
+        [promise]() { promise->setException(expiredError()); });
+    if (!admitted) {
+      promise->setException(overloadedError());
+    }
+    return future;
+  }
+
+  uint64_t admitted() const {
+    return admitted_.load(std::memory_order_relaxed);
+  }
+  uint64_t rejected() const {
+    return rejected_.load(std::memory_order_relaxed);
+  }
+  uint64_t expiredCount() const {
+    return expired_.load(std::memory_order_relaxed);
+  }
+  // One line summary of the counters, for logging.
+  std::string report() const;
+
+ private:
+  struct Waiter {
+    Deadline deadline;
+    std::chrono::steady_clock::time_point queued;
+    std::function<void()> start;
+    std::function<void()> expire;
+  };
+
+  // Calls start now or once a slot frees up, or expire if the deadline
+  // passes first. False if the request could not even be queued.
+  bool admit(Deadline deadline, std::function<void()> start,
+      std::function<void()> expire);
+  // Frees a slot and starts the next waiter that is still in time.
+  // Requests that complete while they start release again from within, so
+  // the outermost release on a thread runs the starts of the nested ones
+  // in a loop rather than recursing once per request.
+  void release();
+  // body of expirer_: fails waiters once their deadline passes
+  void expireLoop();
+
+  int max_in_flight_;
+  size_t max_pending_;
+
+  std::mutex mutex_;
+  int in_flight_;
+  std::deque<Waiter> pending_;
+  // wakes expirer_ for a new deadline or to stop
+  std::condition_variable expiry_cv_;
+  bool stop_;
+
+  std::atomic<uint64_t> admitted_;
+  std::atomic<uint64_t> rejected_;
+  std::atomic<uint64_t> expired_;
+  // declared last, starts once the rest is set up
+  std::thread expirer_;
+};
+
+} // namespace cpp2
@@ -0,0 +1,142 @@
+#include "CpuExecutor.h"
+
+#include <algorithm>
+#include <memory>
+#include <sstream>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "Stats.h"
+#include "ThreadBudget.h"
+
+DEFINE_int32(cpu_threads, 4,
+             "Number of threads doing the compute work of requests "
+             "(default: 4)");
+
+namespace cpp2 {
+
+namespace {
+
+void raise(std::atomic<uint64_t>* value, uint64_t to) {
+  uint64_t current = value->load(std::memory_order_relaxed);
+  while (current < to &&
+      !value->compare_exchange_weak(current, to, std::memory_order_relaxed)) {
+  }
+}
+
+} // namespace
+
+CpuExecutor& CpuExecutor::instance() {
+  static CpuExecutor executor(
+      ThreadBudget::instance().executorThreads(FLAGS_cpu_threads));
+  return executor;
+}
+
+CpuExecutor::CpuExecutor(int threads)
+    : stop_(false), depth_(0), max_depth_(0), tasks_(0), total_wait_us_(0),
+      max_wait_us_(0) {
+  threads = std::max(1, threads);
+  for (int i = 0; i < threads; ++i) {
+    threads_.emplace_back(&CpuExecutor::loop, this, i);
+  }
+  Stats::instance().gauge("cpu_executor.queue_depth",
+      [this]() { return (int64_t) queueDepth(); });
+  LOG(ERROR) << "Started " << threads << " CPU executor threads";
+}
+
+CpuExecutor::~CpuExecutor() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+}
+
+void CpuExecutor::add(Task task) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queue_.push_back(Entry{std::move(task), std::chrono::steady_clock::now()});
+    raise(&max_depth_, ++depth_);
+  }
+  cv_.notify_one();
+}
+
+void CpuExecutor::parallelFor(int n, const std::function<void(int)>& body) {
+  if (n <= 1) {
+    if (n == 1) {
+      body(0);
+    }
+    return;
+  }
+  // workers and the caller pull indices until none are left, the last one
+  // to finish an index wakes the caller
+  struct State {
+    std::atomic<int> next;
+    std::atomic<int> done;
+    std::mutex mutex;
+    std::condition_variable cv;
+  };
+  auto state = std::make_shared<State>();
+  state->next = 0;
+  state->done = 0;
+  auto work = [state, n, &body]() {
+    int i;
+    while ((i = state->next++) < n) {
+      body(i);
+      if (++state->done == n) {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->cv.notify_one();
+      }
+    }
+  };
+  int helpers = std::min(n - 1, (int) threads_.size());
+  for (int h = 0; h < helpers; ++h) {
+    add(work);
+  }
+  work();
+  std::unique_lock<std::mutex> lock(state->mutex);
+  state->cv.wait(lock, [&] { return state->done == n; });
+}
+
+std::string CpuExecutor::report() const {
+  uint64_t tasks = this->tasks();
+  std::ostringstream out;
+  out << "cpu executor: threads=" << threads_.size() << " tasks=" << tasks
+      << " queue_depth=" << queueDepth() << " max_queue_depth="
+      << maxQueueDepth() << " avg_wait_us="
+      << (tasks ? totalWaitUs() / tasks : 0) << " max_wait_us="
+      << maxWaitUs();
+  return out.str();
+}
+
+void CpuExecutor::loop(int index) {
+  ThreadBudget::instance().pin(ThreadBudget::EXECUTOR, index);
+  Histogram& queue_wait_us = Stats::instance().histogram("queue_wait_us");
+  while (true) {
+    Entry entry;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+      if (queue_.empty()) {
+        return;
+      }
+      entry = std::move(queue_.front());
+      queue_.pop_front();
+      --depth_;
+    }
+    uint64_t wait_us = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - entry.queued).count();
+    total_wait_us_ += wait_us;
+    raise(&max_wait_us_, wait_us);
+    queue_wait_us.add(wait_us);
+    ++tasks_;
+    entry.task();
+    LOG_EVERY_N(ERROR, 100000) << report();
+  }
+}
+
+} // namespace cpp2
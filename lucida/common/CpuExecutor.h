@@ -0,0 +1,82 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace cpp2 {
+
+// Fixed pool of --cpu_threads threads for the compute work of a service
+// (image decoding, forward passes, descriptor matching), so that the Thrift
+// I/O threads only (de)serialize and complete promises and a slow request
+// never stalls the other connections of its event base. Tasks run in FIFO
+// order. Queue depth and the time tasks wait before a thread picks them up
+// are tracked, and exported as queue_wait_us and cpu_executor.queue_depth.
+// The process wide pool is sized and pinned by the ThreadBudget.
+class CpuExecutor {
+ public:
+  typedef std::function<void()> Task;
+
+  // The process wide pool, started on first use.
+  static CpuExecutor& instance();
+
+  explicit CpuExecutor(int threads);
+  ~CpuExecutor();
+
+  int threads() const { return threads_.size(); }
+
+  void add(Task task);
+
+  // Runs body(i) for i < n on the pool and the calling thread, returns once
+  // all are done. The caller helps, so this makes progress even when every
+  // pool thread is busy.
+  void parallelFor(int n, const std::function<void(int)>& body);
+
+  // Tasks queued but not started yet.
+  uint64_t queueDepth() const {
+    return depth_.load(std::memory_order_relaxed);
+  }
+  uint64_t maxQueueDepth() const {
+    return max_depth_.load(std::memory_order_relaxed);
+  }
+  uint64_t tasks() const { return tasks_.load(std::memory_order_relaxed); }
+  // Sum and maximum of the queue waits of all started tasks, in us.
+  uint64_t totalWaitUs() const {
+    return total_wait_us_.load(std::memory_order_relaxed);
+  }
+  uint64_t maxWaitUs() const {
+    return max_wait_us_.load(std::memory_order_relaxed);
+  }
+  // One line summary of the above, for logging.
+  std::string report() const;
+
+ private:
+  struct Entry {
+    Task task;
+    std::chrono::steady_clock::time_point queued;
+  };
+
+  // index-th thread of the pool
+  void loop(int index);
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<Entry> queue_;
+  bool stop_;
+  std::vector<std::thread> threads_;
+
+  std::atomic<uint64_t> depth_;
+  std::atomic<uint64_t> max_depth_;
+  std::atomic<uint64_t> tasks_;
+  std::atomic<uint64_t> total_wait_us_;
+  std::atomic<uint64_t> max_wait_us_;
+};
+
+} // namespace cpp2
@@ -0,0 +1,61 @@
+#include "SignalWatcher.h"
+
+#include <signal.h>
+
+#include <glog/logging.h>
+
+namespace cpp2 {
+
+namespace {
+
+sigset_t toSet(const std::vector<int>& signals) {
+  sigset_t set;
+  sigemptyset(&set);
+  for (int signo : signals) {
+    sigaddset(&set, signo);
+  }
+  return set;
+}
+
+} // namespace
+
+SignalWatcher::SignalWatcher(const std::vector<int>& signals)
+    : signals_(signals) {
+  sigset_t set = toSet(signals_);
+  pthread_sigmask(SIG_BLOCK, &set, nullptr);
+  thread_ = std::thread(&SignalWatcher::loop, this);
+}
+
+SignalWatcher::~SignalWatcher() {
+  // the thread sits in sigwait for good, servers only exit with the process
+  thread_.detach();
+}
+
+void SignalWatcher::on(int signo, std::function<void()> callback) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  callbacks_[signo] = std::move(callback);
+}
+
+void SignalWatcher::loop() {
+  sigset_t set = toSet(signals_);
+  while (true) {
+    int signo;
+    if (sigwait(&set, &signo) != 0) {
+      continue;
+    }
+    std::function<void()> callback;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto it = callbacks_.find(signo);
+      if (it != callbacks_.end()) {
+        callback = it->second;
+      }
+    }
+    LOG(ERROR) << "Received signal " << signo;
+    if (callback) {
+      callback();
+    }
+  }
+}
+
+} // namespace cpp2
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace cpp2 {
+
+// Runs callbacks for signals on a thread of its own rather than in signal
+// context, so they may lock, allocate and log. The signals are blocked for
+// the calling thread and every thread it starts afterwards, so create the
+// watcher at the top of main, before any other thread exists.
+class SignalWatcher {
+ public:
+  explicit SignalWatcher(const std::vector<int>& signals);
+  ~SignalWatcher();
+
+  // Replaces the callback for signo, which must be one of the watched
+  // signals. Until a callback is set the signal is ignored.
+  void on(int signo, std::function<void()> callback);
+
+ private:
+  void loop();
+
+  std::vector<int> signals_;
+  std::mutex mutex_;
+  std::map<int, std::function<void()>> callbacks_;
+  std::thread thread_;
+};
+
+} // namespace cpp2
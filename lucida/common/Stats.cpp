@@ -0,0 +1,171 @@
+#include "Stats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#include <unistd.h>
+
+namespace cpp2 {
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+int64_t elapsedUs(Clock::time_point since) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+      Clock::now() - since).count();
+}
+
+// Values below 4 get a bucket each, larger ones one of four per power of
+// two, split by the two bits after the leading one.
+int bucketOf(int64_t value) {
+  if (value < 4) {
+    return std::max<int64_t>(0, value);
+  }
+  int msb = 63 - __builtin_clzll(value);
+  int sub = (value >> (msb - 2)) & 3;
+  return (msb - 1) * 4 + sub;
+}
+
+int64_t bucketEnd(int bucket) {
+  if (bucket < 4) {
+    return bucket;
+  }
+  int msb = bucket / 4 + 1;
+  uint64_t start = (uint64_t) (4 + bucket % 4) << (msb - 2);
+  uint64_t end = start + ((uint64_t) 1 << (msb - 2)) - 1;
+  return (int64_t) std::min<uint64_t>(end, INT64_MAX);
+}
+
+int64_t residentBytes() {
+  // second field of statm, in pages
+  std::ifstream statm("/proc/self/statm");
+  int64_t size = 0, resident = 0;
+  statm >> size >> resident;
+  return resident * sysconf(_SC_PAGESIZE);
+}
+
+} // namespace
+
+Histogram::Histogram() : count_(0), sum_(0), max_(0) {
+  for (auto& bucket : buckets_) {
+    bucket = 0;
+  }
+}
+
+void Histogram::add(int64_t value) {
+  value = std::max<int64_t>(0, value);
+  buckets_[bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  sum_.fetch_add(value, std::memory_order_relaxed);
+  int64_t current = max_.load(std::memory_order_relaxed);
+  while (current < value &&
+      !max_.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+  }
+}
+
+int64_t Histogram::percentile(double p) const {
+  // the buckets are read one by one while others add, so their sum may
+  // differ slightly from count_
+  int64_t counts[kBuckets];
+  int64_t total = 0;
+  for (int b = 0; b < kBuckets; ++b) {
+    counts[b] = buckets_[b].load(std::memory_order_relaxed);
+    total += counts[b];
+  }
+  if (total == 0) {
+    return 0;
+  }
+  int64_t rank = std::max<int64_t>(1, (int64_t) std::ceil(total * p / 100));
+  int64_t seen = 0;
+  for (int b = 0; b < kBuckets; ++b) {
+    seen += counts[b];
+    if (seen >= rank) {
+      return std::min(bucketEnd(b), max());
+    }
+  }
+  return max();
+}
+
+ScopedTimer::~ScopedTimer() {
+  histogram_.add(elapsedUs(start_));
+}
+
+Stats& Stats::instance() {
+  static Stats stats;
+  return stats;
+}
+
+Stats::Stats() {
+  Clock::time_point start = Clock::now();
+  gauges_["rss_bytes"] = residentBytes;
+  gauges_["uptime_s"] = [start]() {
+    return std::chrono::duration_cast<std::chrono::seconds>(
+        Clock::now() - start).count();
+  };
+}
+
+Counter& Stats::counter(const std::string& name) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::unique_ptr<Counter>& counter = counters_[name];
+  if (!counter) {
+    counter.reset(new Counter());
+  }
+  return *counter;
+}
+
+Histogram& Stats::histogram(const std::string& name) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::unique_ptr<Histogram>& histogram = histograms_[name];
+  if (!histogram) {
+    histogram.reset(new Histogram());
+  }
+  return *histogram;
+}
+
+void Stats::gauge(const std::string& name, std::function<int64_t()> read) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  gauges_[name] = std::move(read);
+}
+
+std::map<std::string, int64_t> Stats::counters() const {
+  std::map<std::string, int64_t> values;
+  std::vector<std::pair<std::string, std::function<int64_t()>>> gauges;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& counter : counters_) {
+      values[counter.first] = counter.second->value();
+    }
+    for (const auto& entry : histograms_) {
+      const std::string& name = entry.first;
+      const Histogram& histogram = *entry.second;
+      int64_t count = histogram.count();
+      values[name + ".count"] = count;
+      values[name + ".avg"] = count ? histogram.sum() / count : 0;
+      values[name + ".p50"] = histogram.percentile(50);
+      values[name + ".p90"] = histogram.percentile(90);
+      values[name + ".p99"] = histogram.percentile(99);
+      values[name + ".p999"] = histogram.percentile(99.9);
+      values[name + ".max"] = histogram.max();
+    }
+    gauges.assign(gauges_.begin(), gauges_.end());
+  }
+  // gauges run unlocked so that they may read other stats
+  for (const auto& gauge : gauges) {
+    values[gauge.first] = gauge.second();
+  }
+  return values;
+}
+
+std::string Stats::dump() const {
+  std::ostringstream out;
+  for (const auto& value : counters()) {
+    out << value.first << " " << value.second << "\n";
+  }
+  return out.str();
+}
+
+} // namespace cpp2
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace cpp2 {
+
+// A count that only goes up, e.g. of requests or bytes.
+class Counter {
+ public:
+  Counter() : value_(0) {}
+
+  void add(int64_t n = 1) { value_.fetch_add(n, std::memory_order_relaxed); }
+  int64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic<int64_t> value_;
+};
+
+// Distribution of non-negative values, e.g. stage latencies in us, over
+// logarithmic buckets with four per power of two, so percentiles are within
+// a fifth of the true value. Adding takes no lock.
+class Histogram {
+ public:
+  Histogram();
+
+  void add(int64_t value);
+
+  int64_t count() const { return count_.load(std::memory_order_relaxed); }
+  int64_t sum() const { return sum_.load(std::memory_order_relaxed); }
+  int64_t max() const { return max_.load(std::memory_order_relaxed); }
+  // Upper end of the bucket holding the p-th percentile (0 < p <= 100) of
+  // the values added so far, 0 if there are none.
+  int64_t percentile(double p) const;
+
+ private:
+  static const int kBuckets = 256;
+
+  std::atomic<int64_t> buckets_[kBuckets];
+  std::atomic<int64_t> count_;
+  std::atomic<int64_t> sum_;
+  std::atomic<int64_t> max_;
+};
+
+// Adds the us from its construction to its destruction to a histogram.
+class ScopedTimer {
+ public:
+  explicit ScopedTimer(Histogram& histogram)
+      : histogram_(histogram), start_(std::chrono::steady_clock::now()) {}
+  ~ScopedTimer();
+
+ private:
+  Histogram& histogram_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+// The counters and histograms of a service, in the style of fb303: every
+// module registers its stats by name on first use and keeps the reference,
+// which stays valid for the life of the process. Handlers return counters()
+// from getCounters(), and servers log dump() on SIGUSR1. Besides what the
+// modules register, rss_bytes and uptime_s are always present. Servers add
+// the stats of their Thrift calls with installThriftStats().
+class Stats {
+ public:
+  static Stats& instance();
+
+  // Returns the stat of that name, created on first use.
+  Counter& counter(const std::string& name);
+  Histogram& histogram(const std::string& name);
+  // Sets a value computed whenever the stats are read, e.g. a queue depth.
+  void gauge(const std::string& name, std::function<int64_t()> read);
+
+  // Counters and gauges by name, and for every histogram its name with
+  // .count, .avg, .p50, .p90, .p99, .p999 and .max appended.
+  std::map<std::string, int64_t> counters() const;
+  // counters() as one "name value" line each, sorted by name.
+  std::string dump() const;
+
+ private:
+  Stats();
+
+  mutable std::mutex mutex_;
+  std::map<std::string, std::unique_ptr<Counter>> counters_;
+  std::map<std::string, std::unique_ptr<Histogram>> histograms_;
+  std::map<std::string, std::function<int64_t()>> gauges_;
+};
+
+} // namespace cpp2
@@ -0,0 +1,267 @@
+#include "ThreadBudget.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+#include <dirent.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+DEFINE_int32(thread_budget, 0,
+             "Cores for the compute threads, split between CPU executor "
+             "threads (--cpu_threads if given, else a quarter) and net "
+             "replicas of --blas_threads BLAS threads each; 0 keeps "
+             "--num_of_threads replicas and --cpu_threads (default: 0)");
+
+DEFINE_int32(blas_threads, 0,
+             "BLAS threads per forward pass, 0 leaves the library's own "
+             "count, or 1 with --thread_budget (default: 0)");
+
+DEFINE_string(thread_affinity, "none",
+              "Pin every replica and CPU executor thread to cores of its "
+              "own (core), replicas from the first core up and executor "
+              "threads from the last one down, to a NUMA node each (node) "
+              "or not at all (default: none)");
+
+DECLARE_int32(cpu_threads);
+
+namespace cpp2 {
+
+namespace {
+
+int models = 1;
+
+// "0-3,8,10-11"
+std::vector<int> parseCpuList(const std::string& list) {
+  std::vector<int> cpus;
+  std::stringstream ss(list);
+  for (std::string range; std::getline(ss, range, ','); ) {
+    int first, last;
+    int n = sscanf(range.c_str(), "%d-%d", &first, &last);
+    if (n == 1) {
+      last = first;
+    } else if (n != 2) {
+      continue;
+    }
+    for (int cpu = first; cpu <= last; ++cpu) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+
+std::string formatCpuList(const std::vector<int>& cpus) {
+  std::ostringstream out;
+  for (size_t i = 0; i < cpus.size(); ) {
+    size_t j = i;
+    while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1) {
+      ++j;
+    }
+    out << (i ? "," : "") << cpus[i];
+    if (j > i) {
+      out << "-" << cpus[j];
+    }
+    i = j + 1;
+  }
+  return out.str();
+}
+
+// Sets the thread count of whichever BLAS library Caffe was linked against.
+void setBlasThreads(int threads) {
+  typedef void (*SetThreads)(int);
+  bool found = false;
+  for (const char* name : {"openblas_set_num_threads", "MKL_Set_Num_Threads"}) {
+    SetThreads set = (SetThreads) dlsym(RTLD_DEFAULT, name);
+    if (set != nullptr) {
+      set(threads);
+      found = true;
+    }
+  }
+  if (!found) {
+    LOG(ERROR) << "Cannot set the BLAS thread count, ATLAS fixes it when it "
+               << "is built (the serial libcblas runs one)";
+  }
+}
+
+} // namespace
+
+ThreadBudget& ThreadBudget::instance() {
+  static ThreadBudget budget;
+  return budget;
+}
+
+void ThreadBudget::setModels(int count) {
+  models = std::max(0, count);
+}
+
+ThreadBudget::ThreadBudget()
+    : budget_(std::max(0, FLAGS_thread_budget)),
+      blas_threads_(std::max(0, FLAGS_blas_threads)),
+      affinity_(FLAGS_thread_affinity),
+      next_replica_(0) {
+  if (budget_ > 0 && blas_threads_ == 0) {
+    blas_threads_ = 1;
+  }
+  replicas_ = 0;
+  executor_threads_ = 0;
+  if (budget_ > 0) {
+    // the executor's share first, the replicas fill the rest in whole
+    // blocks and the executor gets back what they cannot use
+    bool given =
+        !gflags::GetCommandLineFlagInfoOrDie("cpu_threads").is_default;
+    int reserved = given ? std::max(1, FLAGS_cpu_threads) :
+        models == 0 ? budget_ : std::max(1, budget_ / 4);
+    replicas_ = models == 0 ? 0 : std::max(1,
+        std::max(0, budget_ - reserved) / blas_threads_ / models);
+    int replica_cores = replicas_ * blas_threads_ * models;
+    executor_threads_ = given ? reserved :
+        std::max(1, budget_ - replica_cores);
+    if (replica_cores + executor_threads_ > budget_) {
+      LOG(ERROR) << "A budget of " << budget_ << " threads is too small for "
+                 << models << " model(s) with " << blas_threads_
+                 << " BLAS threads each and " << executor_threads_
+                 << " CPU executor thread(s), the pools share cores";
+    }
+  }
+  if (affinity_ != "none" && affinity_ != "core" && affinity_ != "node") {
+    LOG(ERROR) << "Unknown --thread_affinity " << affinity_
+               << ", not pinning threads";
+    affinity_ = "none";
+  }
+
+  // the CPUs this process may run on (taskset, cpusets), by NUMA node
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  sched_getaffinity(0, sizeof(allowed), &allowed);
+  DIR* dir = opendir("/sys/devices/system/node");
+  for (struct dirent* entry; dir && (entry = readdir(dir)); ) {
+    int id;
+    if (sscanf(entry->d_name, "node%d", &id) != 1) {
+      continue;
+    }
+    std::ifstream file(std::string("/sys/devices/system/node/") +
+        entry->d_name + "/cpulist");
+    std::string list;
+    std::getline(file, list);
+    Node node{id, {}};
+    for (int cpu : parseCpuList(list)) {
+      if (CPU_ISSET(cpu, &allowed)) {
+        node.cpus.push_back(cpu);
+      }
+    }
+    if (!node.cpus.empty()) {
+      nodes_.push_back(node);
+    }
+  }
+  if (dir) {
+    closedir(dir);
+  }
+  std::sort(nodes_.begin(), nodes_.end(),
+      [](const Node& a, const Node& b) { return a.id < b.id; });
+  if (nodes_.empty()) {
+    // no NUMA information, a single node
+    Node node{0, {}};
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+      if (CPU_ISSET(cpu, &allowed)) {
+        node.cpus.push_back(cpu);
+      }
+    }
+    nodes_.push_back(node);
+  }
+  for (const Node& node : nodes_) {
+    cpus_.insert(cpus_.end(), node.cpus.begin(), node.cpus.end());
+  }
+
+  if (budget_ > (int) cpus_.size()) {
+    LOG(ERROR) << "--thread_budget " << budget_ << " exceeds the "
+               << cpus_.size() << " CPUs this process may use";
+  }
+  if (blas_threads_ > 0) {
+    setBlasThreads(blas_threads_);
+  }
+  LOG(ERROR) << describe();
+}
+
+int ThreadBudget::replicas(int unbudgeted) const {
+  return budget_ > 0 ? replicas_ : unbudgeted;
+}
+
+int ThreadBudget::executorThreads(int unbudgeted) const {
+  return budget_ > 0 ? executor_threads_ : unbudgeted;
+}
+
+int ThreadBudget::assignReplicas(int count) {
+  return next_replica_.fetch_add(count);
+}
+
+std::vector<int> ThreadBudget::cpusOf(Role role, int slot) const {
+  if (role == REPLICA && budget_ > 0 && replicas_ * models > 0) {
+    slot %= replicas_ * models;
+  }
+  if (affinity_ == "node") {
+    return nodes_[slot % nodes_.size()].cpus;
+  }
+  // a replica gets a core for each of its BLAS threads counting up from the
+  // first core, CPU executor threads one each counting down from the last;
+  // cores are numbered node by node, so that blocks stay within a node
+  // where they can
+  if (role == EXECUTOR) {
+    return {cpus_[cpus_.size() - 1 - slot % cpus_.size()]};
+  }
+  int block = std::max(1, blas_threads_);
+  std::vector<int> cpus;
+  for (int i = 0; i < block; ++i) {
+    cpus.push_back(cpus_[(slot * block + i) % cpus_.size()]);
+  }
+  return cpus;
+}
+
+void ThreadBudget::pin(Role role, int slot) const {
+  if (affinity_ == "none") {
+    return;
+  }
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int cpu : cpusOf(role, slot)) {
+    CPU_SET(cpu, &set);
+  }
+  int error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  if (error != 0) {
+    LOG(ERROR) << "Cannot pin thread to cpus "
+               << formatCpuList(cpusOf(role, slot)) << ": error " << error;
+  }
+}
+
+std::string ThreadBudget::describe() const {
+  std::ostringstream out;
+  if (budget_ > 0) {
+    out << "thread budget " << budget_ << ": ";
+    if (models > 0) {
+      out << replicas_ << " replica(s) per model x " << blas_threads_
+          << " BLAS thread(s)"
+          << (models > 1 ? ", " + std::to_string(models) + " models" : "")
+          << ", ";
+    }
+    out << executor_threads_ << " CPU executor thread(s)";
+  } else {
+    out << "no thread budget";
+    if (blas_threads_ > 0) {
+      out << ", " << blas_threads_ << " BLAS thread(s)";
+    }
+  }
+  out << "; affinity " << affinity_ << "; " << cpus_.size() << " CPUs on "
+      << nodes_.size() << " NUMA node(s):";
+  for (const Node& node : nodes_) {
+    out << " node" << node.id << "=" << formatCpuList(node.cpus);
+  }
+  return out.str();
+}
+
+} // namespace cpp2
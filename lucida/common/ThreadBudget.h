@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+namespace cpp2 {
+
+// Splits the cores of a server between request level parallelism and the
+// threads its BLAS library starts within every forward pass, which otherwise
+// multiply and oversubscribe the machine. With --thread_budget N the two
+// pools split the N cores: the CPU executor, which decodes the inputs of
+// the next batches, sets aside --cpu_threads of them if given and a quarter
+// otherwise, the replicas get as many blocks of --blas_threads cores as fit
+// into the rest, and the executor then takes whatever the replicas left.
+// --thread_affinity pins the replica threads from the first allowed core up
+// and the CPU executor threads from the last one down, so the pools only
+// share cores when they outnumber them. Thrift I/O threads are neither
+// counted nor pinned, they only (de)serialize.
+class ThreadBudget {
+ public:
+  enum Role { REPLICA, EXECUTOR };
+
+  // Sets up the budget from the flags on first use, applies the BLAS thread
+  // count and logs the split and the topology.
+  static ThreadBudget& instance();
+
+  // Number of models whose replicas share the budget, DJINNServer hosts
+  // several, 0 for a server without nets whose CPU executor gets the whole
+  // budget. Call before the first instance().
+  static void setModels(int models);
+
+  // Replicas per model, or unbudgeted if there is no budget.
+  int replicas(int unbudgeted) const;
+  // CPU executor threads, or unbudgeted if there is no budget.
+  int executorThreads(int unbudgeted) const;
+
+  // Returns the pinning slot of the first of count new replicas, the others
+  // follow. Slots wrap around, so reloaded models reuse the old cores.
+  int assignReplicas(int count);
+  // Pins the calling thread to the cores of its slot, if --thread_affinity
+  // is set.
+  void pin(Role role, int slot) const;
+
+  // One line description of the split and the topology, for logging.
+  std::string describe() const;
+
+ private:
+  struct Node {
+    int id;
+    std::vector<int> cpus;
+  };
+
+  ThreadBudget();
+  ThreadBudget(const ThreadBudget&) = delete;
+  ThreadBudget& operator=(const ThreadBudget&) = delete;
+
+  std::vector<int> cpusOf(Role role, int slot) const;
+
+  int budget_;
+  int blas_threads_;
+  int replicas_;
+  int executor_threads_;
+  std::string affinity_;
+  // NUMA nodes with the CPUs this process may run on, node by node
+  std::vector<Node> nodes_;
+  std::vector<int> cpus_;
+  std::atomic<int> next_replica_;
+};
+
+} // namespace cpp2
@@ -0,0 +1,105 @@
+#include "ThriftStats.h"
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+
+#include <thrift/lib/cpp/TProcessor.h>
+
+#include "Stats.h"
+
+using apache::thrift::TProcessorBase;
+using apache::thrift::TProcessorEventHandler;
+using apache::thrift::TProcessorEventHandlerFactory;
+
+namespace cpp2 {
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+int64_t elapsedUs(Clock::time_point since) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+      Clock::now() - since).count();
+}
+
+// One call seen by the Thrift processor, from reading the request to
+// writing the reply.
+struct Call {
+  Clock::time_point read_start;
+  Clock::time_point read_end;
+  Clock::time_point write_start;
+};
+
+class ThriftStats : public TProcessorEventHandler {
+ public:
+  ThriftStats()
+      : deserialize_us_(Stats::instance().histogram("thrift.deserialize_us")),
+        handler_us_(Stats::instance().histogram("thrift.handler_us")),
+        serialize_us_(Stats::instance().histogram("thrift.serialize_us")),
+        calls_(Stats::instance().counter("thrift.calls")),
+        bytes_in_(Stats::instance().counter("thrift.bytes_in")),
+        bytes_out_(Stats::instance().counter("thrift.bytes_out")) {
+  }
+
+  void* getContext(const char* fn_name,
+      apache::thrift::server::TConnectionContext* context) override {
+    return new Call();
+  }
+
+  void freeContext(void* ctx, const char* fn_name) override {
+    delete static_cast<Call*>(ctx);
+  }
+
+  void preRead(void* ctx, const char* fn_name) override {
+    static_cast<Call*>(ctx)->read_start = Clock::now();
+  }
+
+  void postRead(void* ctx, const char* fn_name,
+      apache::thrift::transport::THeader* header, uint32_t bytes) override {
+    Call* call = static_cast<Call*>(ctx);
+    call->read_end = Clock::now();
+    deserialize_us_.add(std::chrono::duration_cast<std::chrono::microseconds>(
+        call->read_end - call->read_start).count());
+    calls_.add();
+    bytes_in_.add(bytes);
+  }
+
+  void preWrite(void* ctx, const char* fn_name) override {
+    Call* call = static_cast<Call*>(ctx);
+    call->write_start = Clock::now();
+    handler_us_.add(std::chrono::duration_cast<std::chrono::microseconds>(
+        call->write_start - call->read_end).count());
+  }
+
+  void postWrite(void* ctx, const char* fn_name, uint32_t bytes) override {
+    serialize_us_.add(elapsedUs(static_cast<Call*>(ctx)->write_start));
+    bytes_out_.add(bytes);
+  }
+
+ private:
+  Histogram& deserialize_us_;
+  Histogram& handler_us_;
+  Histogram& serialize_us_;
+  Counter& calls_;
+  Counter& bytes_in_;
+  Counter& bytes_out_;
+};
+
+class ThriftStatsFactory : public TProcessorEventHandlerFactory {
+ public:
+  std::shared_ptr<TProcessorEventHandler> getEventHandler() override {
+    static std::shared_ptr<TProcessorEventHandler> handler =
+        std::make_shared<ThriftStats>();
+    return handler;
+  }
+};
+
+} // namespace
+
+void installThriftStats() {
+  TProcessorBase::addProcessorEventHandlerFactory(
+      std::make_shared<ThriftStatsFactory>());
+}
+
+} // namespace cpp2
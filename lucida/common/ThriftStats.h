@@ -0,0 +1,11 @@
+#pragma once
+
+namespace cpp2 {
+
+// Makes every Thrift processor created from now on record in Stats the time
+// spent deserializing requests and serializing replies, the time between
+// the two, and the bytes read and written. Call before the server starts.
+// Kept apart from Stats so that tools without Thrift can use the latter.
+void installThriftStats();
+
+} // namespace cpp2
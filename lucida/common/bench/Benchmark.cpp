@@ -0,0 +1,96 @@
+#include "Benchmark.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+
+#include "LatencyHistogram.h"
+
+namespace cpp2 {
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+bool isNumber(const std::string& value) {
+  if (value.empty()) {
+    return false;
+  }
+  char* end = nullptr;
+  strtod(value.c_str(), &end);
+  return *end == '\0';
+}
+
+std::string quote(const std::string& value) {
+  std::string quoted = "\"";
+  for (char c : value) {
+    if (c == '"' || c == '\\') {
+      quoted += '\\';
+    }
+    quoted += c;
+  }
+  return quoted + "\"";
+}
+
+} // namespace
+
+Benchmark::Benchmark(double min_time_s, int min_iterations, double warmup_s,
+    std::ostream& out, std::ostream& log)
+    : min_time_s_(min_time_s), min_iterations_(std::max(1, min_iterations)),
+      warmup_s_(warmup_s), out_(out), log_(log) {
+}
+
+void Benchmark::run(const std::string& name, const Params& params,
+    const std::function<void()>& body, int64_t items, int64_t bytes) {
+  // at least one call, so caches and lazily built state are in place
+  Clock::time_point start = Clock::now();
+  do {
+    body();
+  } while (std::chrono::duration<double>(Clock::now() - start).count() <
+      warmup_s_);
+
+  LatencyHistogram ns;
+  start = Clock::now();
+  double elapsed = 0;
+  while (ns.count() < min_iterations_ || elapsed < min_time_s_) {
+    Clock::time_point call = Clock::now();
+    body();
+    Clock::time_point now = Clock::now();
+    ns.record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        now - call).count());
+    elapsed = std::chrono::duration<double>(now - start).count();
+  }
+
+  out_ << "{\"benchmark\": " << quote(name);
+  for (const auto& param : params) {
+    out_ << ", " << quote(param.first) << ": "
+         << (isNumber(param.second) ? param.second : quote(param.second));
+  }
+  out_ << std::fixed << std::setprecision(1)
+       << ", \"iterations\": " << ns.count()
+       << ", \"mean_ns\": " << ns.mean()
+       << ", \"min_ns\": " << ns.min()
+       << ", \"p50_ns\": " << ns.percentile(50)
+       << ", \"p99_ns\": " << ns.percentile(99)
+       << ", \"max_ns\": " << ns.max();
+  double seconds = ns.mean() / 1e9;
+  if (items > 0) {
+    out_ << ", \"items_per_s\": " << items / seconds;
+  }
+  if (bytes > 0) {
+    out_ << ", \"bytes_per_s\": " << bytes / seconds;
+  }
+  out_ << "}" << std::endl;
+
+  log_ << std::left << std::setw(24) << name;
+  for (const auto& param : params) {
+    log_ << " " << param.first << "=" << param.second;
+  }
+  log_ << std::fixed << std::setprecision(1) << "  mean "
+       << ns.mean() / 1000 << " us  p50 " << ns.percentile(50) / 1000.0
+       << " us  p99 " << ns.percentile(99) / 1000.0 << " us  ("
+       << ns.count() << " runs)" << std::endl;
+}
+
+} // namespace cpp2
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace cpp2 {
+
+// Minimal harness for the kernel benchmarks. Every case runs its body for a
+// warm-up, then at least min_iterations times and for at least min_time_s,
+// timing each call. Results go to out as one JSON object per line, so runs
+// of two builds can be diffed or loaded into a notebook, and to log as a
+// table for people.
+class Benchmark {
+ public:
+  // Case parameters, e.g. {"source", "1920x1080"}; numbers are written
+  // unquoted.
+  typedef std::vector<std::pair<std::string, std::string>> Params;
+
+  Benchmark(double min_time_s, int min_iterations, double warmup_s,
+      std::ostream& out = std::cout, std::ostream& log = std::cerr);
+
+  // Times body. items and bytes are what one call processes, to report
+  // throughput; 0 leaves them out.
+  void run(const std::string& name, const Params& params,
+      const std::function<void()>& body, int64_t items = 0,
+      int64_t bytes = 0);
+
+ private:
+  double min_time_s_;
+  int min_iterations_;
+  double warmup_s_;
+  std::ostream& out_;
+  std::ostream& log_;
+};
+
+} // namespace cpp2
@@ -0,0 +1,81 @@
+#include "LatencyHistogram.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace cpp2 {
+
+namespace {
+
+const int kExact = 2048;
+const int kHalf = 1024;
+
+} // namespace
+
+LatencyHistogram::LatencyHistogram(int64_t highest)
+    : highest_(std::max<int64_t>(highest, 1)),
+      counts_(index(highest_) + 1),
+      count_(0),
+      sum_(0),
+      min_(INT64_MAX),
+      max_(0) {
+}
+
+int LatencyHistogram::index(int64_t value) {
+  if (value < kExact) {
+    return value;
+  }
+  // keep the 11 leading bits, the top one is implied by the shift
+  int shift = 63 - __builtin_clzll(value) - 10;
+  int sub = value >> shift;
+  return kExact + (shift - 1) * kHalf + (sub - kHalf);
+}
+
+int64_t LatencyHistogram::highestEquivalent(int index) {
+  if (index < kExact) {
+    return index;
+  }
+  int shift = (index - kExact) / kHalf + 1;
+  int64_t sub = (index - kExact) % kHalf + kHalf;
+  return ((sub + 1) << shift) - 1;
+}
+
+void LatencyHistogram::record(int64_t value) {
+  value = std::min(std::max<int64_t>(value, 0), highest_);
+  ++counts_[index(value)];
+  ++count_;
+  sum_ += value;
+  min_ = std::min(min_, value);
+  max_ = std::max(max_, value);
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other) {
+  if (other.counts_.size() > counts_.size()) {
+    counts_.resize(other.counts_.size());
+    highest_ = other.highest_;
+  }
+  for (size_t i = 0; i < other.counts_.size(); ++i) {
+    counts_[i] += other.counts_[i];
+  }
+  count_ += other.count_;
+  sum_ += other.sum_;
+  min_ = std::min(min_, other.min_);
+  max_ = std::max(max_, other.max_);
+}
+
+int64_t LatencyHistogram::percentile(double p) const {
+  if (count_ == 0) {
+    return 0;
+  }
+  int64_t rank = std::max<int64_t>(1, (int64_t) std::ceil(count_ * p / 100));
+  int64_t seen = 0;
+  for (size_t i = 0; i < counts_.size(); ++i) {
+    seen += counts_[i];
+    if (seen >= rank) {
+      return std::min(highestEquivalent(i), max_);
+    }
+  }
+  return max_;
+}
+
+} // namespace cpp2
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace cpp2 {
+
+// Latency recorder in the manner of HdrHistogram: values up to 2047 are
+// counted exactly and larger ones in 1024 buckets per power of two, so every
+// reported value is within 0.1% of the true one. Not thread safe; record
+// per thread and merge.
+class LatencyHistogram {
+ public:
+  // Values above highest are counted as highest.
+  explicit LatencyHistogram(int64_t highest = int64_t(1) << 36);
+
+  void record(int64_t value);
+  void merge(const LatencyHistogram& other);
+
+  int64_t count() const { return count_; }
+  int64_t min() const { return count_ ? min_ : 0; }
+  int64_t max() const { return max_; }
+  double mean() const { return count_ ? (double) sum_ / count_ : 0; }
+  // Highest value equivalent to the p-th percentile (0 <= p <= 100), 0 if
+  // nothing was recorded.
+  int64_t percentile(double p) const;
+
+ private:
+  static int index(int64_t value);
+  static int64_t highestEquivalent(int index);
+
+  int64_t highest_;
+  std::vector<int64_t> counts_;
+  int64_t count_;
+  int64_t sum_;
+  int64_t min_;
+  int64_t max_;
+};
+
+} // namespace cpp2
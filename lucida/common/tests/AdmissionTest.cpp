@@ -0,0 +1,159 @@
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "../Admission.h"
+
+DECLARE_int32(max_in_flight);
+DECLARE_int32(max_pending);
+
+using namespace cpp2;
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+// A request that holds its slot until finish() is called.
+struct Held {
+  folly::Promise<int> promise;
+  bool started = false;
+
+  std::function<folly::Future<int>()> work() {
+    return [this]() {
+      started = true;
+      return promise.getFuture();
+    };
+  }
+  void finish(int value) { promise.setValue(value); }
+};
+
+bool ready(folly::Future<int>& future) {
+  return future.isReady();
+}
+
+// Waits up to timeout for future to complete.
+bool waitFor(folly::Future<int>& future, std::chrono::milliseconds timeout) {
+  auto until = Clock::now() + timeout;
+  while (!ready(future) && Clock::now() < until) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return ready(future);
+}
+
+void testOrder() {
+  FLAGS_max_in_flight = 2;
+  FLAGS_max_pending = 3;
+  Admission admission;
+  std::vector<std::unique_ptr<Held>> held;
+  std::vector<folly::Future<int>> futures;
+  for (int i = 0; i < 5; ++i) {
+    held.emplace_back(new Held());
+    futures.push_back(
+        admission.run<int>(Deadline::max(), held.back()->work()));
+  }
+  // two run, three wait, and a sixth does not even queue
+  CHECK(held[0]->started && held[1]->started);
+  CHECK(!held[2]->started && !held[3]->started && !held[4]->started);
+  Held rejected;
+  auto overloaded = admission.run<int>(Deadline::max(), rejected.work());
+  CHECK(ready(overloaded));
+  CHECK(overloaded.getTry().hasException());
+  CHECK(!rejected.started);
+  CHECK_EQ(admission.rejected(), 1u);
+
+  // every slot that frees up goes to the oldest waiter
+  held[1]->finish(1);
+  CHECK_EQ(futures[1].get(), 1);
+  CHECK(held[2]->started && !held[3]->started);
+  held[0]->finish(0);
+  CHECK(held[3]->started && !held[4]->started);
+  held[3]->finish(3);
+  CHECK(held[4]->started);
+  held[2]->finish(2);
+  held[4]->finish(4);
+  for (int i = 0; i < 5; ++i) {
+    CHECK_EQ(futures[i].get(), i);
+  }
+  CHECK_EQ(admission.admitted(), 5u);
+}
+
+void testDeadlines() {
+  FLAGS_max_in_flight = 1;
+  FLAGS_max_pending = 10;
+  Admission admission;
+  Held first;
+  auto running = admission.run<int>(Deadline::max(), first.work());
+
+  // past its deadline on arrival, it never starts
+  Held late;
+  auto past = admission.run<int>(Clock::now() - std::chrono::seconds(1),
+      late.work());
+  CHECK(ready(past));
+  CHECK(isExpiredError(past.getTry().exception()));
+
+  // waiters fail once their deadline passes, while the slot is still taken
+  // and out of arrival order
+  Held slow, quick, patient;
+  auto slow_future = admission.run<int>(
+      Clock::now() + std::chrono::milliseconds(300), slow.work());
+  auto quick_future = admission.run<int>(
+      Clock::now() + std::chrono::milliseconds(50), quick.work());
+  auto patient_future = admission.run<int>(Deadline::max(), patient.work());
+  auto start = Clock::now();
+  CHECK(waitFor(quick_future, std::chrono::seconds(5)));
+  CHECK(isExpiredError(quick_future.getTry().exception()));
+  CHECK(!ready(slow_future));
+  CHECK(waitFor(slow_future, std::chrono::seconds(5)));
+  CHECK(isExpiredError(slow_future.getTry().exception()));
+  CHECK_GE(Clock::now() - start, std::chrono::milliseconds(250));
+  CHECK(!quick.started && !slow.started);
+  CHECK_EQ(admission.expiredCount(), 3u);
+
+  // the slot then goes to the one still in time
+  CHECK(!ready(patient_future));
+  first.finish(1);
+  CHECK(patient.started);
+  patient.finish(2);
+  CHECK_EQ(patient_future.get(), 2);
+}
+
+void testSynchronousCompletions() {
+  // requests that complete as they start release from within the start of
+  // the next one; a long queue of them must not run out of stack
+  const int kRequests = 200000;
+  FLAGS_max_in_flight = 1;
+  FLAGS_max_pending = kRequests;
+  Admission admission;
+  Held first;
+  auto running = admission.run<int>(Deadline::max(), first.work());
+  std::vector<folly::Future<int>> futures;
+  futures.reserve(kRequests);
+  for (int i = 0; i < kRequests; ++i) {
+    futures.push_back(admission.run<int>(Deadline::max(),
+        [i]() { return folly::makeFuture(i); }));
+  }
+  first.finish(-1);
+  for (int i = 0; i < kRequests; ++i) {
+    CHECK(ready(futures[i])) << i;
+    CHECK_EQ(futures[i].get(), i);
+  }
+  CHECK_EQ(admission.admitted(), kRequests + 1u);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+
+  testOrder();
+  testDeadlines();
+  testSynchronousCompletions();
+  LOG(ERROR) << "Admission tests passed";
+  return 0;
+}
@@ -0,0 +1,195 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+extern "C" {
+#include <cblas.h>
+}
+
+#include "../../common/bench/Benchmark.h"
+#include "../tools/Int8Kernels.h"
+
+DEFINE_double(min_time_s, 1.0, "Time every case for at least this long");
+DEFINE_int32(min_iterations, 10, "Run every case at least this many times");
+DEFINE_double(warmup_s, 0.2, "Run every case untimed for this long first");
+DEFINE_string(batch_sizes, "1,4,16",
+              "Images per forward pass of the inner product layers");
+
+using namespace cpp2;
+
+namespace {
+
+struct Layer {
+  const char* name;
+  bool convolution;
+  int outputs;  // rows of weights
+  int k;        // weights per output
+  int pixels;   // output pixels per image of a convolution
+};
+
+// IMC's (AlexNet) first and a middle convolution and its inner products
+const Layer kLayers[] = {
+  {"conv1", true, 96, 363, 55 * 55},
+  {"conv3", true, 384, 2304, 13 * 13},
+  {"fc6", false, 4096, 9216, 1},
+  {"fc7", false, 4096, 4096, 1},
+  {"fc8", false, 1000, 4096, 1},
+};
+
+std::vector<float> randomFloats(size_t n, std::mt19937* rng) {
+  std::uniform_real_distribution<float> value(-1.0f, 1.0f);
+  std::vector<float> data(n);
+  for (float& x : data) {
+    x = value(*rng);
+  }
+  return data;
+}
+
+// rows of k floats quantized to rows of int8RowLength(k), zero padded
+std::vector<int8_t> quantizeRows(const std::vector<float>& data, int rows,
+    int k) {
+  int row = int8RowLength(k);
+  std::vector<int8_t> q((size_t) rows * row, 0);
+  for (int i = 0; i < rows; ++i) {
+    quantizeInt8(data.data() + (size_t) i * k, k, 127.0f,
+        q.data() + (size_t) i * row);
+  }
+  return q;
+}
+
+// The tiled product against a plain loop over the same int8 operands, so
+// that a broken kernel cannot look fast.
+void checkGemm(const std::vector<int8_t>& a, int m,
+    const std::vector<int8_t>& b, int n, int k) {
+  int row = int8RowLength(k);
+  std::vector<float> scales(std::max(m, n));
+  for (size_t i = 0; i < scales.size(); ++i) {
+    scales[i] = 1.0f + i % 3;
+  }
+  Int8Scales epilogue = {0.5f, scales.data(), scales.data(), scales.data(),
+      scales.data()};
+  std::vector<float> out((size_t) m * n);
+  gemmInt8(a.data(), m, b.data(), n, row, epilogue, out.data());
+  for (int i = 0; i < m; ++i) {
+    for (int j = 0; j < n; ++j) {
+      int32_t sum = 0;
+      for (int p = 0; p < k; ++p) {
+        sum += a[(size_t) i * row + p] * b[(size_t) j * row + p];
+      }
+      float expected = sum * 0.5f * scales[i] * scales[j] + scales[i] +
+          scales[j];
+      CHECK_LE(std::fabs(out[(size_t) i * n + j] - expected),
+          1e-4f * std::max(1.0f, std::fabs(expected)))
+          << "gemmInt8 " << m << "x" << n << "x" << k << " at " << i << ","
+          << j;
+    }
+  }
+}
+
+} // namespace
+
+// Times the int8 products of Int8Net against the fp32 BLAS GEMM Caffe runs
+// for the same layers, one JSON line per case on stdout. items_per_s counts
+// multiply-adds.
+int main(int argc, char* argv[]) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+
+  std::vector<int> batches;
+  std::stringstream ss(FLAGS_batch_sizes);
+  for (std::string size; getline(ss, size, ','); ) {
+    if (atoi(size.c_str()) > 0) {
+      batches.push_back(atoi(size.c_str()));
+    }
+  }
+
+  // ragged shapes exercise the edges of the tiles
+  std::mt19937 rng(42);
+  for (int m : {1, 3, 4, 9}) {
+    for (int n : {1, 5, 8, 37}) {
+      for (int k : {7, 16, 50}) {
+        checkGemm(quantizeRows(randomFloats((size_t) m * k, &rng), m, k), m,
+            quantizeRows(randomFloats((size_t) n * k, &rng), n, k), n, k);
+      }
+    }
+  }
+
+  Benchmark bench(FLAGS_min_time_s, FLAGS_min_iterations, FLAGS_warmup_s);
+  for (const Layer& layer : kLayers) {
+    int row = int8RowLength(layer.k);
+    std::vector<float> weights =
+        randomFloats((size_t) layer.outputs * layer.k, &rng);
+    std::vector<int8_t> q_weights =
+        quantizeRows(weights, layer.outputs, layer.k);
+    std::vector<float> scales(layer.outputs, 1.0f / 127);
+
+    if (layer.convolution) {
+      // one image: weights x columns, as Caffe and Int8Net run it
+      std::vector<float> columns =
+          randomFloats((size_t) layer.k * layer.pixels, &rng);
+      std::vector<int8_t> q_columns =
+          quantizeRows(columns, layer.pixels, layer.k);
+      checkGemm(q_weights, layer.outputs, q_columns, 8, layer.k);
+      std::vector<float> out((size_t) layer.outputs * layer.pixels);
+      int64_t macs = (int64_t) layer.outputs * layer.pixels * layer.k;
+      Benchmark::Params params = {{"layer", layer.name},
+          {"m", std::to_string(layer.outputs)},
+          {"n", std::to_string(layer.pixels)},
+          {"k", std::to_string(layer.k)}};
+      bench.run("sgemm", params, [&] {
+        cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasNoTrans, layer.outputs,
+            layer.pixels, layer.k, 1.0f, weights.data(), layer.k,
+            columns.data(), layer.pixels, 0.0f, out.data(), layer.pixels);
+      }, macs);
+      Int8Scales epilogue = {1.0f / 127, scales.data(), nullptr, nullptr,
+          nullptr};
+      bench.run("gemmInt8", params, [&] {
+        gemmInt8(q_weights.data(), layer.outputs, q_columns.data(),
+            layer.pixels, row, epilogue, out.data());
+      }, macs);
+      continue;
+    }
+
+    for (int batch : batches) {
+      // images x weights, top comes out as batch x outputs
+      std::vector<float> input = randomFloats((size_t) batch * layer.k, &rng);
+      std::vector<int8_t> q_input = quantizeRows(input, batch, layer.k);
+      std::vector<float> out((size_t) batch * layer.outputs);
+      int64_t macs = (int64_t) batch * layer.outputs * layer.k;
+      Benchmark::Params params = {{"layer", layer.name},
+          {"m", std::to_string(batch)},
+          {"n", std::to_string(layer.outputs)},
+          {"k", std::to_string(layer.k)}};
+      bench.run("sgemm", params, [&] {
+        cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans, batch,
+            layer.outputs, layer.k, 1.0f, input.data(), layer.k,
+            weights.data(), layer.k, 0.0f, out.data(), layer.outputs);
+      }, macs);
+      Int8Scales epilogue = {1.0f / 127, nullptr, scales.data(), nullptr,
+          nullptr};
+      bench.run("gemmInt8", params, [&] {
+        gemmInt8(q_input.data(), batch, q_weights.data(), layer.outputs,
+            row, epilogue, out.data());
+      }, macs);
+      // one product per image, which streams the weights once per image
+      Int8Scales per_image = {1.0f / 127, scales.data(), nullptr, nullptr,
+          nullptr};
+      bench.run("gemmInt8_per_image", params, [&] {
+        for (int item = 0; item < batch; ++item) {
+          gemmInt8(q_weights.data(), layer.outputs,
+              q_input.data() + (size_t) item * row, 1, row, per_image,
+              out.data() + (size_t) item * layer.outputs);
+        }
+      }, macs);
+    }
+  }
+  return 0;
+}
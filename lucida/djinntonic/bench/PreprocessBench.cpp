@@ -0,0 +1,162 @@
+#include <cstdint>
+#include <cstdlib>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <jpeglib.h>
+
+#include "../../common/bench/Benchmark.h"
+#include "../tools/Preprocess.h"
+
+DEFINE_double(min_time_s, 1.0, "Time every case for at least this long");
+DEFINE_int32(min_iterations, 10, "Run every case at least this many times");
+DEFINE_double(warmup_s, 0.2, "Run every case untimed for this long first");
+DEFINE_string(sizes, "64x64,320x240,640x480,1280x720,1920x1080,4032x3024",
+              "Source image sizes, as WxH");
+DEFINE_int32(quality, 90, "JPEG quality of the synthetic images");
+
+DECLARE_bool(jpeg_dct_scaling);
+
+using namespace cpp2;
+
+namespace {
+
+struct Target {
+  const char* model;
+  int channels;
+  int size;
+};
+
+// the input blobs of the three services
+const Target kTargets[] = {{"DIG", 1, 28}, {"FACE", 3, 152}, {"IMC", 3, 227}};
+
+// A smooth gradient with some noise, so that the JPEG has the size and
+// decoding cost of a photo rather than of a flat image.
+std::vector<unsigned char> syntheticPixels(int width, int height,
+    int channels) {
+  std::mt19937 rng(width * 31 + height);
+  std::uniform_int_distribution<int> noise(-24, 24);
+  std::vector<unsigned char> pixels((size_t) width * height * channels);
+  size_t i = 0;
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      for (int c = 0; c < channels; ++c) {
+        int value = (x * 255 / width + y * 255 / height) / 2 + c * 40 +
+            noise(rng);
+        pixels[i++] = std::min(255, std::max(0, value));
+      }
+    }
+  }
+  return pixels;
+}
+
+std::string encodeJpeg(const std::vector<unsigned char>& pixels, int width,
+    int height, int channels) {
+  struct jpeg_compress_struct cinfo;
+  struct jpeg_error_mgr jerr;
+  cinfo.err = jpeg_std_error(&jerr);
+  jpeg_create_compress(&cinfo);
+  unsigned char* buffer = nullptr;
+  unsigned long size = 0;
+  jpeg_mem_dest(&cinfo, &buffer, &size);
+  cinfo.image_width = width;
+  cinfo.image_height = height;
+  cinfo.input_components = channels;
+  cinfo.in_color_space = channels == 1 ? JCS_GRAYSCALE : JCS_RGB;
+  jpeg_set_defaults(&cinfo);
+  jpeg_set_quality(&cinfo, FLAGS_quality, TRUE);
+  jpeg_start_compress(&cinfo, TRUE);
+  while (cinfo.next_scanline < cinfo.image_height) {
+    JSAMPROW row = (JSAMPROW) &pixels[
+        (size_t) cinfo.next_scanline * width * channels];
+    jpeg_write_scanlines(&cinfo, &row, 1);
+  }
+  jpeg_finish_compress(&cinfo);
+  jpeg_destroy_compress(&cinfo);
+  std::string jpeg((const char*) buffer, size);
+  free(buffer);
+  return jpeg;
+}
+
+std::string dims(int width, int height) {
+  return std::to_string(width) + "x" + std::to_string(height);
+}
+
+} // namespace
+
+// Times the JPEG decode and resize of the services' request path on
+// synthetic images of --sizes, one JSON line per case on stdout.
+int main(int argc, char* argv[]) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+
+  std::vector<std::pair<int, int>> sizes;
+  std::stringstream ss(FLAGS_sizes);
+  for (std::string size; getline(ss, size, ','); ) {
+    int width = 0, height = 0;
+    if (sscanf(size.c_str(), "%dx%d", &width, &height) != 2 ||
+        width <= 0 || height <= 0) {
+      LOG(ERROR) << "Bad size " << size;
+      return 1;
+    }
+    sizes.emplace_back(width, height);
+  }
+
+  Benchmark bench(FLAGS_min_time_s, FLAGS_min_iterations, FLAGS_warmup_s);
+  // sized for full scale decodes, so that no case times a buffer growing
+  FLAGS_jpeg_dct_scaling = false;
+  for (const Target& target : kTargets) {
+    reserveScratch(target.channels, target.size, target.size);
+  }
+
+  for (const auto& size : sizes) {
+    int width = size.first;
+    int height = size.second;
+    for (int channels : {1, 3}) {
+      std::vector<unsigned char> pixels =
+          syntheticPixels(width, height, channels);
+      std::string jpeg = encodeJpeg(pixels, width, height, channels);
+      for (const Target& target : kTargets) {
+        if (target.channels != channels) {
+          continue;
+        }
+        std::vector<float> input((size_t) channels * target.size *
+            target.size);
+        Benchmark::Params params = {
+          {"model", target.model}, {"source", dims(width, height)},
+          {"channels", std::to_string(channels)},
+          {"jpeg_bytes", std::to_string(jpeg.size())}};
+
+        // whole request path, with and without decoding at a reduced scale
+        for (bool scaling : {true, false}) {
+          FLAGS_jpeg_dct_scaling = scaling;
+          Benchmark::Params decode_params = params;
+          decode_params.emplace_back("dct_scaling", scaling ? "1" : "0");
+          bench.run("decodeJpeg", decode_params, [&] {
+            std::string error;
+            CHECK(decodeJpeg(jpeg.data(), jpeg.size(), channels,
+                target.size, target.size, input.data(), &error)) << error;
+          }, 1, jpeg.size());
+        }
+        FLAGS_jpeg_dct_scaling = true;
+
+        // the resize alone, from the full size image: shrinking both axes
+        // averages boxes, growing both picks the nearest pixel and
+        // anything in between mixes the two
+        const char* branch = width <= target.size && height <= target.size ?
+            "grow" : width >= target.size && height >= target.size ?
+            "shrink" : "mixed";
+        params.emplace_back("branch", branch);
+        bench.run("resizeToPlanar", params, [&] {
+          resizeToPlanar(pixels.data(), width, height, channels,
+              target.size, target.size, input.data());
+        }, 1, pixels.size());
+      }
+    }
+  }
+  return 0;
+}
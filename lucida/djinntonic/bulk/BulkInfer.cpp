@@ -0,0 +1,421 @@
+#include <sys/stat.h>
+#include <dirent.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "../../common/ThreadBudget.h"
+#include "../tools/Backend.h"
+#include "../tools/Preprocess.h"
+#include "../tools/ScratchArena.h"
+#include "BoundedQueue.h"
+
+DEFINE_string(input, "", "Directory of JPEGs, or a file listing one path per "
+              "line");
+DEFINE_string(output, "", "File to write the results to (default: stdout)");
+DEFINE_string(format, "csv", "Output format, csv or jsonl (default: csv)");
+DEFINE_string(network, "", "Network config of the model");
+DEFINE_string(weights, "", "Weights of the model, .caffemodel or converted");
+DEFINE_string(backend, "caffe", "Inference backend, caffe or int8 "
+              "(default: caffe)");
+DEFINE_string(classes, "", "Class names, one per line after an id, as the "
+              "FACE and IMC servers read them (default: none, write the "
+              "class index)");
+DEFINE_int32(class_offset, 0, "Class index of the first line of --classes, "
+             "1 for FACE (default: 0)");
+DEFINE_int32(read_threads, 2, "Threads reading files (default: 2)");
+DEFINE_int32(decode_threads, 0, "Threads decoding JPEGs (default: one per "
+             "core, or the --thread_budget)");
+DEFINE_int32(forward_threads, 2, "Net replicas running forward passes "
+             "(default: 2, or as many as fit in the --thread_budget)");
+DEFINE_int32(batch_size, 16, "Images per forward pass (default: 16)");
+DEFINE_int32(queue_size, 0, "Capacity of the queues between stages "
+             "(default: 4 batches per replica)");
+DEFINE_double(report_s, 10, "Log progress every this many seconds, 0 for "
+              "never (default: 10)");
+
+using namespace cpp2;
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+int64_t nanosSince(Clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      Clock::now() - start).count();
+}
+
+// Time the threads of one stage spent working, waiting for input (starved)
+// and waiting for room downstream (blocked), summed over the threads.
+struct Stage {
+  const char* name;
+  int threads;
+  std::atomic<int64_t> busy_ns{0};
+  std::atomic<int64_t> starved_ns{0};
+  std::atomic<int64_t> blocked_ns{0};
+  std::atomic<int64_t> items{0};
+
+  Stage(const char* name, int threads) : name(name), threads(threads) {}
+};
+
+// timed pop and push, charged to the stage waiting on them
+template <typename T>
+bool pop(BoundedQueue<T>* queue, T* item, Stage* stage) {
+  auto start = Clock::now();
+  bool ok = queue->pop(item);
+  stage->starved_ns += nanosSince(start);
+  return ok;
+}
+
+template <typename T>
+void push(BoundedQueue<T>* queue, T item, Stage* stage) {
+  auto start = Clock::now();
+  queue->push(std::move(item));
+  stage->blocked_ns += nanosSince(start);
+}
+
+struct Item {
+  size_t index;
+  std::string bytes;
+  // C * H * W floats once decoded, empty if the image failed
+  std::vector<float> pixels;
+  std::string reply;
+  bool ok;
+};
+
+// The files of a directory in name order, hidden ones skipped, or the lines
+// of a list file.
+std::vector<std::string> listInput(const std::string& input) {
+  std::vector<std::string> paths;
+  struct stat st;
+  if (stat(input.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+    if (DIR* dir = opendir(input.c_str())) {
+      while (dirent* entry = readdir(dir)) {
+        if (entry->d_name[0] != '.') {
+          paths.push_back(input + "/" + entry->d_name);
+        }
+      }
+      closedir(dir);
+    }
+    std::sort(paths.begin(), paths.end());
+  } else {
+    std::ifstream list(input);
+    std::string line;
+    while (std::getline(list, line)) {
+      if (!line.empty()) {
+        paths.push_back(line);
+      }
+    }
+  }
+  return paths;
+}
+
+// the class file format of the FACE and IMC handlers, an id and the name
+std::vector<std::string> readClasses(const std::string& path) {
+  std::vector<std::string> classes;
+  std::ifstream file(path);
+  std::string id;
+  std::string name;
+  while (file >> id) {
+    file.get();
+    std::getline(file, name);
+    classes.push_back(name);
+  }
+  return classes;
+}
+
+std::string csvField(const std::string& value) {
+  if (value.find_first_of(",\"\n\r") == std::string::npos) {
+    return value;
+  }
+  std::string quoted = "\"";
+  for (char c : value) {
+    quoted += c;
+    if (c == '"') {
+      quoted += '"';
+    }
+  }
+  return quoted + "\"";
+}
+
+std::string jsonString(const std::string& value) {
+  std::ostringstream out;
+  out << '"';
+  for (unsigned char c : value) {
+    if (c == '"' || c == '\\') {
+      out << '\\' << c;
+    } else if (c < 0x20) {
+      out << "\\u" << std::hex << std::setw(4) << std::setfill('0')
+          << (int) c << std::dec;
+    } else {
+      out << c;
+    }
+  }
+  out << '"';
+  return out.str();
+}
+
+void logProgress(size_t done, size_t total, int64_t elapsed_ns) {
+  double seconds = elapsed_ns / 1e9;
+  LOG(ERROR) << done << " of " << total << " images in " << std::fixed
+             << std::setprecision(1) << seconds << " s, "
+             << (seconds > 0 ? done / seconds : 0) << " images/s";
+}
+
+} // namespace
+
+// Classifies every image in --input with one model, without a server:
+// readers load the files, decoders turn them into input tensors the same way
+// the servers do, every replica runs batches of --batch_size through its
+// forward pass and a writer prints one line per image, in completion order.
+// Bounded queues between the stages keep memory flat however many images
+// there are. At the end, images/s and the share of time every stage spent
+// working, waiting for input and waiting on the next stage are logged; the
+// stage that is busy all the time is the bottleneck.
+int main(int argc, char* argv[]) {
+  google::InitGoogleLogging(argv[0]);
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  if (FLAGS_input.empty() || FLAGS_network.empty() ||
+      FLAGS_weights.empty() ||
+      (FLAGS_format != "csv" && FLAGS_format != "jsonl")) {
+    std::cerr << "Usage: " << argv[0] << " --input <dir or list> --network "
+              << "<prototxt> --weights <weights> [--format csv|jsonl] "
+              << "[--output <file>] [--classes <file>]" << std::endl;
+    return -1;
+  }
+
+  std::vector<std::string> paths = listInput(FLAGS_input);
+  std::vector<std::string> classes;
+  if (!FLAGS_classes.empty()) {
+    classes = readClasses(FLAGS_classes);
+  }
+  std::ofstream file;
+  if (!FLAGS_output.empty()) {
+    file.open(FLAGS_output);
+    if (!file) {
+      LOG(ERROR) << "Cannot write " << FLAGS_output;
+      return -1;
+    }
+  }
+  std::ostream& out = FLAGS_output.empty() ? std::cout : file;
+
+  ThreadBudget& budget = ThreadBudget::instance();
+  int replicas = budget.replicas(std::max(1, FLAGS_forward_threads));
+  int decoders = budget.executorThreads(FLAGS_decode_threads > 0 ?
+      FLAGS_decode_threads :
+      std::max(1, (int) std::thread::hardware_concurrency()));
+  int readers = std::max(1, FLAGS_read_threads);
+  int batch = std::max(1, FLAGS_batch_size);
+  std::unique_ptr<Backend> nets;
+  try {
+    nets = makeBackend(FLAGS_backend, FLAGS_network, FLAGS_weights, replicas);
+  } catch (const std::exception& e) {
+    LOG(ERROR) << "Cannot load " << FLAGS_network << ": " << e.what();
+    return -1;
+  }
+  const int channels = nets->channels();
+  const int height = nets->height();
+  const int width = nets->width();
+  const size_t in_size = (size_t) channels * height * width;
+  reserveScratch(channels, height, width);
+  nets->reserveScratch(batch);
+  size_t capacity = FLAGS_queue_size > 0 ? FLAGS_queue_size :
+      4 * batch * replicas;
+  LOG(ERROR) << paths.size() << " images, " << readers << " readers, "
+             << decoders << " decoders, " << replicas << " "
+             << nets->name() << " replicas of batch " << batch
+             << ", queues of " << capacity;
+
+  BoundedQueue<Item> read_queue(capacity);
+  BoundedQueue<Item> decoded_queue(capacity);
+  BoundedQueue<Item> reply_queue(capacity);
+  // decoded tensors go back to the decoders once they are in an input
+  // buffer, so that steady state allocates nothing
+  BoundedQueue<std::vector<float>> free_pixels(2 * capacity);
+
+  Stage read("read", readers);
+  Stage decode("decode", decoders);
+  Stage forward("forward", replicas);
+  Stage write("write", 1);
+  std::atomic<size_t> next_path(0);
+  auto start = Clock::now();
+
+  std::vector<std::thread> read_threads;
+  for (int t = 0; t < readers; ++t) {
+    read_threads.emplace_back([&]() {
+      for (size_t i = next_path++; i < paths.size(); i = next_path++) {
+        auto begin = Clock::now();
+        Item item;
+        item.index = i;
+        item.ok = true;
+        std::ifstream in(paths[i], std::ios::binary);
+        if (in) {
+          item.bytes.assign(std::istreambuf_iterator<char>(in),
+              std::istreambuf_iterator<char>());
+        } else {
+          item.ok = false;
+          item.reply = "cannot read file";
+        }
+        read.busy_ns += nanosSince(begin);
+        ++read.items;
+        push(&read_queue, std::move(item), &read);
+      }
+    });
+  }
+
+  std::vector<std::thread> decode_threads;
+  for (int t = 0; t < decoders; ++t) {
+    decode_threads.emplace_back([&, t]() {
+      ThreadBudget::instance().pin(ThreadBudget::EXECUTOR, t);
+      ScratchArena::get();
+      Item item;
+      while (pop(&read_queue, &item, &decode)) {
+        auto begin = Clock::now();
+        if (item.ok) {
+          free_pixels.tryPop(&item.pixels);
+          item.pixels.resize(in_size);
+          item.ok = decodeJpeg(item.bytes.data(), item.bytes.size(),
+              channels, height, width, item.pixels.data(), &item.reply);
+        }
+        std::string().swap(item.bytes);
+        decode.busy_ns += nanosSince(begin);
+        ++decode.items;
+        push(&decoded_queue, std::move(item), &decode);
+      }
+    });
+  }
+
+  std::vector<std::thread> forward_threads;
+  int first = budget.assignReplicas(replicas);
+  for (int r = 0; r < replicas; ++r) {
+    forward_threads.emplace_back([&, r]() {
+      ThreadBudget::instance().pin(ThreadBudget::REPLICA, first + r);
+      std::vector<float> output;
+      std::vector<Item> items;
+      Item item;
+      while (true) {
+        // a full batch, or what is left at the end
+        items.clear();
+        while ((int) items.size() < batch &&
+            pop(&decoded_queue, &item, &forward)) {
+          if (item.ok) {
+            items.push_back(std::move(item));
+          } else {
+            free_pixels.tryPush(std::move(item.pixels));
+            push(&reply_queue, std::move(item), &forward);
+          }
+        }
+        if (items.empty()) {
+          break;
+        }
+        auto begin = Clock::now();
+        int n = items.size();
+        float* in_data = nets->input(r, n);
+        for (int i = 0; i < n; ++i) {
+          std::copy(items[i].pixels.begin(), items[i].pixels.end(),
+              in_data + i * in_size);
+          free_pixels.tryPush(std::move(items[i].pixels));
+        }
+        output.resize((size_t) n * nets->outputSize());
+        nets->forward(r, n, output.data(), false);
+        // the nets end in an argmax layer, one class index per image
+        for (int i = 0; i < n; ++i) {
+          int label = int(output[(size_t) i * nets->outputSize()]);
+          int k = label - FLAGS_class_offset;
+          items[i].reply = k >= 0 && k < (int) classes.size() ?
+              classes[k] : std::to_string(label);
+        }
+        forward.busy_ns += nanosSince(begin);
+        forward.items += n;
+        for (auto& done : items) {
+          push(&reply_queue, std::move(done), &forward);
+        }
+      }
+    });
+  }
+
+  std::thread write_thread([&]() {
+    if (FLAGS_format == "csv") {
+      out << "path,label,error\n";
+    }
+    Item item;
+    while (pop(&reply_queue, &item, &write)) {
+      auto begin = Clock::now();
+      const std::string& path = paths[item.index];
+      if (FLAGS_format == "csv") {
+        out << csvField(path) << ','
+            << (item.ok ? csvField(item.reply) : "") << ','
+            << (item.ok ? "" : csvField(item.reply)) << '\n';
+      } else {
+        out << "{\"path\": " << jsonString(path) << ", \""
+            << (item.ok ? "label" : "error") << "\": "
+            << jsonString(item.reply) << "}\n";
+      }
+      write.busy_ns += nanosSince(begin);
+      ++write.items;
+    }
+    out.flush();
+  });
+
+  // progress until the last stage is done, then each stage closes the
+  // queue behind it once all of its threads finished
+  std::atomic<bool> finished(false);
+  std::thread report_thread([&]() {
+    auto period = std::chrono::milliseconds((int64_t) (FLAGS_report_s * 1000));
+    auto next = Clock::now() + period;
+    while (!finished && FLAGS_report_s > 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      if (Clock::now() >= next) {
+        logProgress(write.items, paths.size(), nanosSince(start));
+        next += period;
+      }
+    }
+  });
+  for (auto& thread : read_threads) {
+    thread.join();
+  }
+  read_queue.close();
+  for (auto& thread : decode_threads) {
+    thread.join();
+  }
+  decoded_queue.close();
+  for (auto& thread : forward_threads) {
+    thread.join();
+  }
+  reply_queue.close();
+  write_thread.join();
+  finished = true;
+  report_thread.join();
+
+  int64_t elapsed_ns = nanosSince(start);
+  logProgress(write.items, paths.size(), elapsed_ns);
+  std::ostringstream table;
+  table << std::fixed << std::setprecision(1) << "stage    threads  items"
+        << "      busy%  starved%  blocked%\n";
+  for (const Stage* stage : {&read, &decode, &forward, &write}) {
+    double total = (double) elapsed_ns * stage->threads;
+    table << std::left << std::setw(9) << stage->name << std::right
+          << std::setw(7) << stage->threads << std::setw(11)
+          << stage->items.load() << std::setw(7)
+          << 100 * stage->busy_ns / total << std::setw(10)
+          << 100 * stage->starved_ns / total << std::setw(10)
+          << 100 * stage->blocked_ns / total << "\n";
+  }
+  LOG(ERROR) << "Stage utilization:\n" << table.str();
+  return 0;
+}
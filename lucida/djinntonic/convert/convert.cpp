@@ -0,0 +1,49 @@
+#include <algorithm>
+#include <iostream>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "caffe/caffe.hpp"
+#include "../tools/WeightFile.h"
+
+using caffe::Caffe;
+using caffe::Net;
+
+using namespace cpp2;
+
+// Converts a .caffemodel into the mapped weight format of tools/WeightFile.h.
+int main(int argc, char* argv[]) {
+  google::InitGoogleLogging(argv[0]);
+  if (argc != 4) {
+    std::cout << "Usage: " << argv[0]
+              << " <network.prototxt> <weights.caffemodel> <output>"
+              << std::endl;
+    return -1;
+  }
+  Caffe::set_phase(Caffe::TEST);
+  Caffe::set_mode(Caffe::CPU);
+
+  Net<float> net(argv[1]);
+  net.CopyTrainedLayersFrom(argv[2]);
+  writeWeightFile(&net, argv[3]);
+
+  // read it back the way the servers will
+  Net<float> check(argv[1]);
+  MappedWeights mapped(argv[3]);
+  mapped.shareWith(&check);
+  for (size_t i = 0; i < net.layers().size(); ++i) {
+    const auto& expected = net.layers()[i]->blobs();
+    const auto& actual = check.layers()[i]->blobs();
+    for (size_t b = 0; b < expected.size(); ++b) {
+      const float* e = expected[b]->cpu_data();
+      const float* a = actual[b]->cpu_data();
+      if (!std::equal(e, e + expected[b]->count(), a)) {
+        std::cout << "Mismatch in " << net.layer_names()[i] << std::endl;
+        return -1;
+      }
+    }
+  }
+  std::cout << "Wrote " << argv[3] << std::endl;
+  return 0;
+}
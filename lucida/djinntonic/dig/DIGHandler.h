@@ -4,6 +4,7 @@
 #include "../gen-cpp2/LucidaService.h"
 
 #include "caffe/caffe.hpp"
+#include "../tools/Classifier.h"
 
 /*
 namespace facebook {
@@ -32,17 +33,32 @@ class DIGHandler : virtual public LucidaServiceSvIf {
   (std::unique_ptr<std::string> LUCID,
       std::unique_ptr< ::cpp2::QuerySpec> query);
 
+  folly::Future<std::unique_ptr<std::vector<std::string>>> future_inferBatch
+  (std::unique_ptr<std::string> LUCID,
+      std::unique_ptr< ::cpp2::QuerySpec> query);
+
+  folly::Future<std::unique_ptr<std::string>> future_inferFrame
+  (std::unique_ptr<std::string> LUCID, std::unique_ptr<std::string> stream,
+      std::unique_ptr< ::cpp2::QuerySpec> frame);
+
+  folly::Future<folly::Unit> future_closeStream
+  (std::unique_ptr<std::string> LUCID, std::unique_ptr<std::string> stream);
+
+  folly::Future<std::unique_ptr<std::map<std::string, int64_t>>>
+  future_getCounters();
+
+  // Reloads the model files in the background, see Classifier::reload.
+  void reload();
 
 /*
   folly::Future<std::unique_ptr<std::string> >
   future_digitRecognition(std::unique_ptr<std::string> image);
 */
  private:
-  void reshape(caffe::Net<float> *net, int input_size);
-
   std::string network_;
   std::string weights_;
-  caffe::Net<float>* net_;
+  std::unique_ptr<Classifier> classifier_;
+  Admission admission_;
 };
 
 } // namespace cpp2
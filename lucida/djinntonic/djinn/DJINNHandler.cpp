@@ -0,0 +1,122 @@
+#include "DJINNHandler.h"
+
+#include <algorithm>
+#include <cctype>
+#include <utility>
+
+#include <folly/futures/Future.h>
+#include <thrift/lib/cpp/TApplicationException.h>
+
+#include "../../common/Stats.h"
+
+using apache::thrift::TApplicationException;
+
+using std::string;
+using std::unique_ptr;
+
+namespace cpp2 {
+
+namespace {
+
+string upper(string name) {
+  std::transform(name.begin(), name.end(), name.begin(), ::toupper);
+  return name;
+}
+
+template <typename T>
+folly::Future<T> unrouted(const string& LUCID,
+    const ::cpp2::QuerySpec& query) {
+  return folly::makeFuture<T>(TApplicationException(
+      "no model loaded for query " + query.name + " of " + LUCID));
+}
+
+} // namespace
+
+DJINNHandler::DJINNHandler(
+    std::map<string, std::shared_ptr<LucidaServiceSvIf>> models)
+    : models_(std::move(models)) {
+}
+
+LucidaServiceSvIf* DJINNHandler::route(const string& LUCID,
+    const ::cpp2::QuerySpec& query) const {
+  for (const string* name : {&query.name, &LUCID}) {
+    auto it = models_.find(upper(*name));
+    if (it != models_.end()) {
+      return it->second.get();
+    }
+  }
+  if (models_.size() == 1) {
+    return models_.begin()->second.get();
+  }
+  return nullptr;
+}
+
+folly::Future<folly::Unit> DJINNHandler::future_create
+(unique_ptr<string> LUCID, unique_ptr< ::cpp2::QuerySpec> spec) {
+  LucidaServiceSvIf* model = route(*LUCID, *spec);
+  if (model == nullptr) {
+    return unrouted<folly::Unit>(*LUCID, *spec);
+  }
+  return model->future_create(std::move(LUCID), std::move(spec));
+}
+
+folly::Future<folly::Unit> DJINNHandler::future_learn
+(unique_ptr<string> LUCID, unique_ptr< ::cpp2::QuerySpec> knowledge) {
+  LucidaServiceSvIf* model = route(*LUCID, *knowledge);
+  if (model == nullptr) {
+    return unrouted<folly::Unit>(*LUCID, *knowledge);
+  }
+  return model->future_learn(std::move(LUCID), std::move(knowledge));
+}
+
+folly::Future<unique_ptr<string>> DJINNHandler::future_infer
+(unique_ptr<string> LUCID, unique_ptr< ::cpp2::QuerySpec> query) {
+  LucidaServiceSvIf* model = route(*LUCID, *query);
+  if (model == nullptr) {
+    return unrouted<unique_ptr<string>>(*LUCID, *query);
+  }
+  return model->future_infer(std::move(LUCID), std::move(query));
+}
+
+folly::Future<unique_ptr<std::vector<string>>> DJINNHandler::future_inferBatch
+(unique_ptr<string> LUCID, unique_ptr< ::cpp2::QuerySpec> query) {
+  LucidaServiceSvIf* model = route(*LUCID, *query);
+  if (model == nullptr) {
+    return unrouted<unique_ptr<std::vector<string>>>(*LUCID, *query);
+  }
+  return model->future_inferBatch(std::move(LUCID), std::move(query));
+}
+
+folly::Future<unique_ptr<string>> DJINNHandler::future_inferFrame
+(unique_ptr<string> LUCID, unique_ptr<string> stream,
+    unique_ptr< ::cpp2::QuerySpec> frame) {
+  LucidaServiceSvIf* model = route(*LUCID, *frame);
+  if (model == nullptr) {
+    return unrouted<unique_ptr<string>>(*LUCID, *frame);
+  }
+  return model->future_inferFrame(std::move(LUCID), std::move(stream),
+      std::move(frame));
+}
+
+folly::Future<folly::Unit> DJINNHandler::future_closeStream
+(unique_ptr<string> LUCID, unique_ptr<string> stream) {
+  // there is no query to name the model by, and closing a stream a model
+  // does not know is harmless
+  LucidaServiceSvIf* model = route(*LUCID, ::cpp2::QuerySpec());
+  for (const auto& entry : models_) {
+    if (model == nullptr || model == entry.second.get()) {
+      entry.second->future_closeStream(
+          folly::make_unique<string>(*LUCID),
+          folly::make_unique<string>(*stream));
+    }
+  }
+  return folly::makeFuture();
+}
+
+folly::Future<unique_ptr<std::map<string, int64_t>>>
+DJINNHandler::future_getCounters() {
+  return folly::makeFuture(folly::make_unique<std::map<string, int64_t>>(
+      Stats::instance().counters()));
+}
+
+} // namespace cpp2
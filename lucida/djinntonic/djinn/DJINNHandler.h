@@ -0,0 +1,57 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../gen-cpp2/LucidaService.h"
+
+namespace cpp2 {
+
+// Serves several models on one port by handing every request to the model
+// it names. A request goes to the model whose name (DIG, FACE or IMC, any
+// case) is its QuerySpec.name or else its LUCID; with a single model loaded
+// every request goes to it.
+class DJINNHandler : virtual public LucidaServiceSvIf {
+ public:
+  explicit DJINNHandler(
+      std::map<std::string, std::shared_ptr<LucidaServiceSvIf>> models);
+
+  folly::Future<folly::Unit> future_create
+  (std::unique_ptr<std::string> LUCID,
+      std::unique_ptr< ::cpp2::QuerySpec> spec);
+
+  folly::Future<folly::Unit> future_learn
+  (std::unique_ptr<std::string> LUCID,
+      std::unique_ptr< ::cpp2::QuerySpec> knowledge);
+
+  folly::Future<std::unique_ptr<std::string>> future_infer
+  (std::unique_ptr<std::string> LUCID,
+      std::unique_ptr< ::cpp2::QuerySpec> query);
+
+  folly::Future<std::unique_ptr<std::vector<std::string>>> future_inferBatch
+  (std::unique_ptr<std::string> LUCID,
+      std::unique_ptr< ::cpp2::QuerySpec> query);
+
+  folly::Future<std::unique_ptr<std::string>> future_inferFrame
+  (std::unique_ptr<std::string> LUCID, std::unique_ptr<std::string> stream,
+      std::unique_ptr< ::cpp2::QuerySpec> frame);
+
+  // to the model the LUCID names, or else to all of them
+  folly::Future<folly::Unit> future_closeStream
+  (std::unique_ptr<std::string> LUCID, std::unique_ptr<std::string> stream);
+
+  // the stats of the whole process, shared by all models
+  folly::Future<std::unique_ptr<std::map<std::string, int64_t>>>
+  future_getCounters();
+
+ private:
+  // null if the request names no loaded model
+  LucidaServiceSvIf* route(const std::string& LUCID,
+      const ::cpp2::QuerySpec& query) const;
+
+  std::map<std::string, std::shared_ptr<LucidaServiceSvIf>> models_;
+};
+
+} // namespace cpp2
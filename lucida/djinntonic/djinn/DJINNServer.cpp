@@ -0,0 +1,147 @@
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include <thrift/lib/cpp2/server/ThriftServer.h>
+
+#include "DJINNHandler.h"
+#include "../dig/DIGHandler.h"
+#include "../face/FACEHandler.h"
+#include "../imc/IMCHandler.h"
+#include <folly/init/Init.h>
+#include "../dig/Parser.h"
+#include <algorithm>
+#include <iostream>
+#include <csignal>
+#include <sstream>
+#include <thread>
+
+#include "../../common/SignalWatcher.h"
+#include "../../common/Stats.h"
+#include "../../common/ThriftStats.h"
+#include "../tools/LayerProfile.h"
+#include "../../common/ThreadBudget.h"
+
+DEFINE_int32(num_of_threads,
+             4,
+             "Number of threads (default: 4)");
+
+DEFINE_string(models, "DIG,FACE,IMC",
+              "Comma separated models to serve (default: DIG,FACE,IMC)");
+
+DEFINE_int32(router_port, 0,
+             "Port serving all models, routed by query name or LUCID, "
+             "0 for none (default: 0)");
+
+using namespace apache::thrift;
+using namespace apache::thrift::async;
+
+using namespace cpp2;
+
+namespace {
+
+std::shared_ptr<LucidaServiceSvIf> load(const string& model,
+    std::vector<std::function<void()>>* reloads) {
+  if (model == "DIG") {
+    auto handler = std::make_shared<DIGHandler>();
+    reloads->push_back([handler]() { handler->reload(); });
+    return handler;
+  }
+  if (model == "FACE") {
+    auto handler = std::make_shared<FACEHandler>();
+    reloads->push_back([handler]() { handler->reload(); });
+    return handler;
+  }
+  if (model == "IMC") {
+    auto handler = std::make_shared<IMCHandler>();
+    reloads->push_back([handler]() { handler->reload(); });
+    return handler;
+  }
+  return nullptr;
+}
+
+std::unique_ptr<ThriftServer> makeServer(int port,
+    std::shared_ptr<LucidaServiceSvIf> handler) {
+  auto server = folly::make_unique<ThriftServer>();
+  server->setPort(port);
+  server->setNWorkerThreads(FLAGS_num_of_threads);
+  server->setInterface(std::move(handler));
+  server->setIdleTimeout(std::chrono::milliseconds(0));
+  server->setTaskExpireTime(std::chrono::milliseconds(0));
+  return server;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  folly::init(&argc, &argv);
+  // before the handlers start any thread
+  SignalWatcher signals({SIGHUP, SIGUSR1});
+  installThriftStats();
+  // kill -USR1 logs the stats and the layer profile, if any
+  signals.on(SIGUSR1, []() {
+    LOG(ERROR) << "Stats:\n" << Stats::instance().dump()
+               << LayerProfile::report();
+  });
+
+  Properties props;
+  props.Read("../../config.properties");
+
+  // all models share the process wide CPU executor and the per-thread
+  // scratch arenas, which are reserved for the largest of them
+  std::map<string, std::shared_ptr<LucidaServiceSvIf>> models;
+  std::vector<std::function<void()>> reloads;
+  std::vector<std::unique_ptr<ThriftServer>> servers;
+  std::vector<string> names;
+  std::stringstream list(FLAGS_models);
+  for (string model; getline(list, model, ','); ) {
+    if (!model.empty() &&
+        std::find(names.begin(), names.end(), model) == names.end()) {
+      names.push_back(model);
+    }
+  }
+  // the models split the thread budget between them
+  ThreadBudget::setModels(names.size());
+  for (const string& model : names) {
+    string portVal;
+    if (!props.GetValue(model + "_PORT", portVal)) {
+      cout << model << " port not defined" << endl;
+      return -1;
+    }
+    auto handler = load(model, &reloads);
+    if (!handler) {
+      cout << "Unknown model " << model << endl;
+      return -1;
+    }
+    models[model] = handler;
+    // every model keeps its own port, clients need not change
+    servers.push_back(makeServer(atoi(portVal.c_str()), handler));
+    LOG(ERROR) << "Serving " << model << " on port " << portVal;
+  }
+  if (models.empty()) {
+    cout << "No models to serve" << endl;
+    return -1;
+  }
+  if (FLAGS_router_port > 0) {
+    servers.push_back(makeServer(FLAGS_router_port,
+        std::make_shared<DJINNHandler>(models)));
+    LOG(ERROR) << "Routing all models on port " << FLAGS_router_port;
+  }
+
+  // kill -HUP reloads the model files of every model
+  signals.on(SIGHUP, [reloads]() {
+    for (const auto& reload : reloads) {
+      reload();
+    }
+  });
+
+  std::vector<std::thread> threads;
+  for (auto& server : servers) {
+    ThriftServer* s = server.get();
+    threads.emplace_back([s]() { s->serve(); });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  return 0;
+}
@@ -3,14 +3,17 @@
 #include <folly/futures/Future.h>
 #include <folly/MoveWrapper.h>
 
+#include <algorithm>
 #include <sstream>
 #include <string>
 #include <vector>
 #include <unistd.h>
 
-#include <jpeglib.h>
 #include <gflags/gflags.h>
-#include <csetjmp>
+
+#include "../../common/CpuExecutor.h"
+#include "../../common/Stats.h"
+#include "../../common/ThreadBudget.h"
 
 DEFINE_string(face_network, "configs/face.prototxt",
               "Network config for face (default: config/face.prototxt");
@@ -18,6 +21,27 @@ DEFINE_string(face_network, "configs/face.prototxt",
 DEFINE_string(face_weights, "../models/face.caffemodel",
               "Weight config for face (default: models/face.caffemodel");
 
+DEFINE_string(face_backend, "caffe",
+              "Inference backend of face, caffe or int8 (default: caffe)");
+
+DEFINE_string(face_classes, "face-classes.txt",
+              "Class names of face, one per line "
+              "(default: face-classes.txt)");
+
+DEFINE_string(face_embedding_blob, "fc7",
+              "Blob of the face network whose output is the embedding "
+              "enrolled by learn and searched by infer (default: fc7)");
+
+DEFINE_string(face_gallery_dir, "galleries",
+              "Directory of the enrolled faces of every LUCID "
+              "(default: galleries)");
+
+DEFINE_double(face_match_threshold, 0.6,
+              "Cosine similarity above which infer answers the tag of the "
+              "closest enrolled face instead of the class (default: 0.6)");
+
+DECLARE_int32(num_of_threads);
+
 using caffe::Blob;
 using caffe::Caffe;
 using caffe::Net;
@@ -42,40 +66,39 @@ namespace imc {
 
 namespace cpp2 {
 
-struct jpegErrorManager {
-  struct jpeg_error_mgr pub;
-  jmp_buf setjmp_buffer;
-};
-char jpegLastErrorMsg[JMSG_LENGTH_MAX];
-void jpegErrorExit (j_common_ptr cinfo)
-{
-  jpegErrorManager* myerr = (jpegErrorManager*) cinfo->err;
-  ( *(cinfo->err->format_message) ) (cinfo, jpegLastErrorMsg);
-  longjmp(myerr->setjmp_buffer, 1);
-}
-
-FACEHandler::FACEHandler() {
+FACEHandler::FACEHandler() : galleries_(FLAGS_face_gallery_dir) {
   LOG(ERROR) << "Start initializing";
   this->network_ = FLAGS_face_network;
   this->weights_ = FLAGS_face_weights;
 
-  // load caffe model
-  this->net_ = new Net<float>(this->network_);
-  this->net_->CopyTrainedLayersFrom(this->weights_);
- 
-  this->classes_ = new std::vector<std::string>();
-  // load image classes
-  (*this->classes_).push_back(std::string("")); //offset
-  std::ifstream cl_file("face-classes.txt");
-  while (!cl_file.eof()) {
-    char c;
-    std::string face_class;
-    cl_file >> face_class; // fake get
-    cl_file.get(c); // fake get
-    getline (cl_file, face_class);
-    (*this->classes_).push_back(face_class);
-  }
- 
+  // load the model, one replica per worker thread, again on every reload
+  this->classifier_.reset(new Classifier([this](Batcher::Labeler* labeler) {
+    auto nets = makeBackend(FLAGS_face_backend, this->network_,
+        this->weights_,
+        ThreadBudget::instance().replicas(FLAGS_num_of_threads),
+        FLAGS_face_embedding_blob);
+
+    auto classes = std::make_shared<std::vector<std::string>>();
+    // load image classes
+    classes->push_back(std::string("")); //offset
+    std::ifstream cl_file(FLAGS_face_classes);
+    while (!cl_file.eof()) {
+      char c;
+      std::string face_class;
+      cl_file >> face_class; // fake get
+      cl_file.get(c); // fake get
+      getline (cl_file, face_class);
+      classes->push_back(face_class);
+    }
+
+    // the net ends in an argmax layer, one class index per image; the
+    // embedding comes with the result when asked for
+    *labeler = [classes](const float* out) {
+      return (*classes)[int(out[0])];
+    };
+    return nets;
+  }));
+
   LOG(ERROR) << "Finished initializing the handler!"; 
 }
 
@@ -89,227 +112,154 @@ folly::Future<folly::Unit> FACEHandler::future_create
 } 
 folly::Future<folly::Unit> FACEHandler::future_learn
 (unique_ptr<string> LUCID, unique_ptr< ::cpp2::QuerySpec> knowledge) {
-  //print("Learn");
-  // Save LUCID and knowledge.
-  folly::MoveWrapper<folly::Promise<folly::Unit>> promise;
-  auto future = promise->getFuture();
-  promise->setValue(Unit{});
-  LOG(ERROR) << "Learn is not implemented now!"; 
-  return future;
-}
-
-
-
-folly::Future<unique_ptr<string>> FACEHandler::future_infer
-(unique_ptr<string> LUCID, unique_ptr< ::cpp2::QuerySpec> query) {
-  string LUCID_save = *LUCID;
-  ::cpp2::QuerySpec query_save = *query;
-
-  folly::MoveWrapper<folly::Promise<std::unique_ptr<std::string> > > promise;
-
-  std::unique_ptr<std::string> image (new std::string(std::move(query_save.content[0].data[0])));
-  
-  auto move_image = folly::makeMoveWrapper(std::move(image));
-  auto future = promise->getFuture();
-  
-  folly::RequestEventBase::get()->runInEventBaseThread(
-      [promise, move_image, this]() mutable {
-        // determine the image size
-        int64_t img_size = 3 * 152 * 152;
-
-        Caffe::set_phase(Caffe::TEST);
-        // use cpu
-        Caffe::set_mode(Caffe::CPU);
-
-        int img_num = 1;
-
-        // prepare data into array
-        float* data = (float*) malloc(img_num * img_size * sizeof(float));
-        float* preds = (float*) malloc(img_num * sizeof(float));
-        
-        unsigned char* buffer;
-
-        // read in the image
-        std::istringstream is(**move_image);
-        is.seekg(0, is.end);
-        int length = is.tellg();
-        is.seekg(0, is.beg);
-        char* img_buffer = new char[length];
-        is.read(img_buffer, length);
-
-        struct jpeg_decompress_struct cinfo;
-        jpegErrorManager jerr; 
-        cinfo.err = jpeg_std_error(&jerr.pub);
-        jerr.pub.error_exit = jpegErrorExit;
-        
-        if (setjmp(jerr.setjmp_buffer)) {
-          /* If we get here, the JPEG code has signaled an error. */
-          jpeg_destroy_decompress(&cinfo);
-          std::unique_ptr<std::string> image_class = 
-              folly::make_unique<std::string>(jpegLastErrorMsg);
-          promise->setValue(std::move(image_class));
-          return;
-        }
-
-        jpeg_create_decompress(&cinfo);
-        
-        jpeg_mem_src(&cinfo, (unsigned char*)img_buffer, length);
-        jpeg_read_header(&cinfo, TRUE);
-        jpeg_start_decompress(&cinfo);
-
-        if (cinfo.output_components==3 ){
-        img_size =
-            cinfo.output_width * cinfo.output_height * cinfo.output_components;
-        buffer = (unsigned char*) malloc(
-            cinfo.output_components * cinfo.output_width);
-        unsigned char* src = (unsigned char*) malloc( img_size );
-
-        while (cinfo.output_scanline < cinfo.output_height) {
-          (void) jpeg_read_scanlines(&cinfo, (JSAMPARRAY) &buffer, 1);
-          for (int j = 0; j < cinfo.output_components; j++) {
-            for (unsigned int k = 0; k < cinfo.output_width; k++) {
-              int index = (cinfo.output_components -1 - j) *
-                          cinfo.output_width * cinfo.output_height +
-                          (cinfo.output_scanline - 1) * cinfo.output_width + k;
-              src[index] = buffer[k * cinfo.output_components + j];
-            }
+  // as in IMM: "image" inputs enroll data[i] under tags[i], "unlearn" ones
+  // drop the faces of tags[i]
+  auto enroll = folly::make_unique< ::cpp2::QuerySpec>();
+  std::vector<string> tags;
+  std::vector<string> removed;
+  for (auto& input : knowledge->content) {
+    size_t n = std::min(input.data.size(), input.tags.size());
+    if (input.type == "image") {
+      input.data.resize(n);
+      tags.insert(tags.end(), input.tags.begin(), input.tags.begin() + n);
+      enroll->content.push_back(std::move(input));
+    } else if (input.type == "unlearn") {
+      removed.insert(removed.end(), input.tags.begin(),
+          input.tags.begin() + n);
+    }
+  }
+  // the embeddings come from the infer path, cache and batching included
+  Deadline deadline = deadlineAfter(knowledge->timeout_ms);
+  auto move_enroll = folly::makeMoveWrapper(std::move(enroll));
+  string lucid = *LUCID;
+  return this->admission_.run<unique_ptr<std::vector<Result>>>(deadline,
+      [this, move_enroll, deadline]() {
+    return this->classifier_->inferFeatures(std::move(*move_enroll),
+        deadline);
+  }).then([this, lucid, tags, removed](
+      unique_ptr<std::vector<Result>> results) {
+    // gallery files are written and indexes trained off the batcher
+    folly::MoveWrapper<folly::Promise<folly::Unit>> promise;
+    auto future = promise->getFuture();
+    auto move_results = folly::makeMoveWrapper(std::move(results));
+    CpuExecutor::instance().add(
+        [this, lucid, tags, removed, move_results, promise]() {
+      try {
+        if (auto gallery = this->galleries_.find(lucid)) {
+          for (const auto& tag : removed) {
+            gallery->remove(tag);
           }
         }
-
-        int s_w = cinfo.output_width; 
-        int s_h = cinfo.output_height; 
-        int d_w = 152;
-        int d_h = 152;
-
-        if (s_w <= d_w && s_h <= d_h) {
-            double x_r = s_w / (double)d_w;
-            double y_r = s_h / (double)d_h;
-            for(int c=0; c<3 ; c++) {
-              for (int i=0; i<d_h; i++) {
-                for (int j=0; j<d_w; j++) {
-                  data[c*(d_h*d_w)+ i*d_w + j] = (float)src[c*(s_h*s_w) + int(floor(i*y_r)*s_w  + floor(j*x_r))];
-                }  
-              }  
-            }
-
-        } else if (s_w <= d_w && s_h > d_h) {
-          int y_l = s_h / d_h;
-          float x_r = s_w / (float) d_w;
-          float y_r = s_h / (float) d_h;
-          for (int c =0 ; c < 3; c++){
-            for (int i = 0; i < d_h; i++) {
-              for (int j = 0; j < d_w; j++) {
-                int x_t = int(j * x_r);
-                int y_b = int(i * y_r - y_r/2.0 + 0.5);
-                int sum = 0;
-                for (int ii=y_b; ii < y_b + y_l; ii++){
-                  if (ii>=0 && ii < s_h) {
-                    sum += src[c*(s_h*s_w)+ii*s_w + x_t]; 
-                  }
-                }
-                data[c*(d_h*d_w)+ i*d_w + j] = ((float)sum / y_l + 0.5);
-              }
-            }
-          }
-
-        } else if (s_w > d_w && s_h <= d_h) {
-          int x_l = s_w / d_w;
-          float x_r = s_w / (float) d_w;
-          float y_r = s_h / (float) d_h;
-          for (int c =0 ; c < 3; c++){
-            for (int i = 0; i < d_h; i++) {
-              for (int j = 0; j < d_w; j++) {
-                int x_b = int(j * x_r - x_r/2.0 + 0.5);
-                int y_t = int(i * y_r);
-                int sum = 0;
-                for (int jj=x_b; jj < x_b + x_l; jj++) {
-                  if (jj >=0 && jj < s_w) {
-                    sum += src[c*(s_h*s_w)+y_t*s_w + jj];
-                  }
-                }
-                data[c*(d_h*d_w)+ i*d_w + j] = ((float)sum / x_l + 0.5);
-              }
-            }
+        const auto& results = **move_results;
+        for (size_t i = 0; i < results.size(); ++i) {
+          const auto& embedding = results[i].features;
+          if (!results[i].ok || embedding.empty()) {
+            LOG(ERROR) << "Not enrolling " << tags[i] << " of " << lucid
+                       << ": " << results[i].reply;
+            continue;
           }
-
-        } else {
-          int x_l = s_w / d_w;
-          int y_l = s_h / d_h;
-          float x_r = s_w / (float) d_w;
-          float y_r = s_h / (float) d_h;
-          for (int c =0 ; c < 3; c++){
-            for (int i = 0; i < d_h; i++) {
-              for (int j = 0; j < d_w; j++) {
-                int x_b = int(j * x_r - x_r/2.0 + 0.5);
-                int y_b = int(i * y_r - y_r/2.0 + 0.5);
-                int sum = 0;
-                for (int ii=y_b; ii < y_b + y_l; ii++){
-                  for (int jj=x_b; jj < x_b + x_l; jj++) {
-                    if (ii>=0 && ii < s_h && jj>=0 && jj < s_w) {
-                      sum += src[c*(s_h*s_w)+ii*s_w+jj]; 
-                    }
-                  }
-                }
-                data[c*(d_h*d_w)+ i*d_w + j] = ((float)sum / (x_l * y_l) + 0.5);
-              }
-            }
+          auto gallery = this->galleries_.create(lucid, embedding.size());
+          if (gallery->dims() != (int) embedding.size()) {
+            LOG(ERROR) << "Not enrolling " << tags[i] << " of " << lucid
+                       << ": the gallery holds embeddings of "
+                       << gallery->dims() << " floats, the model gives "
+                       << embedding.size();
+            continue;
           }
+          gallery->add(tags[i], embedding.data());
         }
-
-        delete[] img_buffer;
-        delete[] buffer;
-        delete[] src;
-        jpeg_finish_decompress(&cinfo);
-        jpeg_destroy_decompress(&cinfo);
-        
-        float loss;
-        reshape(this->net_, img_num * 152*152*3);
-  
-        // TODO(XW): We need to add code for face alignment preprocessing
-        std::vector<Blob<float>*> in_blobs = this->net_->input_blobs();
-        in_blobs[0]->set_cpu_data(data);
-
-        std::vector<Blob<float>*> out_blobs = this->net_->ForwardPrefilled(&loss);
-        memcpy(preds, out_blobs[0]->cpu_data(), img_num * sizeof(float));
-
-        std::unique_ptr<std::string> image_class = 
-            folly::make_unique<std::string>((*(this->classes_))[int(preds[0])]);
-            //folly::make_unique<std::string>(std::to_string(preds[0]));
-        promise->setValue(std::move(image_class));
-       } else {
-        std::unique_ptr<std::string> image_class = 
-            folly::make_unique<std::string>("null");
-        promise->setValue(std::move(image_class));
-        
-        }
+        // replies of stream key frames may name a face that changed
+        this->classifier_->clearStreams();
+        promise->setValue();
+      } catch (const std::exception& e) {
+        this->classifier_->clearStreams();
+        LOG(ERROR) << "Learn of " << lucid << " failed: " << e.what();
+        promise->setException(
+            folly::exception_wrapper(std::current_exception(), e));
       }
-  );
+    });
+    return future;
+  });
+}
+
 
-  return future;
 
+folly::Future<unique_ptr<string>> FACEHandler::future_infer
+(unique_ptr<string> LUCID, unique_ptr< ::cpp2::QuerySpec> query) {
+  Deadline deadline = deadlineAfter(query->timeout_ms);
+  auto move_query = folly::makeMoveWrapper(std::move(query));
+  Classifier::Resolve resolve = this->resolver(*LUCID);
+  return this->admission_.run<unique_ptr<string>>(deadline,
+      [this, move_query, deadline, resolve]() {
+    return this->classifier_->infer(std::move(*move_query), deadline,
+        resolve);
+  });
 }
 
-void FACEHandler::reshape(Net<float>* net, int input_size) {
-  int n_in = net->input_blobs()[0]->num();
-  int c_in = net->input_blobs()[0]->channels();
-  int w_in = net->input_blobs()[0]->width();
-  int h_in = net->input_blobs()[0]->height();
+folly::Future<unique_ptr<std::vector<string>>> FACEHandler::future_inferBatch
+(unique_ptr<string> LUCID, unique_ptr< ::cpp2::QuerySpec> query) {
+  Deadline deadline = deadlineAfter(query->timeout_ms);
+  auto move_query = folly::makeMoveWrapper(std::move(query));
+  Classifier::Resolve resolve = this->resolver(*LUCID);
+  return this->admission_.run<unique_ptr<std::vector<string>>>(deadline,
+      [this, move_query, deadline, resolve]() {
+    return this->classifier_->inferBatch(std::move(*move_query), deadline,
+        resolve);
+  });
+}
 
-  int n_out = net->output_blobs()[0]->num();
-  int c_out = net->output_blobs()[0]->channels();
-  int w_out = net->output_blobs()[0]->width();
-  int h_out = net->output_blobs()[0]->height();
+folly::Future<unique_ptr<string>> FACEHandler::future_inferFrame
+(unique_ptr<string> LUCID, unique_ptr<string> stream,
+    unique_ptr< ::cpp2::QuerySpec> frame) {
+  Deadline deadline = deadlineAfter(frame->timeout_ms);
+  auto move_frame = folly::makeMoveWrapper(std::move(frame));
+  string lucid = *LUCID;
+  string name = *stream;
+  Classifier::Resolve resolve = this->resolver(lucid);
+  return this->admission_.run<unique_ptr<string>>(deadline,
+      [this, lucid, name, move_frame, deadline, resolve]() {
+    return this->classifier_->inferFrame(lucid, name, std::move(*move_frame),
+        deadline, resolve);
+  });
+}
 
-  // assumes C, H, W are known, only reshapes batch dim
-  if (input_size / (c_in * w_in * h_in) != n_in) {
-    n_in = input_size / (c_in * w_in * h_in);
-    net->input_blobs()[0]->Reshape(n_in, c_in, w_in, h_in);
+folly::Future<folly::Unit> FACEHandler::future_closeStream
+(unique_ptr<string> LUCID, unique_ptr<string> stream) {
+  this->classifier_->closeStream(*LUCID, *stream);
+  return folly::makeFuture();
+}
 
-    n_out = n_in;
-    net->output_blobs()[0]->Reshape(n_out, c_out, w_out, h_out);
+
+folly::Future<unique_ptr<std::map<string, int64_t>>>
+FACEHandler::future_getCounters() {
+  return folly::makeFuture(folly::make_unique<std::map<string, int64_t>>(
+      Stats::instance().counters()));
+}
+
+Classifier::Resolve FACEHandler::resolver(const string& LUCID) {
+  static Counter& matched = Stats::instance().counter("face.gallery_matched");
+  auto gallery = this->galleries_.find(LUCID);
+  if (!gallery || gallery->size() == 0) {
+    return nullptr;
   }
+  return [gallery](const Result& result) {
+    string tag;
+    float similarity;
+    if (gallery->dims() == (int) result.features.size() &&
+        gallery->search(result.features.data(), &tag, &similarity) &&
+        similarity >= FLAGS_face_match_threshold) {
+      matched.add();
+      return tag;
+    }
+    return result.reply;
+  };
 }
 
+void FACEHandler::reload() {
+  if (!this->classifier_->reload()) {
+    LOG(ERROR) << "A reload is already running";
+  }
+}
 
 } // namespace cpp2
 
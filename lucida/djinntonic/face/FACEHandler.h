@@ -3,6 +3,8 @@
 #include "../gen-cpp2/LucidaService.h"
 
 #include "caffe/caffe.hpp"
+#include "../tools/Classifier.h"
+#include "../tools/Gallery.h"
 
 /*
 namespace facebook {
@@ -30,20 +32,41 @@ class FACEHandler : virtual public LucidaServiceSvIf {
   (std::unique_ptr<std::string> LUCID,
       std::unique_ptr< ::cpp2::QuerySpec> query);
 
+  folly::Future<std::unique_ptr<std::vector<std::string>>> future_inferBatch
+  (std::unique_ptr<std::string> LUCID,
+      std::unique_ptr< ::cpp2::QuerySpec> query);
+
+  folly::Future<std::unique_ptr<std::string>> future_inferFrame
+  (std::unique_ptr<std::string> LUCID, std::unique_ptr<std::string> stream,
+      std::unique_ptr< ::cpp2::QuerySpec> frame);
+
+  folly::Future<folly::Unit> future_closeStream
+  (std::unique_ptr<std::string> LUCID, std::unique_ptr<std::string> stream);
+
+  folly::Future<std::unique_ptr<std::map<std::string, int64_t>>>
+  future_getCounters();
 
 /*
   folly::Future<std::unique_ptr<std::string> >
   future_imageClassification(std::unique_ptr<std::string> image);
 */
 
+  // Reloads the model files in the background, see Classifier::reload.
+  void reload();
+
  private:
-  void reshape(caffe::Net<float> *net, int input_size);
+  // Answers with the tag of the LUCID's closest enrolled face if it is
+  // similar enough to the face's embedding, otherwise with the class. Null
+  // if the LUCID has no faces enrolled, so that its queries need no
+  // embeddings.
+  Classifier::Resolve resolver(const std::string& LUCID);
 
   std::string network_;
   std::string weights_;
-  caffe::Net<float>* net_;
-  
-  std::vector<std::string>* classes_;
+  std::unique_ptr<Classifier> classifier_;
+  Admission admission_;
+  // the faces enrolled by learn, per LUCID
+  GalleryStore galleries_;
 };
 
 } // namespace cpp2
@@ -7,6 +7,12 @@
 #include <folly/init/Init.h>
 #include "Parser.h"
 #include <iostream>
+#include <csignal>
+
+#include "../../common/SignalWatcher.h"
+#include "../../common/Stats.h"
+#include "../../common/ThriftStats.h"
+#include "../tools/LayerProfile.h"
 
 DEFINE_int32(num_of_threads,
              4,
@@ -20,6 +26,14 @@ using namespace cpp2;
 
 int main(int argc, char* argv[]) {
   folly::init(&argc, &argv);
+  // before the handler starts any thread
+  SignalWatcher signals({SIGHUP, SIGUSR1});
+  installThriftStats();
+  // kill -USR1 logs the stats and the layer profile, if any
+  signals.on(SIGUSR1, []() {
+    LOG(ERROR) << "Stats:\n" << Stats::instance().dump()
+               << LayerProfile::report();
+  });
 
   Properties props;
   props.Read("../../config.properties");
@@ -33,6 +47,8 @@ int main(int argc, char* argv[]) {
   }
 
   auto handler = std::make_shared<IMCHandler>();
+  // kill -HUP reloads the model files without dropping requests
+  signals.on(SIGHUP, [handler]() { handler->reload(); });
   auto server = folly::make_unique<ThriftServer>();
 
   server->setPort(port);
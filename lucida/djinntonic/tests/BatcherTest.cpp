@@ -0,0 +1,173 @@
+#include <atomic>
+#include <future>
+#include <string>
+#include <vector>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "../tools/Batcher.h"
+
+DECLARE_int32(max_batch_size);
+DECLARE_int32(batch_window_us);
+
+using namespace cpp2;
+
+namespace {
+
+// One float of input per image. The output of an image is its input and its
+// two features are the input doubled and negated, so that every result can
+// be traced back to its fill.
+class FakeBackend : public Backend {
+ public:
+  FakeBackend() : inputs_(2), passes_(0), largest_(0) {}
+
+  std::string name() const override { return "fake"; }
+  int replicas() const override { return inputs_.size(); }
+  int channels() const override { return 1; }
+  int height() const override { return 1; }
+  int width() const override { return 1; }
+  int outputSize() const override { return 1; }
+  int featureSize() const override { return 2; }
+  uint64_t identity() const override { return 1; }
+
+  float* input(int replica, int n) override {
+    inputs_[replica].resize(std::max<size_t>(inputs_[replica].size(), n));
+    return inputs_[replica].data();
+  }
+
+  void forward(int replica, int n, float* output, bool profile) override {
+    ++passes_;
+    int largest = largest_;
+    while (n > largest && !largest_.compare_exchange_weak(largest, n)) {
+    }
+    for (int i = 0; i < n; ++i) {
+      float in = inputs_[replica][i];
+      output[3 * i] = in;
+      output[3 * i + 1] = 2 * in;
+      output[3 * i + 2] = -in;
+    }
+  }
+
+  int passes() const { return passes_; }
+  int largest() const { return largest_; }
+
+ private:
+  std::vector<std::vector<float>> inputs_;
+  std::atomic<int> passes_;
+  std::atomic<int> largest_;
+};
+
+// Enqueues n images whose fills write first + i, except those for which
+// fail(i) holds, and waits for the results.
+folly::Try<std::vector<Result>> run(Batcher* batcher, int first, int n,
+    std::function<bool(int)> fail, bool features,
+    Deadline deadline = Deadline::max()) {
+  std::vector<Batcher::Fill> fills;
+  for (int i = 0; i < n; ++i) {
+    fills.push_back([first, i, fail](float* dst, std::string* error) {
+      if (fail(i)) {
+        *error = "bad " + std::to_string(first + i);
+        return false;
+      }
+      *dst = first + i;
+      return true;
+    });
+  }
+  auto promise = std::make_shared<
+      std::promise<folly::Try<std::vector<Result>>>>();
+  batcher->enqueue(std::move(fills), deadline,
+      [promise](folly::Try<std::vector<Result>> results) {
+        promise->set_value(std::move(results));
+      }, false, features);
+  return promise->get_future().get();
+}
+
+void checkResults(const std::vector<Result>& results, int first, int n,
+    std::function<bool(int)> fail, bool features) {
+  CHECK_EQ(results.size(), (size_t) n);
+  for (int i = 0; i < n; ++i) {
+    const Result& result = results[i];
+    if (fail(i)) {
+      CHECK(!result.ok) << i;
+      CHECK_EQ(result.reply, "bad " + std::to_string(first + i));
+      continue;
+    }
+    CHECK(result.ok) << i;
+    CHECK_EQ(result.reply, std::to_string(first + i));
+    if (features) {
+      CHECK_EQ(result.features.size(), 2u);
+      CHECK_EQ(result.features[0], 2.0f * (first + i));
+      CHECK_EQ(result.features[1], -1.0f * (first + i));
+    } else {
+      CHECK(result.features.empty());
+    }
+  }
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  FLAGS_max_batch_size = 4;
+  FLAGS_batch_window_us = 100;
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+
+  FakeBackend nets;
+  Batcher batcher(&nets, [](const float* out) {
+    return std::to_string((int) out[0]);
+  });
+  int warmup = nets.passes();
+  auto none = [](int i) { return false; };
+
+  // a request within a batch
+  auto results = run(&batcher, 0, 3, none, false);
+  checkResults(results.value(), 0, 3, none, false);
+
+  // larger requests are split into parts of at most --max_batch_size, and
+  // the results come back whole and in order
+  for (int n : {4, 5, 11, 16}) {
+    int passes = nets.passes();
+    results = run(&batcher, 100 * n, n, none, true);
+    checkResults(results.value(), 100 * n, n, none, true);
+    CHECK_GE(nets.passes() - passes, (n + 3) / 4) << n;
+  }
+  CHECK_LE(nets.largest(), 4);
+
+  // failed fills keep their error in their slot, across parts
+  auto odd = [](int i) { return i % 3 == 1; };
+  results = run(&batcher, 500, 10, odd, true);
+  checkResults(results.value(), 500, 10, odd, true);
+  auto all = [](int i) { return true; };
+  results = run(&batcher, 600, 6, all, false);
+  checkResults(results.value(), 600, 6, all, false);
+
+  // concurrent split requests do not mix up their results
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 8; ++t) {
+    threads.emplace_back([&batcher, t]() {
+      for (int k = 0; k < 20; ++k) {
+        int first = 10000 * t + 100 * k;
+        int n = 1 + (t + k) % 9;
+        auto fail = [k](int i) { return (i + k) % 7 == 0; };
+        auto results = run(&batcher, first, n, fail, k % 2);
+        checkResults(results.value(), first, n, fail, k % 2);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  CHECK_LE(nets.largest(), 4);
+
+  // a request past its deadline fails as a whole, in every part
+  int passes = nets.passes();
+  results = run(&batcher, 0, 9, none, false,
+      std::chrono::steady_clock::now() - std::chrono::seconds(1));
+  CHECK(results.hasException());
+  CHECK_EQ(nets.passes(), passes);
+
+  LOG(ERROR) << "Batcher tests passed, " << nets.passes() - warmup
+             << " forward passes";
+  return 0;
+}
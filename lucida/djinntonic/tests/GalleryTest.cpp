@@ -0,0 +1,216 @@
+#include <cmath>
+#include <cstdlib>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "../tools/Gallery.h"
+
+DECLARE_int32(gallery_exact_max);
+DECLARE_int32(gallery_nprobe);
+
+using namespace cpp2;
+
+namespace {
+
+// A fresh directory for the gallery files of one test.
+std::string tempDir() {
+  char dir[] = "/tmp/gallery_testXXXXXX";
+  CHECK(mkdtemp(dir) != nullptr);
+  return dir;
+}
+
+void removeDir(const std::string& dir) {
+  CHECK_EQ(system(("rm -rf " + dir).c_str()), 0);
+}
+
+std::vector<float> unit(int dims, int axis) {
+  std::vector<float> v(dims, 0.0f);
+  v[axis] = 1.0f;
+  return v;
+}
+
+// Identities as random centers, their faces as noisy copies.
+class Faces {
+ public:
+  Faces(int identities, int dims) : dims_(dims), rng_(7) {
+    centers_.resize(identities);
+    for (auto& center : centers_) {
+      center = noise(1.0f);
+    }
+  }
+
+  std::vector<float> sample(int identity) {
+    std::vector<float> v = noise(0.8f);
+    for (int d = 0; d < dims_; ++d) {
+      v[d] += centers_[identity][d];
+    }
+    return v;
+  }
+
+ private:
+  std::vector<float> noise(float sigma) {
+    std::normal_distribution<float> normal(0.0f, sigma);
+    std::vector<float> v(dims_);
+    for (float& x : v) {
+      x = normal(rng_);
+    }
+    return v;
+  }
+
+  const int dims_;
+  std::mt19937 rng_;
+  std::vector<std::vector<float>> centers_;
+};
+
+// The label of the entry closest by cosine, by brute force.
+std::string exactMatch(const std::vector<std::vector<float>>& entries,
+    const std::vector<std::string>& labels, const std::vector<float>& query) {
+  size_t best = 0;
+  double best_sim = -2.0;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    double dot = 0.0, norm_e = 0.0, norm_q = 0.0;
+    for (size_t d = 0; d < query.size(); ++d) {
+      dot += entries[i][d] * query[d];
+      norm_e += entries[i][d] * entries[i][d];
+      norm_q += query[d] * query[d];
+    }
+    double sim = dot / std::sqrt(norm_e * norm_q);
+    if (sim > best_sim) {
+      best_sim = sim;
+      best = i;
+    }
+  }
+  return labels[best];
+}
+
+void testExact() {
+  std::string dir = tempDir();
+  {
+    GalleryStore store(dir);
+    CHECK(store.find("alice") == nullptr);
+    auto gallery = store.create("alice", 8);
+    CHECK(store.create("alice", 8) == gallery);
+    std::string label;
+    float similarity;
+    CHECK(!gallery->search(unit(8, 0).data(), &label, &similarity));
+
+    gallery->add("a", unit(8, 0).data());
+    gallery->add("b", unit(8, 1).data());
+    // cosine, so the length of the query does not matter
+    std::vector<float> query = unit(8, 0);
+    query[0] = 3.0f;
+    query[1] = 0.5f;
+    CHECK(gallery->search(query.data(), &label, &similarity));
+    CHECK_EQ(label, "a");
+    CHECK_LT(std::fabs(similarity - 3.0f / std::sqrt(9.25f)), 1e-5f);
+
+    gallery->remove("a");
+    CHECK_EQ(gallery->size(), 1u);
+    CHECK(gallery->search(query.data(), &label, &similarity));
+    CHECK_EQ(label, "b");
+  }
+
+  // a restarted server gets the gallery back without the removed faces,
+  // and the files of one LUCID are not opened as another dims
+  GalleryStore store(dir);
+  auto gallery = store.find("alice");
+  CHECK(gallery != nullptr);
+  CHECK_EQ(gallery->size(), 1u);
+  CHECK_EQ(gallery->dims(), 8);
+  std::string label;
+  float similarity;
+  CHECK(gallery->search(unit(8, 0).data(), &label, &similarity));
+  CHECK_EQ(label, "b");
+  bool thrown = false;
+  try {
+    Gallery other(dir + "/alice", "alice", 16);
+  } catch (const std::exception& e) {
+    thrown = true;
+  }
+  CHECK(thrown);
+  removeDir(dir);
+}
+
+void testIvfRecall() {
+  // small enough to train an index a few times over, large enough for
+  // lists worth probing
+  const int dims = 32;
+  const int identities = 300;
+  const int per_identity = 4;
+  const int queries = 300;
+  FLAGS_gallery_exact_max = 256;
+  FLAGS_gallery_nprobe = 16;
+
+  std::string dir = tempDir();
+  Faces faces(identities, dims);
+  std::vector<std::vector<float>> entries;
+  std::vector<std::string> labels;
+  std::vector<std::vector<float>> queried;
+  std::vector<std::string> found;
+  {
+    GalleryStore store(dir);
+    auto gallery = store.create("bob", dims);
+    for (int p = 0; p < per_identity; ++p) {
+      for (int i = 0; i < identities; ++i) {
+        entries.push_back(faces.sample(i));
+        labels.push_back(std::to_string(i));
+        gallery->add(labels.back(), entries.back().data());
+      }
+    }
+    CHECK_EQ(gallery->size(), entries.size());
+
+    // the index may miss the exact best match, but rarely
+    int agree = 0;
+    for (int q = 0; q < queries; ++q) {
+      queried.push_back(faces.sample(q % identities));
+      std::string label;
+      float similarity;
+      CHECK(gallery->search(queried.back().data(), &label, &similarity));
+      found.push_back(label);
+      agree += label == exactMatch(entries, labels, queried.back());
+    }
+    LOG(ERROR) << "IVF agrees with exhaustive search on " << agree << " of "
+               << queries;
+    CHECK_GE(agree, queries * 95 / 100);
+
+    // probing every list is exhaustive
+    FLAGS_gallery_nprobe = entries.size();
+    for (int q = 0; q < queries; ++q) {
+      std::string label;
+      float similarity;
+      CHECK(gallery->search(queried[q].data(), &label, &similarity));
+      CHECK_EQ(label, exactMatch(entries, labels, queried[q]));
+    }
+    FLAGS_gallery_nprobe = 16;
+  }
+
+  // the index is loaded rather than retrained, so searches answer the same
+  GalleryStore store(dir);
+  auto gallery = store.find("bob");
+  CHECK(gallery != nullptr);
+  CHECK_EQ(gallery->size(), entries.size());
+  for (int q = 0; q < queries; ++q) {
+    std::string label;
+    float similarity;
+    CHECK(gallery->search(queried[q].data(), &label, &similarity));
+    CHECK_EQ(label, found[q]);
+  }
+  removeDir(dir);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+
+  testExact();
+  testIvfRecall();
+  LOG(ERROR) << "Gallery tests passed";
+  return 0;
+}
@@ -0,0 +1,211 @@
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "../tools/Preprocess.h"
+
+DECLARE_int64(max_image_pixels);
+
+using namespace cpp2;
+
+namespace {
+
+TensorFormat parse(const std::string& type,
+    const std::vector<std::string>& tags) {
+  TensorFormat format;
+  std::string error;
+  CHECK(parseTensorFormat(type, tags, &format, &error)) << error;
+  return format;
+}
+
+std::string parseError(const std::string& type,
+    const std::vector<std::string>& tags) {
+  TensorFormat format;
+  std::string error;
+  CHECK(!parseTensorFormat(type, tags, &format, &error)) << type;
+  return error;
+}
+
+// A channels x height x width image as its interleaved bytes, every
+// component distinct.
+std::vector<unsigned char> pixels(int channels, int height, int width) {
+  std::vector<unsigned char> hwc((size_t) channels * height * width);
+  for (size_t i = 0; i < hwc.size(); ++i) {
+    hwc[i] = (i * 37 + 11) % 251;
+  }
+  return hwc;
+}
+
+// The same image in any of the four tensor encodings.
+std::string encode(const std::vector<unsigned char>& hwc,
+    const TensorFormat& format) {
+  std::string data(format.size(), '\0');
+  size_t plane = (size_t) format.height * format.width;
+  for (size_t p = 0; p < plane; ++p) {
+    for (int c = 0; c < format.channels; ++c) {
+      unsigned char value = hwc[p * format.channels + c];
+      size_t i = format.planar ? c * plane + p : p * format.channels + c;
+      if (format.f32) {
+        float f = value;
+        memcpy(&data[i * sizeof(float)], &f, sizeof(float));
+      } else {
+        data[i] = value;
+      }
+    }
+  }
+  return data;
+}
+
+std::vector<float> convert(const std::string& data,
+    const TensorFormat& format, int height, int width) {
+  std::vector<float> dst((size_t) format.channels * height * width);
+  std::string error;
+  CHECK(convertTensor(data.data(), data.size(), format, format.channels,
+      height, width, dst.data(), &error)) << error;
+  return dst;
+}
+
+TensorFormat format(bool f32, bool planar, int channels, int height,
+    int width) {
+  return TensorFormat{f32, planar, channels, height, width};
+}
+
+void testParse() {
+  TensorFormat f = parse("tensor_u8",
+      {"width=4", "face", "channels=3", "height=2"});
+  CHECK(!f.f32);
+  CHECK(!f.planar);
+  CHECK_EQ(f.channels, 3);
+  CHECK_EQ(f.height, 2);
+  CHECK_EQ(f.width, 4);
+  CHECK_EQ(f.size(), 24u);
+  CHECK_EQ(f.str(), "tensor_u8 HWC 3x2x4");
+
+  f = parse("tensor_f32",
+      {"height=2", "width=4", "channels=1", "layout=CHW"});
+  CHECK(f.f32);
+  CHECK(f.planar);
+  CHECK_EQ(f.size(), 8 * sizeof(float));
+  // the order of the tags does not change the description, which keys
+  // the result cache
+  CHECK_EQ(f.str(), parse("tensor_f32",
+      {"layout=CHW", "channels=1", "width=4", "height=2"}).str());
+  CHECK(f.str() != parse("tensor_f32",
+      {"layout=HWC", "channels=1", "width=4", "height=2"}).str());
+
+  CHECK(isTensor("tensor_u8"));
+  CHECK(!isTensor("image"));
+  CHECK_EQ(parseError("image", {"height=1", "width=1", "channels=1"}),
+      "unknown input type image");
+  CHECK_EQ(parseError("tensor_u8", {"height=1", "width=1"}),
+      "tensor input needs height, width and channels tags");
+  CHECK_EQ(parseError("tensor_u8",
+      {"height=1", "width=1", "channels=1", "layout=NCHW"}),
+      "unknown tensor layout NCHW");
+  for (std::string bad :
+      {"height=0", "height=-2", "height=", "height=2x", "channels=5"}) {
+    CHECK_EQ(parseError("tensor_u8", {"height=1", "width=1", "channels=1",
+        bad}), "bad tensor " + bad);
+  }
+  int64_t max_pixels = FLAGS_max_image_pixels;
+  FLAGS_max_image_pixels = 100;
+  parse("tensor_u8", {"height=10", "width=10", "channels=1"});
+  CHECK(!parseError("tensor_u8",
+      {"height=10", "width=11", "channels=1"}).empty());
+  FLAGS_max_image_pixels = max_pixels;
+}
+
+void testConvertSameSize() {
+  // the input blob is planar BGR, the tensors RGB in either layout; at the
+  // size of the input nothing is resampled
+  const int channels = 3, height = 4, width = 6;
+  std::vector<unsigned char> hwc = pixels(channels, height, width);
+  std::vector<float> expected((size_t) channels * height * width);
+  for (int y = 0; y < height; ++y) {
+    for (int x = 0; x < width; ++x) {
+      for (int c = 0; c < channels; ++c) {
+        expected[((channels - 1 - c) * height + y) * width + x] =
+            hwc[(y * width + x) * channels + c];
+      }
+    }
+  }
+  for (bool f32 : {false, true}) {
+    for (bool planar : {false, true}) {
+      TensorFormat f = format(f32, planar, channels, height, width);
+      CHECK(convert(encode(hwc, f), f, height, width) == expected)
+          << f.str();
+    }
+  }
+}
+
+void testConvertResize() {
+  // shrinking averages boxes, growing picks the nearest pixel; bytes and
+  // floats round alike, so a frame gives the same input in either type
+  for (int channels : {1, 3}) {
+    std::vector<unsigned char> hwc = pixels(channels, 8, 8);
+    TensorFormat bytes = format(false, false, channels, 8, 8);
+    std::vector<float> small = convert(encode(hwc, bytes), bytes, 4, 4);
+    std::vector<float> large = convert(encode(hwc, bytes), bytes, 16, 16);
+    for (bool f32 : {false, true}) {
+      for (bool planar : {false, true}) {
+        TensorFormat f = format(f32, planar, channels, 8, 8);
+        CHECK(convert(encode(hwc, f), f, 4, 4) == small) << f.str();
+        CHECK(convert(encode(hwc, f), f, 16, 16) == large) << f.str();
+      }
+    }
+    for (int c = 0; c < channels; ++c) {
+      const float* plane = large.data() + (channels - 1 - c) * 256;
+      for (int y = 0; y < 16; ++y) {
+        for (int x = 0; x < 16; ++x) {
+          CHECK_EQ(plane[y * 16 + x],
+              hwc[((y / 2) * 8 + x / 2) * channels + c]);
+        }
+      }
+    }
+
+    // every box of a flat image averages to its value, in the plane of its
+    // component
+    for (size_t i = 0; i < hwc.size(); ++i) {
+      hwc[i] = 50 * (1 + i % channels);
+    }
+    small = convert(encode(hwc, bytes), bytes, 4, 4);
+    for (int c = 0; c < channels; ++c) {
+      const float* plane = small.data() + (channels - 1 - c) * 16;
+      for (int i = 0; i < 16; ++i) {
+        CHECK_LE(std::fabs(plane[i] - 50 * (1 + c)), 0.5f);
+      }
+    }
+  }
+}
+
+void testConvertErrors() {
+  TensorFormat f = format(false, false, 3, 2, 2);
+  std::vector<float> dst(12);
+  std::string error;
+  CHECK(!convertTensor("short", 5, f, 3, 2, 2, dst.data(), &error));
+  CHECK_EQ(error, "tensor of 5 bytes, tensor_u8 HWC 3x2x2 takes 12");
+  // a gray tensor for a color net fails like a gray JPEG does
+  std::string gray(4, '\0');
+  CHECK(!convertTensor(gray.data(), gray.size(), format(false, false, 1, 2,
+      2), 3, 2, 2, dst.data(), &error));
+  CHECK_EQ(error, "null");
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  reserveScratch(3, 16, 16);
+
+  testParse();
+  testConvertSameSize();
+  testConvertResize();
+  testConvertErrors();
+  LOG(ERROR) << "Preprocess tests passed";
+  return 0;
+}
@@ -0,0 +1,200 @@
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "../../common/Admission.h"
+#include "../tools/ResultCache.h"
+
+using namespace cpp2;
+
+namespace {
+
+ResultCache::Key key(int i) {
+  return ResultCache::key(1, "image " + std::to_string(i));
+}
+
+// Looks key up and returns its reply, computing it as value when it misses;
+// computed tells whether it did.
+std::string get(ResultCache* cache, const ResultCache::Key& key,
+    const std::string& value, bool* computed = nullptr) {
+  std::string reply;
+  bool miss = false;
+  cache->get(key, [&](folly::Try<Result> result) {
+    reply = result.value().reply;
+  }, [&](ResultCache::Fill fill) {
+    miss = true;
+    fill(folly::Try<Result>(Result{value, true}), true);
+  });
+  if (computed != nullptr) {
+    *computed = miss;
+  }
+  return reply;
+}
+
+void testKeys() {
+  CHECK(ResultCache::key(1, "a") == ResultCache::key(1, "a"));
+  // other weights, other bytes and other tensor formats never match
+  CHECK(!(ResultCache::key(1, "a") == ResultCache::key(2, "a")));
+  CHECK(!(ResultCache::key(1, "a") == ResultCache::key(1, "b")));
+  CHECK(!(ResultCache::key(1, "a", "u8 3x2x2") ==
+      ResultCache::key(1, "a", "u8 3x4x1")));
+  CHECK(!(ResultCache::key(1, "a") == ResultCache::key(1, "a", "u8 1x1x1")));
+}
+
+void testLru() {
+  // one shard, so that the order of eviction is exact
+  ResultCache cache(3, 1);
+  bool computed;
+  for (int i = 0; i < 3; ++i) {
+    get(&cache, key(i), "v" + std::to_string(i), &computed);
+    CHECK(computed);
+  }
+  CHECK_EQ(get(&cache, key(0), "x", &computed), "v0");
+  CHECK(!computed);
+  // 1 is now the least recently used and makes room for 3
+  get(&cache, key(3), "v3", &computed);
+  CHECK(computed);
+  CHECK_EQ(get(&cache, key(1), "again", &computed), "again");
+  CHECK(computed);
+  // which evicted 2, while 0 and 3 stay
+  CHECK_EQ(get(&cache, key(0), "x", &computed), "v0");
+  CHECK(!computed);
+  CHECK_EQ(get(&cache, key(3), "x", &computed), "v3");
+  CHECK(!computed);
+  CHECK_EQ(get(&cache, key(2), "again", &computed), "again");
+  CHECK(computed);
+  CHECK_EQ(cache.hits(), 3u);
+  CHECK_EQ(cache.misses(), 6u);
+}
+
+void testShards() {
+  // every shard holds its share of the capacity
+  ResultCache cache(64, 8);
+  for (int i = 0; i < 1000; ++i) {
+    get(&cache, key(i), "v");
+  }
+  // newest first, so that the misses only evict what was already counted
+  int cached = 0;
+  for (int i = 999; i >= 0; --i) {
+    bool computed;
+    get(&cache, key(i), "v", &computed);
+    cached += !computed;
+  }
+  CHECK_EQ(cached, 64);
+}
+
+void testSingleflight() {
+  for (size_t capacity : {0, 10}) {
+    ResultCache cache(capacity, 4);
+    std::vector<ResultCache::Fill> fills;
+    std::vector<std::string> replies;
+    int computes = 0;
+    for (int i = 0; i < 5; ++i) {
+      cache.get(key(7), [&](folly::Try<Result> result) {
+        replies.push_back(result.value().reply);
+      }, [&](ResultCache::Fill fill) {
+        ++computes;
+        fills.push_back(fill);
+      });
+    }
+    // the first lookup computes, the others wait for it
+    CHECK_EQ(computes, 1);
+    CHECK(replies.empty());
+    CHECK_EQ(cache.coalesced(), 4u);
+    fills[0](folly::Try<Result>(Result{"seven", true}), true);
+    CHECK_EQ(replies.size(), 5u);
+    for (const auto& reply : replies) {
+      CHECK_EQ(reply, "seven");
+    }
+    // kept unless caching is off
+    bool computed;
+    get(&cache, key(7), "other", &computed);
+    CHECK_EQ(computed, capacity == 0);
+  }
+}
+
+void testFailures() {
+  ResultCache cache(10, 1);
+  // an error reaches every waiter and is not kept, the next lookup computes
+  // again; that is how the lookups coalesced onto a dropped request retry
+  int errors = 0;
+  ResultCache::Fill leader;
+  for (int i = 0; i < 3; ++i) {
+    cache.get(key(1), [&](folly::Try<Result> result) {
+      CHECK(result.hasException());
+      CHECK(isExpiredError(result.exception()));
+      ++errors;
+    }, [&](ResultCache::Fill fill) { leader = fill; });
+  }
+  leader(folly::Try<Result>(expiredError()), true);
+  CHECK_EQ(errors, 3);
+  CHECK(!isExpiredError(overloadedError()));
+  bool computed;
+  get(&cache, key(1), "v1", &computed);
+  CHECK(computed);
+
+  // replies completed with cache false are answered but not kept, error
+  // results with cache true are kept like labels
+  cache.get(key(2), [](folly::Try<Result> result) {},
+      [](ResultCache::Fill fill) {
+        fill(folly::Try<Result>(Result{"v2", true}), false);
+      });
+  get(&cache, key(2), "v2", &computed);
+  CHECK(computed);
+  cache.get(key(3), [](folly::Try<Result> result) {},
+      [](ResultCache::Fill fill) {
+        fill(folly::Try<Result>(Result{"bad jpeg", false}), true);
+      });
+  cache.get(key(3), [](folly::Try<Result> result) {
+    CHECK(!result.value().ok);
+    CHECK_EQ(result.value().reply, "bad jpeg");
+  }, [](ResultCache::Fill fill) { CHECK(false) << "computed again"; });
+}
+
+void testConcurrent() {
+  // threads looking up the same keys compute each of them once
+  ResultCache cache(1000, 16);
+  std::atomic<int> computes(0);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 8; ++t) {
+    threads.emplace_back([&cache, &computes]() {
+      for (int i = 0; i < 2000; ++i) {
+        int k = i % 200;
+        cache.get(key(k), [k](folly::Try<Result> result) {
+          // a waiter's result arrives on the computing thread
+          CHECK_EQ(result.value().reply, std::to_string(k));
+        }, [&](ResultCache::Fill fill) {
+          ++computes;
+          std::this_thread::yield();
+          fill(folly::Try<Result>(Result{std::to_string(k), true}), true);
+        });
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  CHECK_EQ(computes.load(), 200);
+  CHECK_EQ(cache.misses(), 200u);
+  CHECK_EQ(cache.hits() + cache.coalesced(), 8 * 2000u - 200);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+
+  testKeys();
+  testLru();
+  testShards();
+  testSingleflight();
+  testFailures();
+  testConcurrent();
+  LOG(ERROR) << "ResultCache tests passed";
+  return 0;
+}
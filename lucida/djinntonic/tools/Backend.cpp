@@ -0,0 +1,145 @@
+#include "Backend.h"
+
+#include <dirent.h>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "CaffeBackend.h"
+#include "Preprocess.h"
+
+DEFINE_bool(int8, false,
+            "Run convolution and inner product layers in int8, the same "
+            "as the int8 backend for every model (default: false)");
+
+DEFINE_string(parity_dir, "input",
+              "JPEGs on which backends other than caffe are checked "
+              "against caffe when they load (default: input)");
+
+DEFINE_double(min_parity, 0.9,
+              "Share of the --parity_dir images on which a backend must "
+              "agree with caffe, or it fails to load, 0 to only log "
+              "(default: 0.9)");
+
+DEFINE_double(parity_min_cosine, 0.99,
+              "Cosine similarity to the caffe features above which those "
+              "of another backend agree (default: 0.99)");
+
+namespace cpp2 {
+
+namespace {
+
+// Runs the images of --parity_dir through backend and through caffe on the
+// same files, and logs on how many they agree and the largest difference of
+// any output. An image agrees if its outputs, the labels, are identical and
+// its features point the same way: int8 perturbs every float of an
+// embedding a little, which does not matter for their cosine search.
+void checkParity(Backend* backend, const std::string& network,
+    const std::string& weights, const std::string& features) {
+  CaffeBackend reference(network, weights, 1, false, features);
+  if (reference.channels() != backend->channels() ||
+      reference.height() != backend->height() ||
+      reference.width() != backend->width() ||
+      reference.outputSize() != backend->outputSize() ||
+      reference.featureSize() != backend->featureSize()) {
+    throw std::runtime_error(backend->name() + " backend of " + network +
+        " does not have the input and output shape of caffe");
+  }
+  size_t in_size = (size_t) reference.channels() * reference.height() *
+      reference.width();
+  size_t out_size = reference.outputSize();
+  std::vector<float> expected(out_size + reference.featureSize());
+  std::vector<float> actual(expected.size());
+  int checked = 0;
+  int agree = 0;
+  float max_diff = 0.0f;
+  float min_cosine = 1.0f;
+  for (const auto& image : readFiles(FLAGS_parity_dir)) {
+    float* input = reference.input(0, 1);
+    std::string error;
+    if (!decodeJpeg(image.data(), image.size(), reference.channels(),
+        reference.height(), reference.width(), input, &error)) {
+      continue;
+    }
+    std::copy(input, input + in_size, backend->input(0, 1));
+    reference.forward(0, 1, expected.data(), false);
+    backend->forward(0, 1, actual.data(), false);
+    ++checked;
+    for (size_t i = 0; i < out_size; ++i) {
+      max_diff = std::max(max_diff, std::fabs(expected[i] - actual[i]));
+    }
+    float cosine = 1.0f;
+    if (expected.size() > out_size) {
+      double dot = 0, expected_norm = 0, actual_norm = 0;
+      for (size_t i = out_size; i < expected.size(); ++i) {
+        dot += (double) expected[i] * actual[i];
+        expected_norm += (double) expected[i] * expected[i];
+        actual_norm += (double) actual[i] * actual[i];
+      }
+      cosine = expected_norm > 0 && actual_norm > 0 ?
+          dot / std::sqrt(expected_norm * actual_norm) :
+          (expected_norm == actual_norm ? 1.0f : 0.0f);
+      min_cosine = std::min(min_cosine, cosine);
+    }
+    agree += std::equal(expected.begin(), expected.begin() + out_size,
+        actual.begin()) && cosine >= FLAGS_parity_min_cosine;
+  }
+  LOG(ERROR) << backend->name() << " backend of " << network
+             << " matches caffe on " << agree << " of " << checked
+             << " images in " << FLAGS_parity_dir
+             << ", largest output difference " << max_diff
+             << (expected.size() > out_size ?
+                 ", lowest feature cosine " + std::to_string(min_cosine) :
+                 "");
+  if (checked > 0 && agree < FLAGS_min_parity * checked) {
+    throw std::runtime_error(backend->name() + " backend of " + network +
+        " matches caffe on too few images");
+  }
+}
+
+} // namespace
+
+std::unique_ptr<Backend> makeBackend(const std::string& name,
+    const std::string& network, const std::string& weights, int replicas,
+    const std::string& features) {
+  std::unique_ptr<Backend> backend;
+  if (name == "caffe" || name == "int8") {
+    backend.reset(new CaffeBackend(network, weights, replicas,
+        name == "int8" || FLAGS_int8, features));
+  } else {
+    throw std::invalid_argument("unknown backend " + name);
+  }
+  // an int8 backend without calibration images stays caffe
+  if (backend->name() != "caffe") {
+    checkParity(backend.get(), network, weights, features);
+  }
+  return backend;
+}
+
+std::vector<std::string> readFiles(const std::string& dir) {
+  std::vector<std::string> names;
+  if (DIR* d = opendir(dir.c_str())) {
+    while (dirent* entry = readdir(d)) {
+      if (entry->d_name[0] != '.') {
+        names.push_back(entry->d_name);
+      }
+    }
+    closedir(d);
+  }
+  std::sort(names.begin(), names.end());
+  std::vector<std::string> files;
+  for (const auto& name : names) {
+    std::ifstream file(dir + "/" + name, std::ios::binary);
+    files.emplace_back(std::istreambuf_iterator<char>(file),
+        std::istreambuf_iterator<char>());
+  }
+  return files;
+}
+
+} // namespace cpp2
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace cpp2 {
+
+// An inference engine for one model: a fixed number of replicas that run
+// batched forward passes, each used by one thread at a time. The Batcher
+// only talks to this interface, so engines can be swapped per model with
+// --<model>_backend. Inputs are written straight into the replica's own
+// input buffer, so that images are decoded where the engine reads them;
+// outputs go to a buffer of the caller.
+class Backend {
+ public:
+  virtual ~Backend() {}
+
+  // name as given to makeBackend()
+  virtual std::string name() const = 0;
+  virtual int replicas() const = 0;
+
+  // C, H, W of one input image
+  virtual int channels() const = 0;
+  virtual int height() const = 0;
+  virtual int width() const = 0;
+  // floats of output per image
+  virtual int outputSize() const = 0;
+  // floats of features per image, see makeBackend
+  virtual int featureSize() const { return 0; }
+
+  // Hash of the model files and of anything else that changes the outputs,
+  // so that cached replies of other weights or engines are never returned.
+  virtual uint64_t identity() const = 0;
+
+  // Input buffer of the replica for a batch of n images, n * C * H * W
+  // floats in the layout of the net's input blob. It stays valid until the
+  // next call for the replica, and its first images survive a call with a
+  // smaller n.
+  virtual float* input(int replica, int n) = 0;
+
+  // Runs the first n images of the replica's input buffer and writes, for
+  // every image, outputSize() floats of output followed by featureSize()
+  // floats of features to output. With profile every layer is timed, if the
+  // engine supports it.
+  virtual void forward(int replica, int n, float* output, bool profile) = 0;
+
+  // Reserves the scratch space (see ScratchArena) of forward passes of up to
+  // max_batch images, before the threads that run them start.
+  virtual void reserveScratch(int max_batch) {}
+};
+
+// Loads the model in network and weights into a backend of replicas
+// replicas: "caffe", or "int8" for int8 convolution and inner product
+// layers. Backends other than caffe are checked against it on the images in
+// --parity_dir first. Throws if the name is unknown or the check fails.
+// With features, the output of every image is followed by the one of the
+// blob of that name, e.g. a face embedding, as its features.
+std::unique_ptr<Backend> makeBackend(const std::string& name,
+    const std::string& network, const std::string& weights, int replicas,
+    const std::string& features = "");
+
+// Contents of the files in dir, in name order, hidden ones skipped.
+std::vector<std::string> readFiles(const std::string& dir);
+
+} // namespace cpp2
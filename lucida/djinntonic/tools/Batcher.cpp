@@ -0,0 +1,324 @@
+#include "Batcher.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iterator>
+#include <sstream>
+#include <utility>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "../../common/CpuExecutor.h"
+#include "../../common/Stats.h"
+#include "../../common/ThreadBudget.h"
+#include "ScratchArena.h"
+
+DEFINE_int32(max_batch_size, 16,
+             "Maximum number of images per forward pass (default: 16)");
+
+DEFINE_int32(batch_window_us, 2000,
+             "Time to wait for a batch to fill up in us (default: 2000)");
+
+DEFINE_string(warmup_batch_sizes, "",
+              "Comma separated batch sizes to run a synthetic forward pass "
+              "with on every replica before serving, 0 for none (default: "
+              "--max_batch_size and 1)");
+
+DEFINE_bool(profile_layers, false,
+            "Time every layer of every forward pass, see LayerProfile "
+            "(default: false)");
+
+namespace cpp2 {
+
+namespace {
+
+// largest first, blobs keep their memory when shrinking
+std::vector<int> warmupSizes(int max_batch) {
+  std::vector<int> sizes;
+  if (FLAGS_warmup_batch_sizes.empty()) {
+    sizes = {max_batch, 1};
+  } else {
+    std::stringstream list(FLAGS_warmup_batch_sizes);
+    std::string size;
+    while (std::getline(list, size, ',')) {
+      if (atoi(size.c_str()) > 0) {
+        sizes.push_back(atoi(size.c_str()));
+      }
+    }
+  }
+  std::sort(sizes.rbegin(), sizes.rend());
+  sizes.erase(std::unique(sizes.begin(), sizes.end()), sizes.end());
+  return sizes;
+}
+
+} // namespace
+
+Batcher::Batcher(Backend* nets, Labeler labeler)
+    : nets_(nets),
+      labeler_(std::move(labeler)),
+      max_batch_(std::max(1, FLAGS_max_batch_size)),
+      window_(std::max(0, FLAGS_batch_window_us)),
+      buffers_(nets->replicas()),
+      queued_inputs_(0),
+      warmed_(0),
+      stop_(false) {
+  // every replica warms up on its dispatcher thread before the server starts
+  // taking requests: on the cores it will run on, so that its blobs are
+  // allocated on their node, and into the scratch arena its batches use
+  std::vector<int> sizes = warmupSizes(max_batch_);
+  nets_->reserveScratch(max_batch_);
+  int first = ThreadBudget::instance().assignReplicas(nets_->replicas());
+  for (int i = 0; i < nets_->replicas(); ++i) {
+    threads_.emplace_back([this, &sizes, first, i]() {
+      ThreadBudget::instance().pin(ThreadBudget::REPLICA, first + i);
+      warmUp(i, sizes);
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++warmed_;
+      }
+      warmed_cv_.notify_all();
+      loop(i);
+    });
+  }
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    warmed_cv_.wait(lock,
+        [this]() { return warmed_ == nets_->replicas(); });
+  }
+  if (!sizes.empty()) {
+    LOG(ERROR) << "Warmed up " << nets_->replicas() << " "
+               << nets_->name() << " replicas";
+  }
+}
+
+Batcher::~Batcher() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+}
+
+void Batcher::enqueue(std::vector<Fill> fills, Deadline deadline,
+    Done done, bool profile, bool features) {
+  if (fills.empty()) {
+    done(folly::Try<std::vector<Result>>(std::vector<Result>()));
+    return;
+  }
+  auto now = std::chrono::steady_clock::now();
+  // the results are allocated here rather than on the dispatcher
+  if ((int) fills.size() <= max_batch_) {
+    std::vector<Result> results(fills.size());
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      queued_inputs_ += fills.size();
+      queue_.push_back(Request{std::move(fills), std::move(results),
+          std::move(done), now, deadline, profile, features});
+    }
+    cv_.notify_one();
+    return;
+  }
+
+  // every part moves its results into the whole, the last one in answers
+  struct Join {
+    std::mutex mutex;
+    std::vector<Result> results;
+    folly::exception_wrapper error;
+    int pending;
+    Done done;
+  };
+  auto join = std::make_shared<Join>();
+  join->results.resize(fills.size());
+  join->pending = (fills.size() + max_batch_ - 1) / max_batch_;
+  join->done = std::move(done);
+  std::vector<Request> parts;
+  for (size_t begin = 0; begin < fills.size(); begin += max_batch_) {
+    size_t end = std::min(fills.size(), begin + max_batch_);
+    std::vector<Fill> part(std::make_move_iterator(fills.begin() + begin),
+        std::make_move_iterator(fills.begin() + end));
+    parts.push_back(Request{std::move(part), std::vector<Result>(end - begin),
+        [join, begin](folly::Try<std::vector<Result>> results) {
+      bool last;
+      {
+        std::lock_guard<std::mutex> lock(join->mutex);
+        if (results.hasValue()) {
+          std::move(results.value().begin(), results.value().end(),
+              join->results.begin() + begin);
+        } else {
+          join->error = results.exception();
+        }
+        last = --join->pending == 0;
+      }
+      if (last) {
+        join->done(join->error ?
+            folly::Try<std::vector<Result>>(join->error) :
+            folly::Try<std::vector<Result>>(std::move(join->results)));
+      }
+    }, now, deadline, profile, features});
+  }
+  // queued back to back, so that the parts run in the next batches
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& part : parts) {
+      queued_inputs_ += part.fills.size();
+      queue_.push_back(std::move(part));
+    }
+  }
+  cv_.notify_all();
+}
+
+void Batcher::warmUp(int replica, const std::vector<int>& sizes) {
+  Buffers& buffers = buffers_[replica];
+  buffers.batch.reserve(max_batch_);
+  buffers.dropped.reserve(max_batch_);
+  buffers.fills.reserve(max_batch_);
+  buffers.targets.reserve(max_batch_);
+  buffers.features.reserve(max_batch_);
+  buffers.filled.reserve(max_batch_);
+  buffers.output.resize((size_t) max_batch_ *
+      (nets_->outputSize() + nets_->featureSize()));
+
+  size_t in_size = (size_t) nets_->channels() * nets_->height() *
+      nets_->width();
+  for (int size : sizes) {
+    float* in_data = nets_->input(replica, size);
+    std::fill(in_data, in_data + size * in_size, 128.0f);
+    buffers.output.resize(std::max(buffers.output.size(),
+        (size_t) size * (nets_->outputSize() + nets_->featureSize())));
+    nets_->forward(replica, size, buffers.output.data(), false);
+  }
+}
+
+void Batcher::loop(int replica) {
+  // the warm-up sized this thread's scratch space, unless it was skipped
+  ScratchArena::get();
+  Histogram& batch_wait_us = Stats::instance().histogram("batch_wait_us");
+  Buffers& buffers = buffers_[replica];
+  std::vector<Request>& batch = buffers.batch;
+  std::vector<Request>& dropped = buffers.dropped;
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    cv_.wait(lock, [this]() { return stop_ || !queue_.empty(); });
+    if (stop_ && queue_.empty()) {
+      return;
+    }
+    // the window starts with the oldest pending request
+    auto flush = queue_.front().arrival + window_;
+    cv_.wait_until(lock, flush, [this]() {
+      return stop_ || queued_inputs_ >= max_batch_;
+    });
+
+    // another dispatcher may have taken the batch in the meantime. Requests
+    // past their deadline are dropped before any decoding.
+    int n = 0;
+    while (!queue_.empty() &&
+        (n == 0 || n + (int) queue_.front().fills.size() <= max_batch_)) {
+      Request& request = queue_.front();
+      queued_inputs_ -= request.fills.size();
+      batch_wait_us.add(std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - request.arrival).count());
+      if (expired(request.deadline)) {
+        dropped.push_back(std::move(request));
+      } else {
+        n += request.fills.size();
+        batch.push_back(std::move(request));
+      }
+      queue_.pop_front();
+    }
+
+    lock.unlock();
+    for (auto& request : dropped) {
+      request.done(folly::Try<std::vector<Result>>(expiredError()));
+    }
+    dropped.clear();
+    if (!batch.empty()) {
+      forward(replica, buffers);
+    }
+    batch.clear();
+    lock.lock();
+  }
+}
+
+void Batcher::forward(int replica, Buffers& buffers) {
+  static Histogram& batch_size = Stats::instance().histogram("batch_size");
+  static Histogram& forward_us = Stats::instance().histogram("forward_us");
+  std::vector<Request>& batch = buffers.batch;
+  int total = 0;
+  bool profile = FLAGS_profile_layers;
+  for (auto& request : batch) {
+    total += request.fills.size();
+    profile = profile || request.profile;
+  }
+  batch_size.add(total);
+
+  // inputs decode in parallel on the CPU executor, each straight into its
+  // slot of the input buffer
+  size_t in_size = (size_t) nets_->channels() * nets_->height() *
+      nets_->width();
+  float* in_data = nets_->input(replica, total);
+  std::vector<Fill*>& fills = buffers.fills;
+  std::vector<Result*>& targets = buffers.targets;
+  std::vector<char>& features = buffers.features;
+  std::vector<Result*>& filled = buffers.filled;
+  fills.clear();
+  targets.clear();
+  features.clear();
+  filled.clear();
+  for (auto& request : batch) {
+    for (size_t k = 0; k < request.fills.size(); ++k) {
+      fills.push_back(&request.fills[k]);
+      targets.push_back(&request.results[k]);
+      features.push_back(request.features);
+    }
+  }
+  CpuExecutor::instance().parallelFor(total, [&](int i) {
+    targets[i]->ok = (*fills[i])(in_data + (size_t) i * in_size,
+        &targets[i]->reply);
+  });
+
+  // the ones that failed keep their error as reply, close their gaps
+  for (int i = 0; i < total; ++i) {
+    if (!targets[i]->ok) {
+      continue;
+    }
+    if ((int) filled.size() != i) {
+      std::copy(in_data + (size_t) i * in_size,
+          in_data + (size_t) (i + 1) * in_size,
+          in_data + filled.size() * in_size);
+      features[filled.size()] = features[i];
+    }
+    filled.push_back(targets[i]);
+  }
+
+  int n = filled.size();
+  if (n > 0) {
+    // the input keeps its first n images when it shrinks
+    size_t out_size = nets_->outputSize();
+    size_t stride = out_size + nets_->featureSize();
+    // sized for max_batch_ by warmUp
+    std::vector<float>& output = buffers.output;
+    auto start = std::chrono::steady_clock::now();
+    nets_->forward(replica, n, output.data(), profile);
+    forward_us.add(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count());
+    for (int i = 0; i < n; ++i) {
+      const float* out = output.data() + i * stride;
+      filled[i]->reply = labeler_(out);
+      if (features[i]) {
+        filled[i]->features.assign(out + out_size, out + stride);
+      }
+    }
+  }
+
+  for (auto& request : batch) {
+    request.done(
+        folly::Try<std::vector<Result>>(std::move(request.results)));
+  }
+}
+
+} // namespace cpp2
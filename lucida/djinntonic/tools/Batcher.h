@@ -0,0 +1,104 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <folly/Try.h>
+
+#include "../../common/Admission.h"
+#include "Backend.h"
+#include "Result.h"
+
+namespace cpp2 {
+
+// Micro-batching queue in front of a Backend. Concurrent infer requests
+// are collected for up to --batch_window_us (or until --max_batch_size
+// inputs are pending), written straight into the replica's input buffer,
+// run through one forward pass, and each request is answered from its
+// slices of the output. A request may carry several inputs; up to
+// --max_batch_size of them go through the same forward pass, larger requests
+// are split into parts of that size. Every replica in the pool has its own
+// dispatcher thread, so batches run in parallel; the inputs of a batch are
+// decoded in parallel on the CpuExecutor.
+class Batcher {
+ public:
+  // Writes one input, C * H * W floats, into its slot of the input buffer.
+  // Returns false and sets error to the reply to send instead.
+  typedef std::function<bool(float* dst, std::string* error)> Fill;
+  // Receives the results of all inputs of a request, in order, or
+  // expiredError() if the request was dropped.
+  typedef std::function<void(folly::Try<std::vector<Result>> results)> Done;
+  // Maps one input's slice of the output to its reply.
+  typedef std::function<std::string(const float* out)> Labeler;
+
+  Batcher(Backend* nets, Labeler labeler);
+  ~Batcher();
+
+  // Queues one request, its fills run once the batch is formed unless the
+  // deadline passed by then. The parts of a request larger than a batch may
+  // run on different replicas, done is called once with all results. With
+  // profile the forward pass of its batch is timed layer by layer, as every
+  // pass is with --profile_layers. With features its results carry the
+  // features of their inputs.
+  void enqueue(std::vector<Fill> fills, Deadline deadline, Done done,
+      bool profile = false, bool features = false);
+
+ private:
+  struct Request {
+    std::vector<Fill> fills;
+    // one per fill, sized by enqueue and handed to done
+    std::vector<Result> results;
+    Done done;
+    std::chrono::steady_clock::time_point arrival;
+    Deadline deadline;
+    bool profile;
+    bool features;
+  };
+
+  // The working memory of a replica's dispatcher, sized for max_batch_
+  // inputs up front and reused by every batch, so that forming and running
+  // a batch allocates nothing.
+  struct Buffers {
+    std::vector<Request> batch;
+    std::vector<Request> dropped;
+    std::vector<Fill*> fills;
+    std::vector<Result*> targets;
+    // whether the request of each input wants its features
+    std::vector<char> features;
+    std::vector<Result*> filled;
+    std::vector<float> output;
+  };
+
+  // allocates the replica's buffers, then runs synthetic forward passes at
+  // each batch size, so that the first requests find their blobs and scratch
+  // space allocated and the weights paged in; runs on the replica's
+  // dispatcher thread before its loop
+  void warmUp(int replica, const std::vector<int>& sizes);
+  void loop(int replica);
+  void forward(int replica, Buffers& buffers);
+
+  Backend* nets_;
+  Labeler labeler_;
+  int max_batch_;
+  std::chrono::microseconds window_;
+  std::vector<Buffers> buffers_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<Request> queue_;
+  int queued_inputs_;
+  // replicas done warming up, the constructor waits for all of them
+  int warmed_;
+  std::condition_variable warmed_cv_;
+  bool stop_;
+  std::vector<std::thread> threads_;
+};
+
+} // namespace cpp2
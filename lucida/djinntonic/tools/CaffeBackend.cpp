@@ -0,0 +1,154 @@
+#include "CaffeBackend.h"
+
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+DEFINE_string(int8_calibration_dir, "input",
+              "JPEGs used to calibrate and check the int8 layers (default: "
+              "input)");
+
+using caffe::Blob;
+using caffe::Caffe;
+using caffe::Net;
+
+namespace cpp2 {
+
+namespace {
+
+// 64 bit FNV-1a, the identity only has to tell models apart and this keeps
+// the backend free of folly for the offline tools
+void hashBytes(const char* data, size_t size, uint64_t* hash) {
+  for (size_t i = 0; i < size; ++i) {
+    *hash = (*hash ^ static_cast<unsigned char>(data[i])) * 1099511628211ULL;
+  }
+}
+
+void hashFile(const std::string& path, uint64_t* hash) {
+  std::ifstream file(path, std::ios::binary);
+  char buffer[1 << 16];
+  while (file.read(buffer, sizeof(buffer)) || file.gcount() > 0) {
+    hashBytes(buffer, file.gcount(), hash);
+  }
+}
+
+} // namespace
+
+CaffeBackend::CaffeBackend(const std::string& network,
+    const std::string& weights, int size, bool int8,
+    const std::string& features) : features_(features) {
+  // Caffe's mode and phase are process wide, set them once before any net
+  // exists instead of flipping them on every request
+  Caffe::set_phase(Caffe::TEST);
+  Caffe::set_mode(Caffe::CPU);
+
+  size = std::max(1, size);
+  if (isWeightFile(weights)) {
+    mapped_.reset(new MappedWeights(weights));
+  }
+  nets_.emplace_back(new Net<float>(network));
+  if (mapped_) {
+    mapped_->shareWith(nets_[0].get());
+  } else {
+    nets_[0]->CopyTrainedLayersFrom(weights);
+  }
+  for (int i = 1; i < size; ++i) {
+    nets_.emplace_back(new Net<float>(network));
+    // drops the filler-initialized params in favor of replica 0's blobs
+    nets_[i]->ShareTrainedLayersWith(nets_[0].get());
+  }
+  if (int8) {
+    int8_.reset(new Int8Net(nets_[0].get(), FLAGS_int8_calibration_dir));
+    if (!int8_->calibrated()) {
+      int8_.reset();
+    }
+  }
+
+  // the nets end in an argmax, but any output blob shape works
+  reshape(nets_[0].get(), 1);
+  output_count_ = nets_[0]->output_blobs()[0]->count();
+  features_count_ = 0;
+  if (!features_.empty()) {
+    if (!nets_[0]->has_blob(features_)) {
+      throw std::invalid_argument(network + " has no blob " + features_);
+    }
+    features_count_ = nets_[0]->blob_by_name(features_)->count();
+  }
+
+  // int8 replies differ from fp32 ones, and with other calibration images
+  // from each other, so the mode and the scales are part of the identity
+  identity_ = 14695981039346656037ULL;
+  const char mode = int8_ ? 1 : 0;
+  hashBytes(&mode, 1, &identity_);
+  hashFile(network, &identity_);
+  hashFile(weights, &identity_);
+  hashBytes(features_.data(), features_.size(), &identity_);
+  if (int8_) {
+    std::vector<float> scales = int8_->inputScales();
+    hashBytes(reinterpret_cast<const char*>(scales.data()),
+        scales.size() * sizeof(float), &identity_);
+  }
+  LOG(ERROR) << "Created " << size << " " << name() << " replicas of "
+             << network << (mapped_ ? " on mapped weights" : "");
+}
+
+float* CaffeBackend::input(int replica, int n) {
+  Net<float>* net = nets_[replica].get();
+  reshape(net, n);
+  return net->input_blobs()[0]->mutable_cpu_data();
+}
+
+void CaffeBackend::forward(int replica, int n, float* output, bool profile) {
+  Net<float>* net = nets_[replica].get();
+  // shrinking a blob keeps its data
+  reshape(net, n);
+  if (profile) {
+    std::call_once(profile_once_,
+        [this]() { profile_.reset(new LayerProfile(nets_[0].get())); });
+    profile_->forward(net, [this, net](int i) {
+      if (int8_) {
+        int8_->forwardLayer(net, i);
+      } else {
+        net->ForwardFromTo(i, i);
+      }
+    });
+  } else if (int8_) {
+    int8_->forward(net);
+  } else {
+    float loss;
+    net->ForwardPrefilled(&loss);
+  }
+  const float* out = net->output_blobs()[0]->cpu_data();
+  if (features_count_ == 0) {
+    std::copy(out, out + (size_t) n * output_count_, output);
+    return;
+  }
+  const float* features = net->blob_by_name(features_)->cpu_data();
+  for (int i = 0; i < n; ++i) {
+    output = std::copy(out + (size_t) i * output_count_,
+        out + (size_t) (i + 1) * output_count_, output);
+    output = std::copy(features + (size_t) i * features_count_,
+        features + (size_t) (i + 1) * features_count_, output);
+  }
+}
+
+void CaffeBackend::reserveScratch(int max_batch) {
+  if (int8_) {
+    int8_->reserveScratch(max_batch);
+  }
+}
+
+void reshape(Net<float>* net, int num) {
+  Blob<float>* in_blob = net->input_blobs()[0];
+  // assumes C, H, W are known, only reshapes batch dim
+  if (in_blob->num() != num) {
+    in_blob->Reshape(num, in_blob->channels(), in_blob->height(),
+        in_blob->width());
+    net->Reshape();
+  }
+}
+
+} // namespace cpp2
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "caffe/caffe.hpp"
+#include "Backend.h"
+#include "Int8Net.h"
+#include "LayerProfile.h"
+#include "WeightFile.h"
+
+namespace cpp2 {
+
+// The default backend: a fixed set of Caffe Net replicas built from the same
+// prototxt. The first replica loads the trained weights; the others share
+// its parameter blobs, so each extra replica only costs its own activation
+// blobs. Weights converted with djinntonic/convert are mapped instead of
+// parsed, and then shared with every other process using the same file.
+// With int8 the pool also holds one int8 copy of the weights
+// that all replicas run on, see Int8Net. With features, every image's output
+// is followed by the blob of that name, which must exist in the prototxt.
+class CaffeBackend : public Backend {
+ public:
+  CaffeBackend(const std::string& network, const std::string& weights,
+      int size, bool int8, const std::string& features = "");
+
+  std::string name() const override { return int8_ ? "int8" : "caffe"; }
+  int replicas() const override { return nets_.size(); }
+
+  // as declared by the prototxt
+  int channels() const override {
+    return nets_[0]->input_blobs()[0]->channels();
+  }
+  int height() const override { return nets_[0]->input_blobs()[0]->height(); }
+  int width() const override { return nets_[0]->input_blobs()[0]->width(); }
+  int outputSize() const override { return output_count_; }
+  int featureSize() const override { return features_count_; }
+
+  // Hash of the prototxt and weight file contents, of the int8 mode and
+  // calibrated input scales and of the features blob.
+  uint64_t identity() const override { return identity_; }
+
+  // the replica's input blob, reshaped to n
+  float* input(int replica, int n) override;
+  void forward(int replica, int n, float* output, bool profile) override;
+  // the int8 layers' inputs, fp32 runs in Caffe's own blobs
+  void reserveScratch(int max_batch) override;
+
+ private:
+  // declared first so that it outlives the nets
+  std::unique_ptr<MappedWeights> mapped_;
+  std::vector<std::unique_ptr<caffe::Net<float>>> nets_;
+  const std::string features_;
+  // floats per image of the output blob and of the features blob
+  int output_count_;
+  int features_count_;
+  uint64_t identity_;
+  std::unique_ptr<Int8Net> int8_;
+  // set up on the first profiled pass
+  std::once_flag profile_once_;
+  std::unique_ptr<LayerProfile> profile_;
+};
+
+// Reshapes the batch dimension of the net's input blob and propagates the
+// new shape through all layers.
+void reshape(caffe::Net<float>* net, int num);
+
+} // namespace cpp2
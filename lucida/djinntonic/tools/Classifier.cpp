@@ -0,0 +1,407 @@
+#include "Classifier.h"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+#include <folly/MoveWrapper.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "../../common/CpuExecutor.h"
+#include "../../common/Stats.h"
+#include "Preprocess.h"
+
+DEFINE_int32(result_cache_size, 10000,
+             "Number of replies kept per model, 0 disables caching "
+             "(default: 10000)");
+
+DEFINE_int32(feature_cache_size, 1000,
+             "Number of replies with features (such as FACE embeddings) "
+             "kept per model, 0 disables caching them (default: 1000)");
+
+DEFINE_int32(result_cache_shards, 16,
+             "Number of independently locked parts of the result cache "
+             "(default: 16)");
+
+DEFINE_int32(frame_hash_distance, 4,
+             "Bits in which the hash of a stream frame may differ from the "
+             "stream's last classified frame for its reply to be reused, "
+             "-1 classifies every frame (default: 4)");
+
+DEFINE_int32(max_streams, 10000,
+             "Number of inferFrame streams whose last frame is kept "
+             "(default: 10000)");
+
+DEFINE_int32(stream_idle_s, 300,
+             "Seconds after which a stream without frames is forgotten "
+             "(default: 300)");
+
+namespace cpp2 {
+
+namespace {
+
+// streams of different LUCIDs may share a name
+std::string streamKey(const std::string& LUCID, const std::string& stream) {
+  return LUCID + '\0' + stream;
+}
+
+} // namespace
+
+Classifier::Classifier(Loader loader)
+    : loader_(std::move(loader)),
+      cache_(new ResultCache(std::max(0, FLAGS_result_cache_size),
+          FLAGS_result_cache_shards)),
+      features_cache_(new ResultCache(std::max(0, FLAGS_feature_cache_size),
+          FLAGS_result_cache_shards)),
+      streams_(std::max(0, FLAGS_max_streams),
+          std::chrono::seconds(FLAGS_stream_idle_s)),
+      model_(load()),
+      reloading_(false) {
+}
+
+bool Classifier::reload() {
+  if (reloading_.exchange(true)) {
+    return false;
+  }
+  std::thread([this]() {
+    try {
+      std::shared_ptr<Model> model = load();
+      // replies of the old model stay cached under its identity and age out,
+      // the key frames of the streams are dropped
+      std::atomic_store(&model_, model);
+      streams_.clear();
+      LOG(ERROR) << "Swapped in the reloaded model";
+    } catch (const std::exception& e) {
+      LOG(ERROR) << "Reload failed, keeping the current model: " << e.what();
+    }
+    reloading_ = false;
+  }).detach();
+  return true;
+}
+
+std::shared_ptr<Classifier::Model> Classifier::load() {
+  Batcher::Labeler labeler;
+  std::unique_ptr<Model> model(new Model());
+  model->nets = loader_(&labeler);
+  // the batcher threads create their arenas right away, and it warms the
+  // nets up before returning
+  Backend* nets = model->nets.get();
+  reserveScratch(nets->channels(), nets->height(), nets->width());
+  model->batcher.reset(new Batcher(nets, std::move(labeler)));
+  // the last reference may go away on one of the model's own batcher
+  // threads, which cannot join themselves
+  return std::shared_ptr<Model>(model.release(), [](Model* model) {
+    std::thread([model]() { delete model; }).detach();
+  });
+}
+
+folly::Future<std::unique_ptr<std::string>> Classifier::infer(
+    std::unique_ptr< ::cpp2::QuerySpec> query, Deadline deadline,
+    Resolve resolve) {
+  folly::MoveWrapper<folly::Promise<std::unique_ptr<std::string>>> promise;
+  auto future = promise->getFuture();
+  std::shared_ptr< ::cpp2::QuerySpec> shared(std::move(query));
+  Image image{nullptr, nullptr};
+  if (!shared->content.empty() && !shared->content[0].data.empty()) {
+    image = Image{&shared->content[0], &shared->content[0].data[0]};
+  }
+  bool features = resolve != nullptr;
+  classify(shared, {image}, deadline, features, resolved(std::move(resolve),
+      [promise](folly::Try<std::vector<Result>> results) {
+    promise->setTry(results.hasValue() ?
+        folly::Try<std::unique_ptr<std::string>>(
+            folly::make_unique<std::string>(
+                std::move(results.value()[0].reply))) :
+        folly::Try<std::unique_ptr<std::string>>(results.exception()));
+  }));
+  return future;
+}
+
+folly::Future<std::unique_ptr<std::vector<std::string>>>
+Classifier::inferBatch(std::unique_ptr< ::cpp2::QuerySpec> query,
+    Deadline deadline, Resolve resolve) {
+  folly::MoveWrapper<folly::Promise<
+      std::unique_ptr<std::vector<std::string>>>> promise;
+  auto future = promise->getFuture();
+  std::shared_ptr< ::cpp2::QuerySpec> shared(std::move(query));
+  std::vector<Image> images;
+  for (const auto& input : shared->content) {
+    for (const auto& image : input.data) {
+      images.push_back(Image{&input, &image});
+    }
+  }
+  bool features = resolve != nullptr;
+  classify(shared, std::move(images), deadline, features,
+      resolved(std::move(resolve),
+          [promise](folly::Try<std::vector<Result>> results) {
+    typedef std::unique_ptr<std::vector<std::string>> Replies;
+    if (results.hasException()) {
+      promise->setException(results.exception());
+      return;
+    }
+    Replies replies(new std::vector<std::string>());
+    for (auto& result : results.value()) {
+      replies->push_back(std::move(result.reply));
+    }
+    promise->setValue(std::move(replies));
+  }));
+  return future;
+}
+
+folly::Future<std::unique_ptr<std::vector<Result>>>
+Classifier::inferFeatures(std::unique_ptr< ::cpp2::QuerySpec> query,
+    Deadline deadline) {
+  folly::MoveWrapper<folly::Promise<
+      std::unique_ptr<std::vector<Result>>>> promise;
+  auto future = promise->getFuture();
+  std::shared_ptr< ::cpp2::QuerySpec> shared(std::move(query));
+  std::vector<Image> images;
+  for (const auto& input : shared->content) {
+    for (const auto& image : input.data) {
+      images.push_back(Image{&input, &image});
+    }
+  }
+  classify(shared, std::move(images), deadline, true,
+      [promise](folly::Try<std::vector<Result>> results) {
+    typedef std::unique_ptr<std::vector<Result>> Results;
+    promise->setTry(results.hasValue() ?
+        folly::Try<Results>(folly::make_unique<std::vector<Result>>(
+            std::move(results.value()))) :
+        folly::Try<Results>(results.exception()));
+  });
+  return future;
+}
+
+folly::Future<std::unique_ptr<std::string>> Classifier::inferFrame(
+    const std::string& LUCID, const std::string& stream,
+    std::unique_ptr< ::cpp2::QuerySpec> frame, Deadline deadline,
+    Resolve resolve) {
+  static Counter& reused = Stats::instance().counter("frames.reused");
+  static Counter& classified =
+      Stats::instance().counter("frames.classified");
+  folly::MoveWrapper<folly::Promise<std::unique_ptr<std::string>>> promise;
+  auto future = promise->getFuture();
+  std::shared_ptr< ::cpp2::QuerySpec> shared(std::move(frame));
+  std::string key = streamKey(LUCID, stream);
+  CpuExecutor::instance().add(
+      [this, promise, shared, key, deadline, resolve]() {
+    if (expired(deadline)) {
+      promise->setException(expiredError());
+      return;
+    }
+    auto reply = [promise](std::string value) {
+      promise->setValue(folly::make_unique<std::string>(std::move(value)));
+    };
+    if (shared->content.empty() || shared->content[0].data.empty()) {
+      reply("null");
+      return;
+    }
+    Image image{&shared->content[0], &shared->content[0].data[0]};
+    bool tensor = isTensor(image.input->type);
+    TensorFormat format{};
+    std::string error;
+    uint64_t hash;
+    if ((tensor && !parseTensorFormat(image.input->type, image.input->tags,
+        &format, &error)) ||
+        !frameHash(image.data->data(), image.data->size(),
+            tensor ? &format : nullptr, &hash, &error)) {
+      reply(error);
+      return;
+    }
+    uint64_t generation = streams_.generation();
+    uint64_t identity = model()->nets->identity();
+    std::string previous;
+    if (streams_.lookup(key, identity, hash, FLAGS_frame_hash_distance,
+        &previous)) {
+      reused.add();
+      reply(std::move(previous));
+      return;
+    }
+    classified.add();
+    // the frame becomes the key frame once it is classified, with the
+    // resolved reply, unless the streams were cleared in between. A frame
+    // that failed to decode leaves the key frame as it is.
+    classify(shared, {image}, deadline, resolve != nullptr,
+        resolved(resolve, [this, promise, key, generation, identity, hash](
+            folly::Try<std::vector<Result>> results) {
+      if (results.hasException()) {
+        promise->setException(results.exception());
+        return;
+      }
+      Result& result = results.value()[0];
+      if (result.ok) {
+        streams_.update(key, generation, identity, hash, result.reply);
+      }
+      promise->setValue(
+          folly::make_unique<std::string>(std::move(result.reply)));
+    }));
+  });
+  return future;
+}
+
+void Classifier::closeStream(const std::string& LUCID,
+    const std::string& stream) {
+  streams_.close(streamKey(LUCID, stream));
+}
+
+Batcher::Done Classifier::resolved(Resolve resolve, Batcher::Done done) {
+  if (!resolve) {
+    return done;
+  }
+  // off the batcher and cache threads that complete the results
+  return [resolve, done](folly::Try<std::vector<Result>> results) {
+    auto move_results = folly::makeMoveWrapper(std::move(results));
+    CpuExecutor::instance().add([resolve, done, move_results]() {
+      if (move_results->hasValue()) {
+        for (auto& result : move_results->value()) {
+          if (result.ok) {
+            result.reply = resolve(result);
+            result.features.clear();
+          }
+        }
+      }
+      done(std::move(*move_results));
+    });
+  };
+}
+
+void Classifier::classify(std::shared_ptr< ::cpp2::QuerySpec> query,
+    std::vector<Image> images, Deadline deadline, bool features,
+    Batcher::Done done) {
+  std::shared_ptr<Model> model = this->model();
+  ResultCache* cache = features ? features_cache_.get() : cache_.get();
+  struct State {
+    std::vector<Result> results;
+    std::mutex mutex;
+    folly::exception_wrapper error;
+    std::atomic<int> pending;
+    Batcher::Done done;
+  };
+  // one extra count keeps results that arrive while the loop below still
+  // runs from finishing the request early
+  auto state = std::make_shared<State>();
+  state->results.resize(images.size());
+  state->pending = images.size() + 1;
+  state->done = std::move(done);
+  auto finish = [state]() {
+    if (--state->pending == 0) {
+      state->done(state->error ?
+          folly::Try<std::vector<Result>>(state->error) :
+          folly::Try<std::vector<Result>>(std::move(state->results)));
+    }
+  };
+
+  // a "profile" tag on any input times the layers of the forward pass
+  bool profile = false;
+  for (const auto& input : query->content) {
+    profile = profile || std::find(input.tags.begin(), input.tags.end(),
+        "profile") != input.tags.end();
+  }
+
+  std::vector<Batcher::Fill> fills;
+  std::vector<ResultCache::Fill> completions;
+  for (size_t i = 0; i < images.size(); ++i) {
+    const std::string* image = images[i].data;
+    if (image == nullptr) {
+      state->results[i] = Result{"null", false};
+      finish();
+      continue;
+    }
+    // the tags of a tensor are checked here, its size once it is converted
+    bool tensor = isTensor(images[i].input->type);
+    TensorFormat format{};
+    if (tensor) {
+      std::string error;
+      if (!parseTensorFormat(images[i].input->type, images[i].input->tags,
+          &format, &error)) {
+        state->results[i] = Result{error, false};
+        finish();
+        continue;
+      }
+    }
+    lookup(Lookup{model, cache, query, image, tensor, format, deadline,
+        profile, features},
+        [state, i, finish](folly::Try<Result> result) {
+          if (result.hasValue()) {
+            state->results[i] = std::move(result.value());
+          } else {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            state->error = result.exception();
+          }
+          finish();
+        }, &fills, &completions);
+  }
+  if (!fills.empty()) {
+    enqueue(Lookup{model, cache, query, nullptr, false, TensorFormat{},
+        deadline, profile, features}, std::move(fills),
+        std::move(completions));
+  }
+  finish();
+  LOG_EVERY_N(ERROR, 10000) << cache_->report();
+}
+
+void Classifier::lookup(const Lookup& image, ResultCache::Callback done,
+    std::vector<Batcher::Fill>* fills,
+    std::vector<ResultCache::Fill>* completions) {
+  static Counter& retried = Stats::instance().counter("result_cache.retried");
+  image.cache->get(ResultCache::key(image.model->nets->identity(),
+      *image.image, image.tensor ? image.format.str() : ""),
+      [this, image, done](folly::Try<Result> result) {
+        // the run this lookup waited on was dropped for the deadline of the
+        // request that started it, which need not be this one's
+        if (result.hasException() && isExpiredError(result.exception()) &&
+            !expired(image.deadline)) {
+          retried.add();
+          lookup(image, done, nullptr, nullptr);
+          return;
+        }
+        done(std::move(result));
+      },
+      [&](ResultCache::Fill complete) {
+        // the image is decoded from the received payload once its batch
+        // forms, directly into the backend's input buffer
+        Backend* nets = image.model->nets.get();
+        auto query = image.query;
+        const std::string* data = image.image;
+        bool tensor = image.tensor;
+        TensorFormat format = image.format;
+        Batcher::Fill fill = [query, data, nets, tensor, format](float* dst,
+            std::string* error) {
+          if (tensor) {
+            return convertTensor(data->data(), data->size(), format,
+                nets->channels(), nets->height(), nets->width(), dst, error);
+          }
+          return decodeJpeg(data->data(), data->size(), nets->channels(),
+              nets->height(), nets->width(), dst, error);
+        };
+        if (fills != nullptr) {
+          fills->push_back(std::move(fill));
+          completions->push_back(std::move(complete));
+        } else {
+          enqueue(image, {std::move(fill)}, {std::move(complete)});
+        }
+      });
+}
+
+void Classifier::enqueue(const Lookup& request,
+    std::vector<Batcher::Fill> fills,
+    std::vector<ResultCache::Fill> completions) {
+  // decode errors depend on the bytes alone, so they are cached as well. A
+  // dropped request fails its own lookups, and the coalesced ones retry.
+  // The model stays alive until the request is done with it.
+  std::shared_ptr<Model> model = request.model;
+  model->batcher->enqueue(std::move(fills), request.deadline,
+      [completions, model](folly::Try<std::vector<Result>> results) {
+    for (size_t k = 0; k < completions.size(); ++k) {
+      completions[k](results.hasValue() ?
+          folly::Try<Result>(std::move(results.value()[k])) :
+          folly::Try<Result>(results.exception()), true);
+    }
+  }, request.profile, request.features);
+}
+
+} // namespace cpp2
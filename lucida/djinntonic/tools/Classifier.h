@@ -0,0 +1,149 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <folly/futures/Future.h>
+
+#include "../gen-cpp2/lucidatypes_types.h"
+#include "../../common/Admission.h"
+#include "Backend.h"
+#include "Batcher.h"
+#include "FrameStreams.h"
+#include "Preprocess.h"
+#include "ResultCache.h"
+
+namespace cpp2 {
+
+// The infer path shared by DIG, FACE and IMC: replies for images seen before
+// come from a ResultCache, the others are decoded into a Batcher's forward
+// pass. Identical images in flight at the same time are only run once; if
+// that run is dropped for its deadline, the others waiting on it try again
+// within their own.
+// Inputs of a tensor type (see TensorFormat) skip the JPEG decode. Frames of
+// a video stream are only classified when they differ from the stream's
+// last classified frame, see FrameStreams; swapping in a reloaded model
+// clears the streams.
+//
+// Callers that answer from the features of an image rather than from the
+// model's label, like FACE with its galleries, pass a Resolve. Requests with
+// one get the features through the batcher and cache them apart from the
+// labels, in a smaller cache of --feature_cache_size entries.
+//
+// The model (nets, batcher and labels) can be reloaded while serving. Every
+// request holds a reference to the model it started on, so requests under
+// way when a new model is swapped in finish on the old one, which is freed
+// after the last of them.
+class Classifier {
+ public:
+  // Loads a model: returns its backend and sets the labeler for its output.
+  typedef std::function<std::unique_ptr<Backend>(Batcher::Labeler* labeler)>
+      Loader;
+
+  // Turns the result of an image with its features into the reply. Runs on
+  // the CPU executor, once per image that was classified.
+  typedef std::function<std::string(const Result& result)> Resolve;
+
+  explicit Classifier(Loader loader);
+
+  const ResultCache& cache() const { return *cache_; }
+
+  // Loads and warms up a new model on a thread of its own, then swaps it in.
+  // Returns false if a reload is already running.
+  bool reload();
+
+  // Classifies the first data item of the first content entry, queries
+  // without one get "null". Fails with expiredError() if the deadline
+  // passes before the image is decoded.
+  folly::Future<std::unique_ptr<std::string>> infer(
+      std::unique_ptr< ::cpp2::QuerySpec> query, Deadline deadline,
+      Resolve resolve = nullptr);
+
+  // Classifies all data items of all content entries, in order. The images
+  // that miss the cache share forward passes, see Batcher.
+  folly::Future<std::unique_ptr<std::vector<std::string>>> inferBatch(
+      std::unique_ptr< ::cpp2::QuerySpec> query, Deadline deadline,
+      Resolve resolve = nullptr);
+
+  // Like inferBatch, with the features of every image that was classified.
+  folly::Future<std::unique_ptr<std::vector<Result>>> inferFeatures(
+      std::unique_ptr< ::cpp2::QuerySpec> query, Deadline deadline);
+
+  // Like infer, for the next frame of a stream of the LUCID: the frame's
+  // hash is computed on the CPU executor, and if it is within
+  // --frame_hash_distance of the stream's key frame that frame's reply is
+  // returned without decoding or running the frame.
+  folly::Future<std::unique_ptr<std::string>> inferFrame(
+      const std::string& LUCID, const std::string& stream,
+      std::unique_ptr< ::cpp2::QuerySpec> frame, Deadline deadline,
+      Resolve resolve = nullptr);
+
+  void closeStream(const std::string& LUCID, const std::string& stream);
+
+  // Drops the key frames of all streams, for when their replies change
+  // without the model changing, as FACE's do when its galleries do.
+  void clearStreams() { streams_.clear(); }
+
+ private:
+  // One image of a query, either a JPEG or a pre-decoded tensor as told by
+  // the type of its input. Both point into the query, images without data
+  // are answered with "null".
+  struct Image {
+    const ::cpp2::QueryInput* input;
+    const std::string* data;
+  };
+
+  // With features the results carry the features of their images.
+  void classify(std::shared_ptr< ::cpp2::QuerySpec> query,
+      std::vector<Image> images, Deadline deadline, bool features,
+      Batcher::Done done);
+
+  // done, after resolve replaced the replies of the classified images on
+  // the CPU executor. done itself without a resolve.
+  static Batcher::Done resolved(Resolve resolve, Batcher::Done done);
+
+  struct Model {
+    std::unique_ptr<Backend> nets;
+    std::unique_ptr<Batcher> batcher;  // declared last, stops first
+  };
+
+  // An image to look up in a cache, with what running it on a miss takes.
+  struct Lookup {
+    std::shared_ptr<Model> model;
+    ResultCache* cache;
+    std::shared_ptr< ::cpp2::QuerySpec> query;  // holds the image
+    const std::string* image;
+    bool tensor;
+    TensorFormat format;
+    Deadline deadline;
+    bool profile;
+    bool features;
+  };
+
+  // Answers done from the cache, or adds the image's fill and completion
+  // to fills and completions on a miss. Without fills the image is queued
+  // on its own, as when a lookup coalesced onto a dropped request retries.
+  void lookup(const Lookup& image, ResultCache::Callback done,
+      std::vector<Batcher::Fill>* fills,
+      std::vector<ResultCache::Fill>* completions);
+  // Queues the fills on the model's batcher, each completing its key.
+  static void enqueue(const Lookup& request,
+      std::vector<Batcher::Fill> fills,
+      std::vector<ResultCache::Fill> completions);
+
+  std::shared_ptr<Model> load();
+  std::shared_ptr<Model> model() const { return std::atomic_load(&model_); }
+
+  Loader loader_;
+  std::unique_ptr<ResultCache> cache_;
+  // results with features, kept apart so that the others stay small
+  std::unique_ptr<ResultCache> features_cache_;
+  FrameStreams streams_;
+  std::shared_ptr<Model> model_;
+  std::atomic<bool> reloading_;
+};
+
+} // namespace cpp2
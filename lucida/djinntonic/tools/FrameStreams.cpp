@@ -0,0 +1,92 @@
+#include "FrameStreams.h"
+
+#include <utility>
+
+#include "Preprocess.h"
+
+namespace cpp2 {
+
+FrameStreams::FrameStreams(size_t max_streams, std::chrono::seconds idle)
+    : max_streams_(max_streams), idle_(idle), generation_(0) {
+}
+
+bool FrameStreams::lookup(const std::string& stream, uint64_t identity,
+    uint64_t hash, int distance, std::string* reply) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto now = Clock::now();
+  expire(now);
+  auto it = streams_.find(stream);
+  if (it == streams_.end()) {
+    return false;
+  }
+  Stream& state = it->second;
+  state.used = now;
+  lru_.splice(lru_.begin(), lru_, state.lru);
+  // replies of a reloaded model's predecessor are not reused
+  if (state.identity != identity ||
+      hashDistance(state.hash, hash) > distance) {
+    return false;
+  }
+  *reply = state.reply;
+  return true;
+}
+
+void FrameStreams::update(const std::string& stream, uint64_t generation,
+    uint64_t identity, uint64_t hash, std::string reply) {
+  if (max_streams_ == 0) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (generation != generation_) {
+    return;
+  }
+  auto now = Clock::now();
+  auto it = streams_.find(stream);
+  if (it == streams_.end()) {
+    lru_.push_front(stream);
+    it = streams_.emplace(stream, Stream()).first;
+    it->second.lru = lru_.begin();
+  } else {
+    lru_.splice(lru_.begin(), lru_, it->second.lru);
+  }
+  Stream& state = it->second;
+  state.identity = identity;
+  state.hash = hash;
+  state.reply = std::move(reply);
+  state.used = now;
+  expire(now);
+}
+
+void FrameStreams::close(const std::string& stream) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = streams_.find(stream);
+  if (it != streams_.end()) {
+    lru_.erase(it->second.lru);
+    streams_.erase(it);
+  }
+}
+
+void FrameStreams::clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  ++generation_;
+  streams_.clear();
+  lru_.clear();
+}
+
+uint64_t FrameStreams::generation() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return generation_;
+}
+
+void FrameStreams::expire(Clock::time_point now) {
+  while (!lru_.empty()) {
+    auto it = streams_.find(lru_.back());
+    if (streams_.size() <= max_streams_ && now - it->second.used < idle_) {
+      break;
+    }
+    streams_.erase(it);
+    lru_.pop_back();
+  }
+}
+
+} // namespace cpp2
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace cpp2 {
+
+// Per-stream state of inferFrame: the frame hash and reply of the last frame
+// of every stream that the model classified, its key frame. Later frames
+// are compared with the key frame rather than with the frame just before, so
+// that a slow pan cannot drift away from the frame the reply belongs to.
+// Streams are dropped when closed, after --stream_idle_s without a frame,
+// and the least recently used ones beyond --max_streams. All of them are
+// dropped by clear, when their replies may have changed.
+class FrameStreams {
+ public:
+  FrameStreams(size_t max_streams, std::chrono::seconds idle);
+
+  // Sets reply to the key frame's if the stream has one from the model of
+  // that identity within distance of hash.
+  bool lookup(const std::string& stream, uint64_t identity, uint64_t hash,
+      int distance, std::string* reply);
+
+  // Makes the frame with that hash and reply the stream's key frame, unless
+  // the streams were cleared since generation() returned generation, before
+  // the frame was classified.
+  void update(const std::string& stream, uint64_t generation,
+      uint64_t identity, uint64_t hash, std::string reply);
+
+  void close(const std::string& stream);
+
+  // Drops the key frames of all streams.
+  void clear();
+  uint64_t generation();
+
+ private:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Stream {
+    uint64_t identity;
+    uint64_t hash;
+    std::string reply;
+    Clock::time_point used;
+    // position in lru_
+    std::list<std::string>::iterator lru;
+  };
+
+  // drops streams past the idle time or the count, caller holds mutex_
+  void expire(Clock::time_point now);
+
+  const size_t max_streams_;
+  const std::chrono::seconds idle_;
+  std::mutex mutex_;
+  // bumped by clear
+  uint64_t generation_;
+  std::unordered_map<std::string, Stream> streams_;
+  // most recently used first
+  std::list<std::string> lru_;
+};
+
+} // namespace cpp2
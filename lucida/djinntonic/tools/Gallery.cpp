@@ -0,0 +1,581 @@
+#include "Gallery.h"
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "../../common/CpuExecutor.h"
+#include "../../common/Stats.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DJINN_X86 1
+#endif
+
+DEFINE_int32(gallery_exact_max, 4096,
+             "Largest gallery searched exhaustively, larger ones are "
+             "searched through an IVF index (default: 4096)");
+
+DEFINE_int32(gallery_nprobe, 16,
+             "IVF lists scanned per search of a large gallery, more is "
+             "slower but misses fewer matches (default: 16)");
+
+namespace cpp2 {
+
+namespace {
+
+const char kGalleryMagic[8] = {'D', 'J', 'G', 'A', 'L', 'R', 'Y', '1'};
+const char kIndexMagic[8] = {'D', 'J', 'G', 'I', 'V', 'F', '0', '1'};
+
+// k-means training: sample entries per list, iterations, and at most lists
+const int kSamplesPerList = 32;
+const int kIterations = 10;
+const int kMaxLists = 4096;
+
+typedef float (*DotFn)(const float* a, const float* b, int n);
+
+float dotScalar(const float* a, const float* b, int n) {
+  float sum = 0.0f;
+  for (int i = 0; i < n; ++i) {
+    sum += a[i] * b[i];
+  }
+  return sum;
+}
+
+#ifdef DJINN_X86
+__attribute__((target("sse4.1")))
+float dotSse41(const float* a, const float* b, int n) {
+  __m128 acc0 = _mm_setzero_ps();
+  __m128 acc1 = _mm_setzero_ps();
+  int k = 0;
+  for (; k + 8 <= n; k += 8) {
+    acc0 = _mm_add_ps(acc0,
+        _mm_mul_ps(_mm_loadu_ps(a + k), _mm_loadu_ps(b + k)));
+    acc1 = _mm_add_ps(acc1,
+        _mm_mul_ps(_mm_loadu_ps(a + k + 4), _mm_loadu_ps(b + k + 4)));
+  }
+  __m128 acc = _mm_add_ps(acc0, acc1);
+  acc = _mm_hadd_ps(acc, acc);
+  acc = _mm_hadd_ps(acc, acc);
+  return _mm_cvtss_f32(acc) + dotScalar(a + k, b + k, n - k);
+}
+
+// two accumulators hide the latency of the fused multiply-add
+__attribute__((target("avx2,fma")))
+float dotAvx2(const float* a, const float* b, int n) {
+  __m256 acc0 = _mm256_setzero_ps();
+  __m256 acc1 = _mm256_setzero_ps();
+  int k = 0;
+  for (; k + 16 <= n; k += 16) {
+    acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + k), _mm256_loadu_ps(b + k),
+        acc0);
+    acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + k + 8),
+        _mm256_loadu_ps(b + k + 8), acc1);
+  }
+  __m256 acc = _mm256_add_ps(acc0, acc1);
+  __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc),
+      _mm256_extractf128_ps(acc, 1));
+  sum = _mm_hadd_ps(sum, sum);
+  sum = _mm_hadd_ps(sum, sum);
+  return _mm_cvtss_f32(sum) + dotScalar(a + k, b + k, n - k);
+}
+#endif
+
+DotFn selectDot() {
+#ifdef DJINN_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    return dotAvx2;
+  }
+  if (__builtin_cpu_supports("sse4.1")) {
+    return dotSse41;
+  }
+#endif
+  return dotScalar;
+}
+
+float dot(const float* a, const float* b, int n) {
+  static const DotFn fn = selectDot();
+  return fn(a, b, n);
+}
+
+// scales v to unit length, so that dot products are cosine similarities
+void normalize(float* v, int n) {
+  float norm = std::sqrt(dot(v, v, n));
+  if (norm > 0.0f) {
+    for (int i = 0; i < n; ++i) {
+      v[i] /= norm;
+    }
+  }
+}
+
+int nearest(const float* centroids, int nlist, int dims, const float* v) {
+  int best = 0;
+  float best_sim = -std::numeric_limits<float>::infinity();
+  for (int c = 0; c < nlist; ++c) {
+    float sim = dot(centroids + (size_t) c * dims, v, dims);
+    if (sim > best_sim) {
+      best_sim = sim;
+      best = c;
+    }
+  }
+  return best;
+}
+
+template <typename T>
+void writePod(std::ostream& out, const T& value) {
+  out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <typename T>
+bool readPod(std::istream& in, T* value) {
+  return (bool) in.read(reinterpret_cast<char*>(value), sizeof(*value));
+}
+
+void writeString(std::ostream& out, const std::string& s) {
+  writePod(out, (uint32_t) s.size());
+  out.write(s.data(), s.size());
+}
+
+bool readString(std::istream& in, std::string* s) {
+  uint32_t size;
+  if (!readPod(in, &size) || size > (1u << 20)) {
+    return false;
+  }
+  s->resize(size);
+  return size == 0 || in.read(&(*s)[0], size);
+}
+
+void writeHeader(std::ostream& out, const std::string& LUCID, int dims) {
+  out.write(kGalleryMagic, sizeof(kGalleryMagic));
+  writePod(out, (int32_t) dims);
+  writeString(out, LUCID);
+}
+
+bool readHeader(std::istream& in, std::string* LUCID, int* dims) {
+  char magic[sizeof(kGalleryMagic)];
+  int32_t d;
+  if (!in.read(magic, sizeof(magic)) ||
+      memcmp(magic, kGalleryMagic, sizeof(magic)) != 0 ||
+      !readPod(in, &d) || d <= 0 || !readString(in, LUCID)) {
+    return false;
+  }
+  *dims = d;
+  return true;
+}
+
+// LUCIDs are user names, keep only characters that are safe in a file name
+std::string fileName(const std::string& LUCID) {
+  std::string name;
+  for (unsigned char c : LUCID) {
+    if (isalnum(c) || c == '_' || c == '-') {
+      name += c;
+    } else {
+      char hex[4];
+      snprintf(hex, sizeof(hex), "%%%02X", c);
+      name += hex;
+    }
+  }
+  return name;
+}
+
+bool endsWith(const std::string& s, const std::string& suffix) {
+  return s.size() >= suffix.size() &&
+      s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+} // namespace
+
+Gallery::Gallery(const std::string& path, const std::string& LUCID, int dims)
+    : path_(path), lucid_(LUCID), dims_(dims), nlist_(0), trained_size_(0) {
+  std::lock_guard<std::mutex> learn(learn_mutex_);
+  load();
+}
+
+size_t Gallery::size() const {
+  folly::SharedMutex::ReadHolder read(mutex_);
+  return entries_.size();
+}
+
+void Gallery::add(const std::string& label, const float* embedding) {
+  Entry entry;
+  entry.label = label;
+  entry.vector.reset(new float[dims_]);
+  std::copy(embedding, embedding + dims_, entry.vector.get());
+  normalize(entry.vector.get(), dims_);
+
+  std::lock_guard<std::mutex> learn(learn_mutex_);
+  // the index only changes under learn_mutex_
+  entry.list = centroids_.empty() ? -1 :
+      nearest(centroids_.data(), nlist_, dims_, entry.vector.get());
+  append('A', label, entry.vector.get());
+  size_t n;
+  {
+    folly::SharedMutex::WriteHolder write(mutex_);
+    if (entry.list >= 0) {
+      lists_[entry.list].push_back(entries_.size());
+    }
+    entries_.push_back(std::move(entry));
+    n = entries_.size();
+  }
+  if (n > (size_t) std::max(0, FLAGS_gallery_exact_max) &&
+      n >= 2 * trained_size_) {
+    train();
+  }
+}
+
+void Gallery::remove(const std::string& label) {
+  std::lock_guard<std::mutex> learn(learn_mutex_);
+  {
+    folly::SharedMutex::WriteHolder write(mutex_);
+    size_t before = entries_.size();
+    entries_.erase(std::remove_if(entries_.begin(), entries_.end(),
+        [&label](const Entry& e) { return e.label == label; }),
+        entries_.end());
+    if (entries_.size() == before) {
+      return;
+    }
+    buildLists();
+  }
+  // compacted on the next load
+  append('R', label, nullptr);
+}
+
+bool Gallery::search(const float* embedding, std::string* label,
+    float* similarity) const {
+  static Histogram& search_us =
+      Stats::instance().histogram("face.gallery_search_us");
+  ScopedTimer timer(search_us);
+  std::vector<float> query(embedding, embedding + dims_);
+  normalize(query.data(), dims_);
+
+  folly::SharedMutex::ReadHolder read(mutex_);
+  const Entry* best = nullptr;
+  float best_sim = -std::numeric_limits<float>::infinity();
+  auto scan = [&](const Entry& e) {
+    float sim = dot(query.data(), e.vector.get(), dims_);
+    if (sim > best_sim) {
+      best_sim = sim;
+      best = &e;
+    }
+  };
+  if (centroids_.empty()) {
+    for (const auto& e : entries_) {
+      scan(e);
+    }
+  } else {
+    std::vector<std::pair<float, int>> lists(nlist_);
+    for (int c = 0; c < nlist_; ++c) {
+      lists[c] = std::make_pair(
+          dot(query.data(), centroids_.data() + (size_t) c * dims_, dims_),
+          c);
+    }
+    int probe = std::min(nlist_, std::max(1, FLAGS_gallery_nprobe));
+    std::partial_sort(lists.begin(), lists.begin() + probe, lists.end(),
+        std::greater<std::pair<float, int>>());
+    for (int p = 0; p < probe; ++p) {
+      for (uint32_t i : lists_[lists[p].second]) {
+        scan(entries_[i]);
+      }
+    }
+  }
+  if (!best) {
+    return false;
+  }
+  *label = best->label;
+  *similarity = best_sim;
+  return true;
+}
+
+void Gallery::append(char type, const std::string& label,
+    const float* embedding) {
+  file_.put(type);
+  writeString(file_, label);
+  if (embedding) {
+    file_.write(reinterpret_cast<const char*>(embedding),
+        sizeof(float) * dims_);
+  }
+  file_.flush();
+  if (!file_) {
+    LOG(ERROR) << "Failed to write " << path_ << ".gallery, the change "
+               << "is lost on restart";
+    file_.clear();
+  }
+}
+
+void Gallery::rewrite() {
+  std::string name = path_ + ".gallery";
+  std::string tmp = name + ".tmp";
+  {
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    writeHeader(out, lucid_, dims_);
+    for (const auto& e : entries_) {
+      out.put('A');
+      writeString(out, e.label);
+      out.write(reinterpret_cast<const char*>(e.vector.get()),
+          sizeof(float) * dims_);
+    }
+    out.flush();
+    if (!out || rename(tmp.c_str(), name.c_str()) != 0) {
+      throw std::runtime_error("failed to write " + name);
+    }
+  }
+  file_.close();
+  file_.open(name, std::ios::binary | std::ios::app);
+}
+
+void Gallery::load() {
+  std::string name = path_ + ".gallery";
+  std::ifstream in(name, std::ios::binary);
+  if (!in) {
+    rewrite();
+    return;
+  }
+  std::string lucid;
+  int dims;
+  if (!readHeader(in, &lucid, &dims) || lucid != lucid_ || dims != dims_) {
+    throw std::runtime_error(name + " is not a gallery of " + lucid_ +
+        " with " + std::to_string(dims_) + " floats per face");
+  }
+  // a record cut short by a crash ends the file
+  bool compact = false;
+  char type;
+  while (in.get(type)) {
+    std::string label;
+    if ((type != 'A' && type != 'R') || !readString(in, &label)) {
+      compact = true;
+      break;
+    }
+    if (type == 'R') {
+      entries_.erase(std::remove_if(entries_.begin(), entries_.end(),
+          [&label](const Entry& e) { return e.label == label; }),
+          entries_.end());
+      compact = true;
+      continue;
+    }
+    Entry entry;
+    entry.label = label;
+    entry.vector.reset(new float[dims_]);
+    entry.list = -1;
+    if (!in.read(reinterpret_cast<char*>(entry.vector.get()),
+        sizeof(float) * dims_)) {
+      compact = true;
+      break;
+    }
+    entries_.push_back(std::move(entry));
+  }
+  in.close();
+  if (compact) {
+    rewrite();
+  } else {
+    file_.open(name, std::ios::binary | std::ios::app);
+  }
+  loadIndex();
+  if (centroids_.empty() &&
+      entries_.size() > (size_t) std::max(0, FLAGS_gallery_exact_max)) {
+    train();
+  }
+  LOG(ERROR) << "Loaded " << entries_.size() << " faces of " << lucid_
+             << " from " << name
+             << (centroids_.empty() ? "" : " with an IVF index");
+}
+
+void Gallery::loadIndex() {
+  std::ifstream in(path_ + ".ivf", std::ios::binary);
+  char magic[sizeof(kIndexMagic)];
+  int32_t dims;
+  int32_t nlist;
+  uint64_t trained_size;
+  if (!in.read(magic, sizeof(magic)) ||
+      memcmp(magic, kIndexMagic, sizeof(magic)) != 0 ||
+      !readPod(in, &dims) || dims != dims_ ||
+      !readPod(in, &nlist) || nlist <= 0 || nlist > kMaxLists ||
+      !readPod(in, &trained_size)) {
+    return;
+  }
+  std::vector<float> centroids((size_t) nlist * dims_);
+  if (!in.read(reinterpret_cast<char*>(centroids.data()),
+      sizeof(float) * centroids.size())) {
+    return;
+  }
+  std::vector<int> lists = assign(centroids, nlist);
+  centroids_.swap(centroids);
+  nlist_ = nlist;
+  for (size_t i = 0; i < entries_.size(); ++i) {
+    entries_[i].list = lists[i];
+  }
+  buildLists();
+  trained_size_ = trained_size;
+}
+
+void Gallery::saveIndex() {
+  std::string name = path_ + ".ivf";
+  std::string tmp = name + ".tmp";
+  std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+  out.write(kIndexMagic, sizeof(kIndexMagic));
+  writePod(out, (int32_t) dims_);
+  writePod(out, (int32_t) nlist_);
+  writePod(out, (uint64_t) trained_size_);
+  out.write(reinterpret_cast<const char*>(centroids_.data()),
+      sizeof(float) * centroids_.size());
+  out.close();
+  if (!out || rename(tmp.c_str(), name.c_str()) != 0) {
+    LOG(ERROR) << "Failed to write " << name << ", the index is retrained "
+               << "on restart";
+  }
+}
+
+void Gallery::train() {
+  auto start = std::chrono::steady_clock::now();
+  size_t n = entries_.size();
+  int nlist = std::max(1, std::min(kMaxLists, (int) std::sqrt(n)));
+  size_t samples = std::min(n, (size_t) nlist * kSamplesPerList);
+  // evenly spread over the entries, so that early enrollments do not
+  // dominate
+  std::vector<const float*> sample(samples);
+  for (size_t i = 0; i < samples; ++i) {
+    sample[i] = entries_[i * n / samples].vector.get();
+  }
+  std::vector<float> centroids((size_t) nlist * dims_);
+  for (int c = 0; c < nlist; ++c) {
+    const float* v = sample[(size_t) c * samples / nlist];
+    std::copy(v, v + dims_, centroids.begin() + (size_t) c * dims_);
+  }
+
+  std::vector<int> near(samples);
+  std::vector<float> sums;
+  std::vector<int> counts;
+  for (int iteration = 0; iteration < kIterations; ++iteration) {
+    CpuExecutor::instance().parallelFor(samples, [&](int i) {
+      near[i] = nearest(centroids.data(), nlist, dims_, sample[i]);
+    });
+    sums.assign(centroids.size(), 0.0f);
+    counts.assign(nlist, 0);
+    for (size_t i = 0; i < samples; ++i) {
+      float* sum = sums.data() + (size_t) near[i] * dims_;
+      for (int d = 0; d < dims_; ++d) {
+        sum[d] += sample[i][d];
+      }
+      ++counts[near[i]];
+    }
+    // spherical k-means: the mean direction of a list, an empty list keeps
+    // its centroid
+    for (int c = 0; c < nlist; ++c) {
+      if (counts[c] > 0) {
+        float* centroid = centroids.data() + (size_t) c * dims_;
+        std::copy(sums.begin() + (size_t) c * dims_,
+            sums.begin() + (size_t) (c + 1) * dims_, centroid);
+        normalize(centroid, dims_);
+      }
+    }
+  }
+
+  std::vector<int> lists = assign(centroids, nlist);
+  {
+    folly::SharedMutex::WriteHolder write(mutex_);
+    centroids_.swap(centroids);
+    nlist_ = nlist;
+    for (size_t i = 0; i < n; ++i) {
+      entries_[i].list = lists[i];
+    }
+    buildLists();
+    trained_size_ = n;
+  }
+  saveIndex();
+  LOG(ERROR) << "Trained " << nlist << " IVF lists over " << n
+             << " faces of " << lucid_ << " in "
+             << std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::steady_clock::now() - start).count()
+             << " ms";
+}
+
+std::vector<int> Gallery::assign(const std::vector<float>& centroids,
+    int nlist) const {
+  std::vector<int> lists(entries_.size());
+  CpuExecutor::instance().parallelFor(entries_.size(), [&](int i) {
+    lists[i] = nearest(centroids.data(), nlist, dims_,
+        entries_[i].vector.get());
+  });
+  return lists;
+}
+
+void Gallery::buildLists() {
+  lists_.assign(centroids_.empty() ? 0 : nlist_,
+      std::vector<uint32_t>());
+  if (lists_.empty()) {
+    return;
+  }
+  for (size_t i = 0; i < entries_.size(); ++i) {
+    lists_[entries_[i].list].push_back(i);
+  }
+}
+
+GalleryStore::GalleryStore(const std::string& dir) : dir_(dir) {
+  if (mkdir(dir_.c_str(), 0755) != 0 && errno != EEXIST) {
+    LOG(ERROR) << "Cannot create " << dir_ << ", galleries are not kept";
+  }
+  std::vector<std::string> names;
+  if (DIR* d = opendir(dir_.c_str())) {
+    while (dirent* entry = readdir(d)) {
+      std::string name = entry->d_name;
+      if (endsWith(name, ".gallery")) {
+        names.push_back(name.substr(0, name.size() - strlen(".gallery")));
+      }
+    }
+    closedir(d);
+  }
+  for (const auto& name : names) {
+    std::string path = dir_ + "/" + name;
+    std::ifstream in(path + ".gallery", std::ios::binary);
+    std::string lucid;
+    int dims;
+    if (!readHeader(in, &lucid, &dims)) {
+      LOG(ERROR) << "Skipping " << path << ".gallery, not a gallery";
+      continue;
+    }
+    in.close();
+    try {
+      galleries_[lucid] = std::make_shared<Gallery>(path, lucid, dims);
+    } catch (const std::exception& e) {
+      LOG(ERROR) << "Skipping " << path << ".gallery: " << e.what();
+    }
+  }
+}
+
+std::shared_ptr<Gallery> GalleryStore::find(const std::string& LUCID) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = galleries_.find(LUCID);
+  return it == galleries_.end() ? nullptr : it->second;
+}
+
+std::shared_ptr<Gallery> GalleryStore::create(const std::string& LUCID,
+    int dims) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto& gallery = galleries_[LUCID];
+  if (!gallery) {
+    try {
+      gallery = std::make_shared<Gallery>(dir_ + "/" + fileName(LUCID),
+          LUCID, dims);
+    } catch (...) {
+      galleries_.erase(LUCID);
+      throw;
+    }
+  }
+  return gallery;
+}
+
+} // namespace cpp2
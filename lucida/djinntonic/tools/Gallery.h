@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <folly/SharedMutex.h>
+
+namespace cpp2 {
+
+// The enrolled faces of one LUCID: L2-normalized embeddings with the label
+// of the person, searched by cosine similarity. Up to --gallery_exact_max
+// entries every one is compared with the query; beyond that an inverted
+// file index (IVF) of about sqrt(n) k-means centroids is trained, and a
+// query only scans the entries of its --gallery_nprobe nearest centroids.
+// The index is retrained whenever the gallery doubled since.
+// Every change is appended to <path>.gallery and the centroids are written
+// to <path>.ivf, so that a restarted server gets both back without
+// retraining. Searches run concurrently; changes are serialized.
+class Gallery {
+ public:
+  // Loads the gallery files at path if they exist, otherwise creates an
+  // empty gallery of LUCID for embeddings of dims floats. Throws if the
+  // files exist with other dims or cannot be written.
+  Gallery(const std::string& path, const std::string& LUCID, int dims);
+
+  const std::string& LUCID() const { return lucid_; }
+  int dims() const { return dims_; }
+  size_t size() const;
+
+  // Adds the embedding of dims floats under label.
+  void add(const std::string& label, const float* embedding);
+
+  // Drops all entries of label.
+  void remove(const std::string& label);
+
+  // Sets label and similarity to the best match of the embedding, false if
+  // the gallery is empty.
+  bool search(const float* embedding, std::string* label,
+      float* similarity) const;
+
+ private:
+  // Appends an add ('A') or remove ('R') record to the gallery file.
+  void append(char type, const std::string& label, const float* embedding);
+  // Writes the entries to a new gallery file that replaces the old one,
+  // which drops the records of removed entries.
+  void rewrite();
+  void load();
+  void loadIndex();
+  void saveIndex();
+  // k-means over a sample of the entries, then assigns every entry to its
+  // nearest centroid. The caller holds learn_mutex_; mutex_ is only taken
+  // to install the result, so searches go on meanwhile.
+  void train();
+  // nearest centroid of every entry, caller holds learn_mutex_
+  std::vector<int> assign(const std::vector<float>& centroids,
+      int nlist) const;
+  // rebuilds lists_ from the entries, caller holds mutex_ exclusively
+  void buildLists();
+
+  struct Entry {
+    std::string label;
+    // dims floats, allocated per entry so that a growing gallery never
+    // copies the others while searches wait
+    std::unique_ptr<float[]> vector;
+    // IVF list, -1 without an index
+    int list;
+  };
+
+  const std::string path_;
+  const std::string lucid_;
+  const int dims_;
+  // serializes add, remove and train
+  std::mutex learn_mutex_;
+  // guards the entries and the index against concurrent searches
+  mutable folly::SharedMutex mutex_;
+  std::vector<Entry> entries_;
+  // IVF centroids, nlist_ * dims_ floats, empty while the gallery is
+  // searched exhaustively
+  std::vector<float> centroids_;
+  int nlist_;
+  // the entries of every list
+  std::vector<std::vector<uint32_t>> lists_;
+  // entries at the last training
+  size_t trained_size_;
+  std::ofstream file_;
+};
+
+// The galleries of all LUCIDs, one pair of files each in dir. All of them
+// are loaded when the store is created.
+class GalleryStore {
+ public:
+  explicit GalleryStore(const std::string& dir);
+
+  // The gallery of LUCID, null if it has none.
+  std::shared_ptr<Gallery> find(const std::string& LUCID) const;
+
+  // The gallery of LUCID, created with dims if it has none.
+  std::shared_ptr<Gallery> create(const std::string& LUCID, int dims);
+
+ private:
+  const std::string dir_;
+  mutable std::mutex mutex_;
+  std::map<std::string, std::shared_ptr<Gallery>> galleries_;
+};
+
+} // namespace cpp2
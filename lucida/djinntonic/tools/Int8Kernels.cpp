@@ -0,0 +1,253 @@
+#include "Int8Kernels.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DJINN_X86 1
+#endif
+
+namespace cpp2 {
+
+namespace {
+
+// rows of b handled per pass over a, small enough to stay in cache
+const int kBlock = 32;
+// output tiles are kTile x kTile, every row of a and b loaded once per tile
+// feeds kTile products instead of one
+const int kTile = 4;
+
+// sum of a[k] * b[k] for k < n, n a multiple of 16
+typedef int32_t (*DotFn)(const int8_t* a, const int8_t* b, int n);
+// sums[i * kTile + j] = dot(a_i, b_j) for the kTile rows of a and of b,
+// which are n apart, n a multiple of 16
+typedef void (*TileFn)(const int8_t* a, const int8_t* b, int n,
+    int32_t* sums);
+
+int32_t dotScalar(const int8_t* a, const int8_t* b, int n) {
+  int32_t sum = 0;
+  for (int k = 0; k < n; ++k) {
+    sum += a[k] * b[k];
+  }
+  return sum;
+}
+
+void tileScalar(const int8_t* a, const int8_t* b, int n, int32_t* sums) {
+  for (int i = 0; i < kTile; ++i) {
+    for (int j = 0; j < kTile; ++j) {
+      sums[i * kTile + j] = dotScalar(a + (size_t) i * n,
+          b + (size_t) j * n, n);
+    }
+  }
+}
+
+#ifdef DJINN_X86
+// products of two int8 fit an int16 pair sum, so widen to 16 bits and let
+// madd accumulate pairs into 32 bit lanes
+__attribute__((target("sse4.1")))
+int32_t dotSse41(const int8_t* a, const int8_t* b, int n) {
+  __m128i acc = _mm_setzero_si128();
+  for (int k = 0; k < n; k += 8) {
+    __m128i x = _mm_cvtepi8_epi16(_mm_loadl_epi64((const __m128i*) (a + k)));
+    __m128i y = _mm_cvtepi8_epi16(_mm_loadl_epi64((const __m128i*) (b + k)));
+    acc = _mm_add_epi32(acc, _mm_madd_epi16(x, y));
+  }
+  acc = _mm_hadd_epi32(acc, acc);
+  acc = _mm_hadd_epi32(acc, acc);
+  return _mm_cvtsi128_si32(acc);
+}
+
+__attribute__((target("avx2")))
+int32_t dotAvx2(const int8_t* a, const int8_t* b, int n) {
+  __m256i acc = _mm256_setzero_si256();
+  for (int k = 0; k < n; k += 16) {
+    __m256i x = _mm256_cvtepi8_epi16(
+        _mm_loadu_si128((const __m128i*) (a + k)));
+    __m256i y = _mm256_cvtepi8_epi16(
+        _mm_loadu_si128((const __m128i*) (b + k)));
+    acc = _mm256_add_epi32(acc, _mm256_madd_epi16(x, y));
+  }
+  __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(acc),
+      _mm256_extracti128_si256(acc, 1));
+  sum = _mm_hadd_epi32(sum, sum);
+  sum = _mm_hadd_epi32(sum, sum);
+  return _mm_cvtsi128_si32(sum);
+}
+
+// adds up the lanes of four accumulators into sums[0..3]
+__attribute__((target("sse4.1")))
+void reduce4Sse41(__m128i x0, __m128i x1, __m128i x2, __m128i x3,
+    int32_t* sums) {
+  __m128i sum = _mm_hadd_epi32(_mm_hadd_epi32(x0, x1),
+      _mm_hadd_epi32(x2, x3));
+  _mm_storeu_si128((__m128i*) sums, sum);
+}
+
+__attribute__((target("sse4.1")))
+void tileSse41(const int8_t* a, const int8_t* b, int n, int32_t* sums) {
+  __m128i acc[kTile][kTile];
+  for (int i = 0; i < kTile; ++i) {
+    for (int j = 0; j < kTile; ++j) {
+      acc[i][j] = _mm_setzero_si128();
+    }
+  }
+  for (int k = 0; k < n; k += 8) {
+    __m128i y[kTile];
+    for (int j = 0; j < kTile; ++j) {
+      y[j] = _mm_cvtepi8_epi16(
+          _mm_loadl_epi64((const __m128i*) (b + (size_t) j * n + k)));
+    }
+    for (int i = 0; i < kTile; ++i) {
+      __m128i x = _mm_cvtepi8_epi16(
+          _mm_loadl_epi64((const __m128i*) (a + (size_t) i * n + k)));
+      for (int j = 0; j < kTile; ++j) {
+        acc[i][j] = _mm_add_epi32(acc[i][j], _mm_madd_epi16(x, y[j]));
+      }
+    }
+  }
+  for (int i = 0; i < kTile; ++i) {
+    reduce4Sse41(acc[i][0], acc[i][1], acc[i][2], acc[i][3],
+        sums + i * kTile);
+  }
+}
+
+__attribute__((target("avx2")))
+void tileAvx2(const int8_t* a, const int8_t* b, int n, int32_t* sums) {
+  __m256i acc[kTile][kTile];
+  for (int i = 0; i < kTile; ++i) {
+    for (int j = 0; j < kTile; ++j) {
+      acc[i][j] = _mm256_setzero_si256();
+    }
+  }
+  for (int k = 0; k < n; k += 16) {
+    __m256i y[kTile];
+    for (int j = 0; j < kTile; ++j) {
+      y[j] = _mm256_cvtepi8_epi16(
+          _mm_loadu_si128((const __m128i*) (b + (size_t) j * n + k)));
+    }
+    for (int i = 0; i < kTile; ++i) {
+      __m256i x = _mm256_cvtepi8_epi16(
+          _mm_loadu_si128((const __m128i*) (a + (size_t) i * n + k)));
+      for (int j = 0; j < kTile; ++j) {
+        acc[i][j] = _mm256_add_epi32(acc[i][j], _mm256_madd_epi16(x, y[j]));
+      }
+    }
+  }
+  // fold the upper halves onto the lower ones, then as for SSE
+  for (int i = 0; i < kTile; ++i) {
+    __m128i half[kTile];
+    for (int j = 0; j < kTile; ++j) {
+      half[j] = _mm_add_epi32(_mm256_castsi256_si128(acc[i][j]),
+          _mm256_extracti128_si256(acc[i][j], 1));
+    }
+    reduce4Sse41(half[0], half[1], half[2], half[3], sums + i * kTile);
+  }
+}
+#endif
+
+struct Kernels {
+  DotFn dot;
+  TileFn tile;
+};
+
+Kernels selectKernels() {
+#ifdef DJINN_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return {dotAvx2, tileAvx2};
+  }
+  if (__builtin_cpu_supports("sse4.1")) {
+    return {dotSse41, tileSse41};
+  }
+#endif
+  return {dotScalar, tileScalar};
+}
+
+const Kernels& kernels() {
+  static const Kernels selected = selectKernels();
+  return selected;
+}
+
+} // namespace
+
+int int8RowLength(int k) {
+  return (k + 15) / 16 * 16;
+}
+
+void quantizeInt8(const float* src, int n, float scale, int8_t* dst) {
+  for (int i = 0; i < n; ++i) {
+    float q = nearbyintf(src[i] * scale);
+    dst[i] = (int8_t) std::max(-127.0f, std::min(127.0f, q));
+  }
+}
+
+void im2colInt8(const int8_t* image, int channels, int height, int width,
+    int kernel, int pad, int stride, int out_h, int out_w, int8_t* columns) {
+  int k = channels * kernel * kernel;
+  int row = int8RowLength(k);
+  for (int y = 0; y < out_h; ++y) {
+    for (int x = 0; x < out_w; ++x) {
+      int8_t* col = columns + (size_t) (y * out_w + x) * row;
+      for (int c = 0; c < channels; ++c) {
+        const int8_t* plane = image + (size_t) c * height * width;
+        for (int ky = 0; ky < kernel; ++ky) {
+          int sy = y * stride - pad + ky;
+          int8_t* dst = col + (c * kernel + ky) * kernel;
+          if (sy < 0 || sy >= height) {
+            memset(dst, 0, kernel);
+            continue;
+          }
+          for (int kx = 0; kx < kernel; ++kx) {
+            int sx = x * stride - pad + kx;
+            dst[kx] = (sx < 0 || sx >= width) ? 0 : plane[sy * width + sx];
+          }
+        }
+      }
+      memset(col + k, 0, row - k);
+    }
+  }
+}
+
+void gemmInt8(const int8_t* a, int m, const int8_t* b, int n, int row,
+    const Int8Scales& scales, float* out) {
+  const Kernels& fn = kernels();
+  int32_t sums[kTile * kTile];
+  for (int j0 = 0; j0 < n; j0 += kBlock) {
+    int j1 = std::min(n, j0 + kBlock);
+    for (int i0 = 0; i0 < m; i0 += kTile) {
+      int rows = std::min(kTile, m - i0);
+      for (int j = j0; j < j1; j += kTile) {
+        int cols = std::min(kTile, j1 - j);
+        if (rows == kTile && cols == kTile) {
+          fn.tile(a + (size_t) i0 * row, b + (size_t) j * row, row, sums);
+        } else {
+          // the ragged edges, one dot product per output
+          for (int i = 0; i < rows; ++i) {
+            for (int c = 0; c < cols; ++c) {
+              sums[i * kTile + c] = fn.dot(a + (size_t) (i0 + i) * row,
+                  b + (size_t) (j + c) * row, row);
+            }
+          }
+        }
+        for (int i = 0; i < rows; ++i) {
+          float row_scale = scales.scale *
+              (scales.row_scales ? scales.row_scales[i0 + i] : 1.0f);
+          float row_bias = scales.row_bias ? scales.row_bias[i0 + i] : 0.0f;
+          float* out_i = out + (size_t) (i0 + i) * n + j;
+          for (int c = 0; c < cols; ++c) {
+            float value = sums[i * kTile + c] * row_scale;
+            if (scales.column_scales) {
+              value *= scales.column_scales[j + c];
+            }
+            out_i[c] = value + row_bias +
+                (scales.column_bias ? scales.column_bias[j + c] : 0.0f);
+          }
+        }
+      }
+    }
+  }
+}
+
+} // namespace cpp2
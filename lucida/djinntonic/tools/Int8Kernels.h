@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+
+namespace cpp2 {
+
+// Row length used for int8 operands, k rounded up to the vector width. The
+// padding is zero so it does not change any dot product.
+int int8RowLength(int k);
+
+// dst[i] = round(src[i] * scale) clamped to [-127, 127], for i < n.
+void quantizeInt8(const float* src, int n, float scale, int8_t* dst);
+
+// Unfolds a channels x height x width int8 image into one row of
+// int8RowLength(channels * kernel * kernel) per output pixel, zeros outside
+// the image, the operand layout of gemmInt8 for a convolution.
+void im2colInt8(const int8_t* image, int channels, int height, int width,
+    int kernel, int pad, int stride, int out_h, int out_w, int8_t* columns);
+
+// Turns the int32 products of gemmInt8 back into fp32: output (i, j) is
+// multiplied by scale, row_scales[i] and column_scales[j], then row_bias[i]
+// and column_bias[j] are added. The arrays may be null. A convolution has
+// its per output channel weights as rows, an inner product layer its images.
+struct Int8Scales {
+  float scale;
+  const float* row_scales;
+  const float* column_scales;
+  const float* row_bias;
+  const float* column_bias;
+};
+
+// out[i * n + j] = dot(a_i, b_j), scaled as above, for the m rows a_i of a
+// and the n rows b_j of b, all of length row (see int8RowLength). Computed
+// in 4 x 4 tiles of the output.
+void gemmInt8(const int8_t* a, int m, const int8_t* b, int n, int row,
+    const Int8Scales& scales, float* out);
+
+} // namespace cpp2
@@ -0,0 +1,241 @@
+#include "Int8Net.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <glog/logging.h>
+
+#include "Backend.h"
+#include "CaffeBackend.h"
+#include "Int8Kernels.h"
+#include "Preprocess.h"
+#include "ScratchArena.h"
+
+using caffe::Blob;
+using caffe::LayerParameter;
+using caffe::Net;
+
+namespace cpp2 {
+
+namespace {
+
+float maxAbs(const float* data, int n) {
+  float m = 0.0f;
+  for (int i = 0; i < n; ++i) {
+    m = std::max(m, std::fabs(data[i]));
+  }
+  return m;
+}
+
+bool quantizable(const LayerParameter& param) {
+  return param.type() == LayerParameter::CONVOLUTION ||
+      param.type() == LayerParameter::INNER_PRODUCT;
+}
+
+} // namespace
+
+Int8Net::Int8Net(Net<float>* net, const std::string& calibration_dir)
+    : calibrated_(false), inner_product_row_(0),
+      layers_(net->layers().size()) {
+  reshape(net, 1);
+  Blob<float>* in_blob = net->input_blobs()[0];
+  std::vector<std::vector<float>> inputs;
+  for (const auto& image : readFiles(calibration_dir)) {
+    std::vector<float> input(in_blob->count());
+    std::string error;
+    if (decodeJpeg(image.data(), image.size(), in_blob->channels(),
+        in_blob->height(), in_blob->width(), input.data(), &error)) {
+      inputs.push_back(std::move(input));
+    }
+  }
+  if (inputs.empty()) {
+    LOG(ERROR) << "No calibration images in " << calibration_dir
+               << ", staying in fp32";
+    return;
+  }
+
+  // fp32 pass, one layer at a time to see the input of every layer. The
+  // nets end in an argmax, so the input of the last layer holds the scores
+  // and the output the label.
+  const auto& layers = net->layers();
+  int n = layers.size();
+  std::vector<float> max_input(n, 0.0f);
+  std::vector<std::vector<float>> scores;
+  std::vector<float> labels;
+  for (const auto& input : inputs) {
+    std::copy(input.begin(), input.end(), in_blob->mutable_cpu_data());
+    for (int i = 0; i < n; ++i) {
+      if (quantizable(layers[i]->layer_param())) {
+        const Blob<float>* bottom = net->bottom_vecs()[i][0];
+        max_input[i] = std::max(max_input[i],
+            maxAbs(bottom->cpu_data(), bottom->count()));
+      }
+      net->ForwardFromTo(i, i);
+    }
+    const Blob<float>* last = net->bottom_vecs()[n - 1][0];
+    scores.emplace_back(last->cpu_data(), last->cpu_data() + last->count());
+    labels.push_back(net->output_blobs()[0]->cpu_data()[0]);
+  }
+
+  for (int i = 0; i < n; ++i) {
+    if (quantizable(layers[i]->layer_param())) {
+      quantize(net, i, max_input[i]);
+    }
+  }
+  calibrated_ = true;
+
+  // int8 pass over the same images
+  int agree = 0;
+  double error = 0.0;
+  double norm = 0.0;
+  for (size_t k = 0; k < inputs.size(); ++k) {
+    std::copy(inputs[k].begin(), inputs[k].end(),
+        in_blob->mutable_cpu_data());
+    agree += forward(net)[0]->cpu_data()[0] == labels[k];
+    const float* last = net->bottom_vecs()[n - 1][0]->cpu_data();
+    for (size_t j = 0; j < scores[k].size(); ++j) {
+      error += (last[j] - scores[k][j]) * (last[j] - scores[k][j]);
+      norm += scores[k][j] * scores[k][j];
+    }
+  }
+  LOG(ERROR) << "Int8 drift over " << inputs.size() << " images from "
+             << calibration_dir << ": top-1 agrees with fp32 on " << agree
+             << ", relative score error " << std::sqrt(error / norm);
+}
+
+const std::vector<Blob<float>*>& Int8Net::forward(Net<float>* net) {
+  int n = net->layers().size();
+  for (int i = 0; i < n; ++i) {
+    forwardLayer(net, i);
+  }
+  return net->output_blobs();
+}
+
+void Int8Net::forwardLayer(Net<float>* net, int i) {
+  if (layers_[i]) {
+    run(*layers_[i], net->bottom_vecs()[i][0], net->top_vecs()[i][0]);
+  } else {
+    net->ForwardFromTo(i, i);
+  }
+}
+
+void Int8Net::quantize(Net<float>* net, int i, float max_input) {
+  const auto& layer = net->layers()[i];
+  const LayerParameter& param = layer->layer_param();
+  std::unique_ptr<Layer> q(new Layer());
+  q->convolution = param.type() == LayerParameter::CONVOLUTION;
+  int num_output;
+  if (q->convolution) {
+    const auto& conv = param.convolution_param();
+    num_output = conv.num_output();
+    q->kernel = conv.kernel_size();
+    q->pad = conv.pad();
+    q->stride = conv.stride();
+    q->group = conv.group();
+  } else {
+    num_output = param.inner_product_param().num_output();
+    q->kernel = q->pad = q->stride = q->group = 1;
+  }
+
+  // one scale per output keeps small filters from rounding to zero
+  const Blob<float>* weights = layer->blobs()[0].get();
+  int k = weights->count() / num_output;
+  q->row = int8RowLength(k);
+  q->weights.assign((size_t) num_output * q->row, 0);
+  q->weight_scales.resize(num_output);
+  for (int o = 0; o < num_output; ++o) {
+    const float* w = weights->cpu_data() + (size_t) o * k;
+    float m = maxAbs(w, k);
+    float scale = m > 0.0f ? 127.0f / m : 1.0f;
+    quantizeInt8(w, k, scale, q->weights.data() + (size_t) o * q->row);
+    q->weight_scales[o] = 1.0f / scale;
+  }
+  if (layer->blobs().size() > 1) {
+    const Blob<float>* bias = layer->blobs()[1].get();
+    q->bias.assign(bias->cpu_data(), bias->cpu_data() + bias->count());
+  }
+  q->input_scale = max_input > 0.0f ? 127.0f / max_input : 1.0f;
+
+  // the net is at batch size 1 here, so these are the per image sizes; an
+  // inner product layer quantizes the whole batch, see reserveScratch
+  const Blob<float>* bottom = net->bottom_vecs()[i][0];
+  const Blob<float>* top = net->top_vecs()[i][0];
+  ScratchArena::reserve(ScratchArena::QUANTIZED,
+      std::max(bottom->count(), q->row));
+  if (q->convolution) {
+    ScratchArena::reserve(ScratchArena::COLUMNS,
+        (size_t) top->height() * top->width() * q->row);
+  } else {
+    inner_product_row_ = std::max(inner_product_row_, q->row);
+  }
+  layers_[i] = std::move(q);
+}
+
+void Int8Net::reserveScratch(int max_batch) const {
+  ScratchArena::reserve(ScratchArena::QUANTIZED,
+      (size_t) std::max(1, max_batch) * inner_product_row_);
+}
+
+std::vector<float> Int8Net::inputScales() const {
+  std::vector<float> scales;
+  for (const auto& layer : layers_) {
+    if (layer) {
+      scales.push_back(layer->input_scale);
+    }
+  }
+  return scales;
+}
+
+void Int8Net::run(const Layer& layer, const Blob<float>* bottom,
+    Blob<float>* top) {
+  ScratchArena& arena = ScratchArena::get();
+  int num = bottom->num();
+  int in_size = bottom->count() / num;
+  int out_size = top->count() / num;
+  int num_output = layer.weight_scales.size();
+  const float* bias = layer.bias.empty() ? nullptr : layer.bias.data();
+  float in_scale = 1.0f / layer.input_scale;
+
+  if (!layer.convolution) {
+    // the whole batch in one product, images as rows, so that every weight
+    // row loaded serves all of them; top is num x num_output as it comes out
+    int8_t* input = arena.buffer<int8_t>(ScratchArena::QUANTIZED,
+        (size_t) num * layer.row);
+    for (int item = 0; item < num; ++item) {
+      int8_t* row = input + (size_t) item * layer.row;
+      quantizeInt8(bottom->cpu_data() + (size_t) item * in_size, in_size,
+          layer.input_scale, row);
+      std::fill(row + in_size, row + layer.row, 0);
+    }
+    Int8Scales scales = {in_scale, nullptr, layer.weight_scales.data(),
+        nullptr, bias};
+    gemmInt8(input, num, layer.weights.data(), num_output, layer.row, scales,
+        top->mutable_cpu_data());
+    return;
+  }
+
+  int8_t* input = arena.buffer<int8_t>(ScratchArena::QUANTIZED, in_size);
+  for (int item = 0; item < num; ++item) {
+    quantizeInt8(bottom->cpu_data() + (size_t) item * in_size, in_size,
+        layer.input_scale, input);
+    float* out = top->mutable_cpu_data() + (size_t) item * out_size;
+    // every group convolves its own slice of channels into its own outputs
+    int channels = bottom->channels() / layer.group;
+    int plane = bottom->height() * bottom->width();
+    int pixels = top->height() * top->width();
+    int m = num_output / layer.group;
+    int8_t* columns = arena.buffer<int8_t>(ScratchArena::COLUMNS,
+        (size_t) pixels * layer.row);
+    for (int g = 0; g < layer.group; ++g) {
+      im2colInt8(input + (size_t) g * channels * plane, channels,
+          bottom->height(), bottom->width(), layer.kernel, layer.pad,
+          layer.stride, top->height(), top->width(), columns);
+      Int8Scales scales = {in_scale, layer.weight_scales.data() + g * m,
+          nullptr, bias ? bias + g * m : nullptr, nullptr};
+      gemmInt8(layer.weights.data() + (size_t) g * m * layer.row, m,
+          columns, pixels, layer.row, scales, out + (size_t) g * m * pixels);
+    }
+  }
+}
+
+} // namespace cpp2
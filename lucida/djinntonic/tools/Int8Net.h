@@ -0,0 +1,65 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "caffe/caffe.hpp"
+
+namespace cpp2 {
+
+// Int8 version of the convolution and inner product layers of a net. Weights
+// are quantized per output channel and layer inputs with one scale per layer,
+// calibrated from the largest activation seen while running sample images
+// through the fp32 net. The products are summed in int32 and scaled back to
+// fp32, every other layer runs as usual. The quantized weights are shared by
+// all replicas of the net.
+class Int8Net {
+ public:
+  // Calibrates on the JPEGs in calibration_dir, then reports how far the
+  // int8 results drift from fp32 on the same images. Leaves net at a batch
+  // size of 1.
+  Int8Net(caffe::Net<float>* net, const std::string& calibration_dir);
+
+  // False if there were no calibration images, the net should stay fp32.
+  bool calibrated() const { return calibrated_; }
+
+  // Same as net->ForwardPrefilled() for any replica of the calibrated net.
+  const std::vector<caffe::Blob<float>*>& forward(caffe::Net<float>* net);
+  // Runs layer i alone, in int8 if it was quantized.
+  void forwardLayer(caffe::Net<float>* net, int i);
+
+  // Reserves the scratch space of batches of up to max_batch images, which
+  // the inner product layers quantize as a whole.
+  void reserveScratch(int max_batch) const;
+
+  // The input scales of the quantized layers in order, all that the
+  // calibration images decide.
+  std::vector<float> inputScales() const;
+
+ private:
+  struct Layer {
+    bool convolution;
+    int kernel;
+    int pad;
+    int stride;
+    int group;
+    int row;                          // padded weights per output
+    std::vector<int8_t> weights;      // num_output rows of row
+    std::vector<float> weight_scales; // per output, back to fp32
+    std::vector<float> bias;          // empty without bias term
+    float input_scale;                // fp32 to int8
+  };
+
+  void quantize(caffe::Net<float>* net, int i, float max_input);
+  void run(const Layer& layer, const caffe::Blob<float>* bottom,
+      caffe::Blob<float>* top);
+
+  bool calibrated_;
+  // longest padded row of the inner product layers
+  int inner_product_row_;
+  // indexed like net->layers(), null for layers kept in fp32
+  std::vector<std::unique_ptr<Layer>> layers_;
+};
+
+} // namespace cpp2
@@ -0,0 +1,129 @@
+#include "LayerProfile.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+
+using caffe::Blob;
+using caffe::LayerParameter;
+using caffe::Net;
+
+namespace cpp2 {
+
+namespace {
+
+std::mutex registry_mutex;
+
+// Floating point operations of layer i at the net's current batch size.
+// Layers with weights do a multiply-add per weight and image, convolutions
+// once per output position; any other layer is counted as one operation per
+// output value, which is about right for the elementwise ones.
+int64_t layerFlops(const Net<float>* net, int i) {
+  const auto& layer = net->layers()[i];
+  const Blob<float>* top = net->top_vecs()[i][0];
+  if (layer->blobs().empty()) {
+    return top->count();
+  }
+  int64_t macs = (int64_t) top->num() * layer->blobs()[0]->count();
+  if (layer->layer_param().type() == LayerParameter::CONVOLUTION) {
+    macs *= (int64_t) top->height() * top->width();
+  }
+  return 2 * macs;
+}
+
+} // namespace
+
+std::map<std::string, std::unique_ptr<LayerProfile::Profile>>&
+LayerProfile::registry() {
+  static std::map<std::string, std::unique_ptr<Profile>> profiles;
+  return profiles;
+}
+
+LayerProfile::LayerProfile(const Net<float>* net) {
+  std::lock_guard<std::mutex> lock(registry_mutex);
+  std::unique_ptr<Profile>& profile = registry()[net->name()];
+  if (!profile) {
+    Stats& stats = Stats::instance();
+    std::string prefix = "layer." + net->name() + ".";
+    profile.reset(new Profile());
+    profile->net = net->name();
+    profile->passes = &stats.counter(prefix + "profiled_passes");
+    for (size_t i = 0; i < net->layers().size(); ++i) {
+      std::string name = prefix + net->layer_names()[i];
+      Layer layer{net->layer_names()[i],
+          caffe::LayerParameter_LayerType_Name(
+              net->layers()[i]->layer_param().type()),
+          &stats.histogram(name + ".us"), &stats.counter(name + ".ns"),
+          &stats.counter(name + ".flops")};
+      Counter* ns = layer.ns;
+      Counter* flops = layer.flops;
+      stats.gauge(name + ".mflops_per_s", [ns, flops]() {
+        return ns->value() > 0 ? flops->value() * 1000 / ns->value() : 0;
+      });
+      profile->layers.push_back(layer);
+    }
+  }
+  profile_ = profile.get();
+}
+
+void LayerProfile::forward(const Net<float>* net,
+    const ForwardLayer& forward_layer) {
+  typedef std::chrono::steady_clock Clock;
+  Clock::time_point start = Clock::now();
+  for (size_t i = 0; i < profile_->layers.size(); ++i) {
+    forward_layer(i);
+    Clock::time_point end = Clock::now();
+    int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        end - start).count();
+    Layer& layer = profile_->layers[i];
+    layer.us->add(ns / 1000);
+    layer.ns->add(ns);
+    layer.flops->add(layerFlops(net, i));
+    start = end;
+  }
+  profile_->passes->add(1);
+}
+
+std::string LayerProfile::report() {
+  std::lock_guard<std::mutex> lock(registry_mutex);
+  std::ostringstream out;
+  for (const auto& entry : registry()) {
+    const Profile& profile = *entry.second;
+    if (profile.passes->value() == 0) {
+      continue;
+    }
+    std::vector<const Layer*> layers;
+    int64_t total_ns = 0;
+    for (const Layer& layer : profile.layers) {
+      layers.push_back(&layer);
+      total_ns += layer.ns->value();
+    }
+    std::sort(layers.begin(), layers.end(),
+        [](const Layer* a, const Layer* b) {
+      return a->ns->value() > b->ns->value();
+    });
+    out << profile.net << ": " << profile.passes->value()
+        << " profiled forward passes\n"
+        << std::left << std::setw(16) << "layer" << std::setw(16) << "type"
+        << std::right << std::setw(10) << "avg_us" << std::setw(10)
+        << "p50_us" << std::setw(10) << "p99_us" << std::setw(8) << "share"
+        << std::setw(12) << "MFLOP/s" << "\n";
+    for (const Layer* layer : layers) {
+      int64_t ns = layer->ns->value();
+      int64_t calls = std::max<int64_t>(1, layer->us->count());
+      out << std::left << std::setw(16) << layer->name << std::setw(16)
+          << layer->type << std::right << std::fixed << std::setprecision(1)
+          << std::setw(10) << ns / 1000.0 / calls
+          << std::setw(10) << layer->us->percentile(50)
+          << std::setw(10) << layer->us->percentile(99)
+          << std::setw(7) << (total_ns ? 100.0 * ns / total_ns : 0.0) << "%"
+          << std::setw(12)
+          << (ns ? layer->flops->value() * 1000 / ns : 0) << "\n";
+    }
+  }
+  return out.str();
+}
+
+} // namespace cpp2
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "caffe/caffe.hpp"
+#include "../../common/Stats.h"
+
+namespace cpp2 {
+
+// Per-layer forward times of a net, to find the layers worth optimizing.
+// Every layer of net <net> gets a histogram layer.<net>.<layer>.us of its
+// forward time and counters of its time in ns and of its FLOPs, estimated
+// from the layer's shape, from which layer.<net>.<layer>.mflops_per_s is
+// derived. The stats of a net name are shared by all its pools, so they
+// add up across reloads.
+class LayerProfile {
+ public:
+  // Runs layer i of a replica.
+  typedef std::function<void(int i)> ForwardLayer;
+
+  explicit LayerProfile(const caffe::Net<float>* net);
+
+  // Runs all layers of net, a replica of the profiled one, through
+  // forward_layer and records the time of each.
+  void forward(const caffe::Net<float>* net,
+      const ForwardLayer& forward_layer);
+
+  // Table of every profiled net's layers, slowest first.
+  static std::string report();
+
+ private:
+  struct Layer {
+    std::string name;
+    std::string type;
+    Histogram* us;
+    Counter* ns;
+    Counter* flops;
+  };
+  struct Profile {
+    std::string net;
+    Counter* passes;
+    std::vector<Layer> layers;
+  };
+
+  // one profile per net name, registered on first use and kept for the
+  // life of the process
+  static std::map<std::string, std::unique_ptr<Profile>>& registry();
+
+  Profile* profile_;
+};
+
+} // namespace cpp2
@@ -0,0 +1,583 @@
+#include "Preprocess.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <csetjmp>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+#include <gflags/gflags.h>
+#include <jpeglib.h>
+
+#include "../../common/Stats.h"
+#include "ScratchArena.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DJINN_X86 1
+#endif
+
+DEFINE_bool(jpeg_dct_scaling, true,
+            "Decode large JPEGs at a reduced scale that still covers the "
+            "network input (default: true)");
+
+DEFINE_int64(max_image_pixels, 4096 * 4096,
+             "Largest image accepted in pixels, larger ones are rejected "
+             "from their header; also sizes the per-thread decode buffers "
+             "(default: 4096 * 4096)");
+
+namespace cpp2 {
+
+namespace {
+
+struct jpegErrorManager {
+  struct jpeg_error_mgr pub;
+  jmp_buf setjmp_buffer;
+  char message[JMSG_LENGTH_MAX];
+};
+
+void jpegErrorExit(j_common_ptr cinfo) {
+  jpegErrorManager* myerr = (jpegErrorManager*) cinfo->err;
+  ( *(cinfo->err->format_message) ) (cinfo, myerr->message);
+  longjmp(myerr->setjmp_buffer, 1);
+}
+
+// Source pixels covered by every output pixel along one axis. The index math
+// is kept exactly as in the original per-service loops so results do not
+// change: nearest sampling uses double ratios when the whole image is
+// enlarged and float ratios otherwise, and a box of s / d pixels centered on
+// the output pixel is averaged when the axis shrinks. Out of range pixels
+// are dropped from the sum but still count towards the divisor.
+struct Axis {
+  int* start;
+  int* count;
+  int len;
+};
+
+// table has room for 2 * d entries
+void buildAxis(int s, int d, bool fits, int* table, Axis* axis) {
+  axis->start = table;
+  axis->count = table + d;
+  axis->len = 1;
+  if (fits) {
+    double r = s / (double) d;
+    for (int i = 0; i < d; ++i) {
+      axis->start[i] = int(floor(i * r));
+      axis->count[i] = 1;
+    }
+  } else if (s <= d) {
+    float r = s / (float) d;
+    for (int i = 0; i < d; ++i) {
+      axis->start[i] = int(i * r);
+      axis->count[i] = 1;
+    }
+  } else {
+    int l = s / d;
+    float r = s / (float) d;
+    axis->len = l;
+    for (int i = 0; i < d; ++i) {
+      int b = int(i * r - r / 2.0 + 0.5);
+      int e = std::min(s, b + l);
+      b = std::max(0, b);
+      axis->start[i] = b;
+      axis->count[i] = std::max(0, e - b);
+    }
+  }
+}
+
+// acc[k] += row[k] for k < n
+typedef void (*AddRowFn)(const unsigned char* row, int n, int32_t* acc);
+// out[k] = sum[k] / div + offset for k < n
+typedef void (*ScaleRowFn)(const int32_t* sum, int n, float div,
+    float offset, float* out);
+
+void addRowScalar(const unsigned char* row, int n, int32_t* acc) {
+  for (int k = 0; k < n; ++k) {
+    acc[k] += row[k];
+  }
+}
+
+void scaleRowScalar(const int32_t* sum, int n, float div, float offset,
+    float* out) {
+  for (int k = 0; k < n; ++k) {
+    out[k] = (float) sum[k] / div + offset;
+  }
+}
+
+#ifdef DJINN_X86
+__attribute__((target("sse4.1")))
+void addRowSse41(const unsigned char* row, int n, int32_t* acc) {
+  int k = 0;
+  for (; k + 4 <= n; k += 4) {
+    int32_t bytes;
+    memcpy(&bytes, row + k, sizeof(bytes));
+    __m128i v = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(bytes));
+    __m128i a = _mm_loadu_si128((const __m128i*) (acc + k));
+    _mm_storeu_si128((__m128i*) (acc + k), _mm_add_epi32(a, v));
+  }
+  addRowScalar(row + k, n - k, acc + k);
+}
+
+__attribute__((target("sse4.1")))
+void scaleRowSse41(const int32_t* sum, int n, float div, float offset,
+    float* out) {
+  __m128 d = _mm_set1_ps(div);
+  __m128 o = _mm_set1_ps(offset);
+  int k = 0;
+  for (; k + 4 <= n; k += 4) {
+    __m128 s = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*) (sum + k)));
+    _mm_storeu_ps(out + k, _mm_add_ps(_mm_div_ps(s, d), o));
+  }
+  scaleRowScalar(sum + k, n - k, div, offset, out + k);
+}
+
+__attribute__((target("avx2")))
+void addRowAvx2(const unsigned char* row, int n, int32_t* acc) {
+  int k = 0;
+  for (; k + 8 <= n; k += 8) {
+    __m256i v = _mm256_cvtepu8_epi32(
+        _mm_loadl_epi64((const __m128i*) (row + k)));
+    __m256i a = _mm256_loadu_si256((const __m256i*) (acc + k));
+    _mm256_storeu_si256((__m256i*) (acc + k), _mm256_add_epi32(a, v));
+  }
+  addRowScalar(row + k, n - k, acc + k);
+}
+
+__attribute__((target("avx2")))
+void scaleRowAvx2(const int32_t* sum, int n, float div, float offset,
+    float* out) {
+  __m256 d = _mm256_set1_ps(div);
+  __m256 o = _mm256_set1_ps(offset);
+  int k = 0;
+  for (; k + 8 <= n; k += 8) {
+    __m256 s = _mm256_cvtepi32_ps(
+        _mm256_loadu_si256((const __m256i*) (sum + k)));
+    _mm256_storeu_ps(out + k, _mm256_add_ps(_mm256_div_ps(s, d), o));
+  }
+  scaleRowScalar(sum + k, n - k, div, offset, out + k);
+}
+#endif
+
+struct Kernels {
+  AddRowFn add_row;
+  ScaleRowFn scale_row;
+};
+
+Kernels selectKernels() {
+#ifdef DJINN_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return Kernels{addRowAvx2, scaleRowAvx2};
+  }
+  if (__builtin_cpu_supports("sse4.1")) {
+    return Kernels{addRowSse41, scaleRowSse41};
+  }
+#endif
+  return Kernels{addRowScalar, scaleRowScalar};
+}
+
+// Largest power of two denominator (up to 8, the limit of libjpeg's DCT
+// scaling) for which the decoded image still covers width x height.
+unsigned int scaleDenom(unsigned int s_w, unsigned int s_h, int width,
+    int height) {
+  unsigned int denom = 1;
+  while (denom < 8 &&
+      (s_w + 2 * denom - 1) / (2 * denom) >= (unsigned int) width &&
+      (s_h + 2 * denom - 1) / (2 * denom) >= (unsigned int) height) {
+    denom *= 2;
+  }
+  return denom;
+}
+
+const Kernels& kernels() {
+  static const Kernels k = selectKernels();
+  return k;
+}
+
+// larger tensors are certainly malformed
+const long kMaxTensorSide = 1 << 16;
+const long kMaxTensorChannels = 4;
+
+float loadFloat(const char* p) {
+  float value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+// Float version of resizeToPlanar for tensor_f32 images in either layout.
+// The few producers that send floats do not justify vector kernels.
+void resizeFloatToPlanar(const char* src, const TensorFormat& format,
+    int d_w, int d_h, float* dst) {
+  int s_w = format.width;
+  int s_h = format.height;
+  int channels = format.channels;
+  size_t plane = (size_t) d_h * d_w;
+  // offsets in floats of the next component, row and pixel
+  size_t c_step = format.planar ? (size_t) s_h * s_w : 1;
+  size_t y_step = format.planar ? s_w : (size_t) s_w * channels;
+  size_t x_step = format.planar ? 1 : channels;
+  if (format.planar && s_w == d_w && s_h == d_h) {
+    for (int c = 0; c < channels; ++c) {
+      memcpy(dst + (channels - 1 - c) * plane,
+          src + c * c_step * sizeof(float), plane * sizeof(float));
+    }
+    return;
+  }
+
+  bool fits = s_w <= d_w && s_h <= d_h;
+  int* tables = ScratchArena::get().buffer<int>(ScratchArena::AXIS_TABLES,
+      2 * (d_w + d_h));
+  Axis xs, ys;
+  buildAxis(s_w, d_w, fits, tables, &xs);
+  buildAxis(s_h, d_h, fits, tables + 2 * d_w, &ys);
+  // the same rounding as for bytes, so a frame gives the same input in
+  // either type
+  float div = xs.len * ys.len;
+  float offset = fits ? 0.0f : 0.5f;
+  for (int c = 0; c < channels; ++c) {
+    float* out = dst + (channels - 1 - c) * plane;
+    for (int i = 0; i < d_h; ++i) {
+      for (int j = 0; j < d_w; ++j) {
+        float sum = 0;
+        for (int r = ys.start[i]; r < ys.start[i] + ys.count[i]; ++r) {
+          for (int x = xs.start[j]; x < xs.start[j] + xs.count[j]; ++x) {
+            sum += loadFloat(src +
+                (c * c_step + r * y_step + x * x_step) * sizeof(float));
+          }
+        }
+        out[(size_t) i * d_w + j] = sum / div + offset;
+      }
+    }
+  }
+}
+
+// Everything that can be decided from the header of a JPEG is checked
+// before jpeg_start_decompress, which for a progressive file already
+// decodes every coefficient: images over --max_image_pixels are rejected,
+// as are ones that would decode to other than channels components (0
+// accepts any). Sets the output dimensions for the scale set in cinfo.
+bool checkHeader(jpeg_decompress_struct* cinfo, int channels,
+    std::string* error) {
+  static Counter& oversized =
+      Stats::instance().counter("decode.rejected_oversized");
+  static Counter& wrong_channels =
+      Stats::instance().counter("decode.rejected_channels");
+  if ((int64_t) cinfo->image_width * cinfo->image_height >
+      FLAGS_max_image_pixels) {
+    oversized.add();
+    *error = "image of " + std::to_string(cinfo->image_width) + "x" +
+        std::to_string(cinfo->image_height) + " pixels is over the limit of " +
+        std::to_string(FLAGS_max_image_pixels);
+    return false;
+  }
+  jpeg_calc_output_dimensions(cinfo);
+  if (channels > 0 && cinfo->output_components != channels) {
+    wrong_channels.add();
+    *error = "null";
+    return false;
+  }
+  return true;
+}
+
+const int kHashWidth = 9;
+const int kHashHeight = 8;
+
+// one bit per pixel pair of every row of a kHashHeight x kHashWidth image
+uint64_t differenceHash(const float* gray) {
+  uint64_t hash = 0;
+  for (int y = 0; y < kHashHeight; ++y) {
+    const float* row = gray + y * kHashWidth;
+    for (int x = 0; x + 1 < kHashWidth; ++x) {
+      hash = (hash << 1) | (row[x] > row[x + 1]);
+    }
+  }
+  return hash;
+}
+
+} // namespace
+
+void reserveScratch(int channels, int height, int width) {
+  // with DCT scaling the decoded image is at most an eighth of the largest
+  // one per axis, unless that would undershoot the input, where it stays
+  // below twice the input per axis
+  size_t pixels = FLAGS_max_image_pixels;
+  if (FLAGS_jpeg_dct_scaling) {
+    pixels = std::max(pixels / 64, (size_t) 4 * height * width);
+  }
+  size_t side = sqrt((double) pixels) + 1;
+  ScratchArena::reserve(ScratchArena::PIXELS, pixels * channels);
+  ScratchArena::reserve(ScratchArena::ROW_SUMS,
+      side * channels * sizeof(int32_t));
+  ScratchArena::reserve(ScratchArena::COL_SUMS, width * sizeof(int32_t));
+  ScratchArena::reserve(ScratchArena::AXIS_TABLES,
+      2 * (width + height) * sizeof(int));
+}
+
+void resizeToPlanar(const unsigned char* src, int s_w, int s_h, int channels,
+    int d_w, int d_h, float* dst) {
+  ScratchArena& arena = ScratchArena::get();
+  bool fits = s_w <= d_w && s_h <= d_h;
+  int* tables = arena.buffer<int>(ScratchArena::AXIS_TABLES,
+      2 * (d_w + d_h));
+  Axis xs, ys;
+  buildAxis(s_w, d_w, fits, tables, &xs);
+  buildAxis(s_h, d_h, fits, tables + 2 * d_w, &ys);
+  float div = xs.len * ys.len;
+  float offset = fits ? 0.0f : 0.5f;
+
+  const Kernels& k = kernels();
+  int row_size = s_w * channels;
+  int32_t* acc = arena.buffer<int32_t>(ScratchArena::ROW_SUMS, row_size);
+  int32_t* sums = arena.buffer<int32_t>(ScratchArena::COL_SUMS, d_w);
+  for (int i = 0; i < d_h; ++i) {
+    // sum the source rows of this output row, all components at once
+    std::fill(acc, acc + row_size, 0);
+    for (int r = ys.start[i]; r < ys.start[i] + ys.count[i]; ++r) {
+      k.add_row(src + (size_t) r * row_size, row_size, acc);
+    }
+    // then the source columns of every output pixel, one plane at a time
+    for (int c = 0; c < channels; ++c) {
+      for (int j = 0; j < d_w; ++j) {
+        const int32_t* a = acc + xs.start[j] * channels + c;
+        int32_t sum = 0;
+        for (int t = 0; t < xs.count[j]; ++t) {
+          sum += a[t * channels];
+        }
+        sums[j] = sum;
+      }
+      float* out = dst + ((size_t) (channels - 1 - c) * d_h + i) * d_w;
+      k.scale_row(sums, d_w, div, offset, out);
+    }
+  }
+}
+
+bool decodeJpeg(const char* data, size_t length, int channels, int height,
+    int width, float* dst, std::string* error) {
+  static Histogram& decode_us = Stats::instance().histogram("decode_us");
+  static Histogram& resize_us = Stats::instance().histogram("resize_us");
+  auto start = std::chrono::steady_clock::now();
+  struct jpeg_decompress_struct cinfo;
+  jpegErrorManager jerr;
+  cinfo.err = jpeg_std_error(&jerr.pub);
+  jerr.pub.error_exit = jpegErrorExit;
+
+  if (setjmp(jerr.setjmp_buffer)) {
+    /* If we get here, the JPEG code has signaled an error. */
+    jpeg_destroy_decompress(&cinfo);
+    *error = jerr.message;
+    return false;
+  }
+
+  jpeg_create_decompress(&cinfo);
+  jpeg_mem_src(&cinfo, (unsigned char*) data, length);
+  jpeg_read_header(&cinfo, TRUE);
+  if (FLAGS_jpeg_dct_scaling) {
+    // skip the high frequency DCT coefficients of big images instead of
+    // decoding every pixel only to average it away in the resize
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = scaleDenom(cinfo.image_width, cinfo.image_height,
+        width, height);
+  }
+  if (!checkHeader(&cinfo, channels, error)) {
+    jpeg_destroy_decompress(&cinfo);
+    return false;
+  }
+  jpeg_start_decompress(&cinfo);
+
+  // decode straight into interleaved rows, the resize handles the layout
+  int s_w = cinfo.output_width;
+  int s_h = cinfo.output_height;
+  size_t row_size = (size_t) s_w * channels;
+  unsigned char* pixels = ScratchArena::get().buffer<unsigned char>(
+      ScratchArena::PIXELS, row_size * s_h);
+  while (cinfo.output_scanline < cinfo.output_height) {
+    JSAMPROW rows[4];
+    for (int r = 0; r < 4; ++r) {
+      int y = std::min(s_h - 1, (int) cinfo.output_scanline + r);
+      rows[r] = pixels + y * row_size;
+    }
+    (void) jpeg_read_scanlines(&cinfo, rows, 4);
+  }
+  jpeg_finish_decompress(&cinfo);
+  jpeg_destroy_decompress(&cinfo);
+
+  auto decoded = std::chrono::steady_clock::now();
+  decode_us.add(std::chrono::duration_cast<std::chrono::microseconds>(
+      decoded - start).count());
+  resizeToPlanar(pixels, s_w, s_h, channels, width, height, dst);
+  resize_us.add(std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - decoded).count());
+  return true;
+}
+
+bool frameHash(const char* data, size_t length, const TensorFormat* format,
+    uint64_t* hash, std::string* error) {
+  static Histogram& frame_hash_us =
+      Stats::instance().histogram("frame_hash_us");
+  ScopedTimer timer(frame_hash_us);
+  float gray[kHashHeight * kHashWidth];
+  if (format != nullptr) {
+    // averaging the components of the thumbnail gives the same hash for
+    // every layout and pixel type
+    float planes[kMaxTensorChannels * kHashHeight * kHashWidth];
+    if (!convertTensor(data, length, *format, format->channels, kHashHeight,
+        kHashWidth, planes, error)) {
+      return false;
+    }
+    for (int i = 0; i < kHashHeight * kHashWidth; ++i) {
+      float sum = 0.0f;
+      for (int c = 0; c < format->channels; ++c) {
+        sum += planes[c * kHashHeight * kHashWidth + i];
+      }
+      gray[i] = sum / format->channels;
+    }
+    *hash = differenceHash(gray);
+    return true;
+  }
+
+  struct jpeg_decompress_struct cinfo;
+  jpegErrorManager jerr;
+  cinfo.err = jpeg_std_error(&jerr.pub);
+  jerr.pub.error_exit = jpegErrorExit;
+  if (setjmp(jerr.setjmp_buffer)) {
+    jpeg_destroy_decompress(&cinfo);
+    *error = jerr.message;
+    return false;
+  }
+  jpeg_create_decompress(&cinfo);
+  jpeg_mem_src(&cinfo, (unsigned char*) data, length);
+  jpeg_read_header(&cinfo, TRUE);
+  // at 1/8 libjpeg only inverts the DC coefficient of every block, and
+  // grayscale output skips the color conversion and the chroma planes
+  cinfo.scale_num = 1;
+  cinfo.scale_denom = 8;
+  cinfo.out_color_space = JCS_GRAYSCALE;
+  if (!checkHeader(&cinfo, 0, error)) {
+    jpeg_destroy_decompress(&cinfo);
+    return false;
+  }
+  jpeg_start_decompress(&cinfo);
+  int s_w = cinfo.output_width;
+  int s_h = cinfo.output_height;
+  unsigned char* pixels = ScratchArena::get().buffer<unsigned char>(
+      ScratchArena::PIXELS, (size_t) s_w * s_h);
+  while (cinfo.output_scanline < cinfo.output_height) {
+    JSAMPROW row = pixels + (size_t) cinfo.output_scanline * s_w;
+    (void) jpeg_read_scanlines(&cinfo, &row, 1);
+  }
+  jpeg_finish_decompress(&cinfo);
+  jpeg_destroy_decompress(&cinfo);
+  resizeToPlanar(pixels, s_w, s_h, 1, kHashWidth, kHashHeight, gray);
+  *hash = differenceHash(gray);
+  return true;
+}
+
+int hashDistance(uint64_t a, uint64_t b) {
+  return __builtin_popcountll(a ^ b);
+}
+
+size_t TensorFormat::size() const {
+  return (size_t) channels * height * width * (f32 ? sizeof(float) : 1);
+}
+
+std::string TensorFormat::str() const {
+  std::ostringstream out;
+  out << (f32 ? "tensor_f32 " : "tensor_u8 ") << (planar ? "CHW " : "HWC ")
+      << channels << "x" << height << "x" << width;
+  return out.str();
+}
+
+bool isTensor(const std::string& type) {
+  return type == "tensor_u8" || type == "tensor_f32";
+}
+
+bool parseTensorFormat(const std::string& type,
+    const std::vector<std::string>& tags, TensorFormat* format,
+    std::string* error) {
+  if (!isTensor(type)) {
+    *error = "unknown input type " + type;
+    return false;
+  }
+  *format = TensorFormat{type == "tensor_f32", false, 0, 0, 0};
+  for (const std::string& tag : tags) {
+    size_t eq = tag.find('=');
+    if (eq == std::string::npos) {
+      continue;
+    }
+    std::string key = tag.substr(0, eq);
+    std::string value = tag.substr(eq + 1);
+    if (key == "layout") {
+      if (value != "HWC" && value != "CHW") {
+        *error = "unknown tensor layout " + value;
+        return false;
+      }
+      format->planar = value == "CHW";
+      continue;
+    }
+    int* dim = key == "height" ? &format->height :
+        key == "width" ? &format->width :
+        key == "channels" ? &format->channels : nullptr;
+    if (dim == nullptr) {
+      continue;
+    }
+    char* end = nullptr;
+    long n = strtol(value.c_str(), &end, 10);
+    long limit = dim == &format->channels ?
+        kMaxTensorChannels : kMaxTensorSide;
+    if (value.empty() || *end != '\0' || n <= 0 || n > limit) {
+      *error = "bad tensor " + tag;
+      return false;
+    }
+    *dim = n;
+  }
+  if (format->height == 0 || format->width == 0 || format->channels == 0) {
+    *error = "tensor input needs height, width and channels tags";
+    return false;
+  }
+  if ((int64_t) format->height * format->width > FLAGS_max_image_pixels) {
+    *error = "tensor of " + std::to_string(format->width) + "x" +
+        std::to_string(format->height) + " pixels is over the limit of " +
+        std::to_string(FLAGS_max_image_pixels);
+    return false;
+  }
+  return true;
+}
+
+bool convertTensor(const char* data, size_t length,
+    const TensorFormat& format, int channels, int height, int width,
+    float* dst, std::string* error) {
+  static Histogram& resize_us = Stats::instance().histogram("resize_us");
+  if (length != format.size()) {
+    *error = "tensor of " + std::to_string(length) + " bytes, " +
+        format.str() + " takes " + std::to_string(format.size());
+    return false;
+  }
+  if (format.channels != channels) {
+    // as for JPEGs of the wrong color space
+    *error = "null";
+    return false;
+  }
+
+  ScopedTimer timer(resize_us);
+  if (format.f32) {
+    resizeFloatToPlanar(data, format, width, height, dst);
+  } else if (format.planar) {
+    // every plane is an image of one component
+    const unsigned char* src = (const unsigned char*) data;
+    size_t plane = (size_t) format.height * format.width;
+    for (int c = 0; c < channels; ++c) {
+      resizeToPlanar(src + c * plane, format.width, format.height, 1, width,
+          height, dst + (size_t) (channels - 1 - c) * height * width);
+    }
+  } else {
+    resizeToPlanar((const unsigned char*) data, format.width, format.height,
+        channels, width, height, dst);
+  }
+  return true;
+}
+
+} // namespace cpp2
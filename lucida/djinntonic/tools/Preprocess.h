@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace cpp2 {
+
+// Decodes the JPEG in [data, data + length) and resizes it into dst as
+// channels x height x width planar floats, the layout of a net's input blob
+// (color images end up in BGR plane order). Images over --max_image_pixels
+// and ones whose component count differs from channels are rejected from
+// their header, before any pixel is decoded. On failure returns false and
+// sets error to the reply the request should get instead.
+bool decodeJpeg(const char* data, size_t length, int channels, int height,
+    int width, float* dst, std::string* error);
+
+// A pre-decoded image sent instead of a JPEG, described by the type and tags
+// of its QueryInput: type "tensor_u8" holds bytes and "tensor_f32" native
+// floats in the 0-255 range of decoded pixels. The tags "height=H",
+// "width=W" and "channels=C" give its dimensions and "layout=HWC" (the
+// default, interleaved like decoded JPEG rows) or "layout=CHW" its layout.
+// Color components are in RGB order, as libjpeg decodes them.
+struct TensorFormat {
+  bool f32;
+  bool planar;
+  int channels;
+  int height;
+  int width;
+
+  // bytes of one image
+  size_t size() const;
+  // canonical description, equal for equal formats
+  std::string str() const;
+};
+
+// True if type names a pre-decoded image.
+bool isTensor(const std::string& type);
+
+// Reads the format of a tensor input from its type and tags, tags that are
+// not key=value pairs are ignored. On failure returns false and sets error.
+bool parseTensorFormat(const std::string& type,
+    const std::vector<std::string>& tags, TensorFormat* format,
+    std::string* error);
+
+// Like decodeJpeg, for one pre-decoded image of format in
+// [data, data + length): resizes it into dst, or just reorders it if its
+// dimensions already match.
+bool convertTensor(const char* data, size_t length,
+    const TensorFormat& format, int channels, int height, int width,
+    float* dst, std::string* error);
+
+// Perceptual hash of an image, for telling near-duplicate video frames
+// apart cheaply: a 9 x 8 grayscale thumbnail with one bit per horizontally
+// adjacent pair of pixels, set if the left one is brighter. JPEGs are decoded
+// at an eighth of their size in grayscale, format is null for them and
+// describes a tensor input otherwise, both within --max_image_pixels. On
+// failure returns false and sets error to the reply the request should get
+// instead.
+bool frameHash(const char* data, size_t length, const TensorFormat* format,
+    uint64_t* hash, std::string* error);
+
+// Number of bits in which two frame hashes differ.
+int hashDistance(uint64_t a, uint64_t b);
+
+// Reserves per-thread scratch space for decoding and resizing into a
+// channels x height x width input, see ScratchArena. The decode buffer is
+// sized for the largest image accepted by --max_image_pixels.
+void reserveScratch(int channels, int height, int width);
+
+// Resizes an interleaved 8-bit image of s_h rows by s_w pixels of channels
+// components into planar floats of channels x d_h x d_w, reversing the
+// component order. Shrinking an axis averages boxes of s / d source pixels,
+// growing it picks the nearest pixel.
+void resizeToPlanar(const unsigned char* src, int s_w, int s_h, int channels,
+    int d_w, int d_h, float* dst);
+
+} // namespace cpp2
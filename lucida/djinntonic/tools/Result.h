@@ -0,0 +1,20 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace cpp2 {
+
+// The answer to one input: the reply for the client, and whether it is a
+// label of the model rather than an error such as an image that could not
+// be decoded. Errors are replies too, and cached like labels since they
+// depend on the image bytes alone, but nothing builds on them. Labels carry
+// the features of the input if the request asked for them (see
+// Backend::featureSize), which never go to the client.
+struct Result {
+  std::string reply;
+  bool ok;
+  std::vector<float> features;
+};
+
+} // namespace cpp2
@@ -0,0 +1,99 @@
+#include "ResultCache.h"
+
+#include <algorithm>
+#include <sstream>
+
+#include <folly/SpookyHashV2.h>
+
+#include "../../common/Stats.h"
+
+namespace cpp2 {
+
+ResultCache::ResultCache(size_t capacity, int shards)
+    : hits_(0), misses_(0), coalesced_(0) {
+  shards = std::max(1, shards);
+  shard_capacity_ = (capacity + shards - 1) / shards;
+  for (int i = 0; i < shards; ++i) {
+    shards_.emplace_back(new Shard());
+  }
+}
+
+ResultCache::Key ResultCache::key(uint64_t model, const std::string& image,
+    const std::string& format) {
+  if (!format.empty()) {
+    model = folly::hash::SpookyHashV2::Hash64(format.data(), format.size(),
+        model);
+  }
+  Key key{model, model};
+  folly::hash::SpookyHashV2::Hash128(image.data(), image.size(),
+      &key.hash1, &key.hash2);
+  return key;
+}
+
+void ResultCache::get(const Key& key, Callback callback,
+    const std::function<void(Fill)>& compute) {
+  // summed over the caches of all models
+  static Counter& hits = Stats::instance().counter("result_cache.hits");
+  static Counter& misses = Stats::instance().counter("result_cache.misses");
+  static Counter& coalesced =
+      Stats::instance().counter("result_cache.coalesced");
+  Shard& s = shard(key);
+  {
+    std::unique_lock<std::mutex> lock(s.mutex);
+    auto it = s.index.find(key);
+    if (it != s.index.end()) {
+      s.lru.splice(s.lru.begin(), s.lru, it->second);
+      Result result = it->second->second;
+      lock.unlock();
+      ++hits_;
+      hits.add();
+      callback(folly::Try<Result>(std::move(result)));
+      return;
+    }
+    auto waiting = s.in_flight.find(key);
+    if (waiting != s.in_flight.end()) {
+      waiting->second.push_back(std::move(callback));
+      ++coalesced_;
+      coalesced.add();
+      return;
+    }
+    s.in_flight[key].push_back(std::move(callback));
+  }
+  ++misses_;
+  misses.add();
+  compute([this, key](folly::Try<Result> result, bool cache) {
+    complete(key, std::move(result), cache);
+  });
+}
+
+void ResultCache::complete(const Key& key, folly::Try<Result> result,
+    bool cache) {
+  Shard& s = shard(key);
+  std::vector<Callback> callbacks;
+  {
+    std::lock_guard<std::mutex> lock(s.mutex);
+    auto waiting = s.in_flight.find(key);
+    callbacks = std::move(waiting->second);
+    s.in_flight.erase(waiting);
+    if (cache && result.hasValue() && shard_capacity_ > 0) {
+      s.lru.emplace_front(key, result.value());
+      s.index[key] = s.lru.begin();
+      if (s.lru.size() > shard_capacity_) {
+        s.index.erase(s.lru.back().first);
+        s.lru.pop_back();
+      }
+    }
+  }
+  for (auto& callback : callbacks) {
+    callback(result);
+  }
+}
+
+std::string ResultCache::report() const {
+  std::ostringstream out;
+  out << "result cache: hits=" << hits() << " misses=" << misses()
+      << " coalesced=" << coalesced();
+  return out.str();
+}
+
+} // namespace cpp2
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <folly/Try.h>
+
+#include "Result.h"
+
+namespace cpp2 {
+
+// Bounded LRU of results keyed by the image bytes and the model that
+// produced them, split into independently locked shards. A lookup that misses
+// while the same key is already being computed waits for that computation
+// instead of starting its own. Entries of a previous model are never matched
+// again, so loading new weights invalidates the cache by itself; they simply
+// age out.
+class ResultCache {
+ public:
+  struct Key {
+    uint64_t hash1;
+    uint64_t hash2;
+    bool operator==(const Key& other) const {
+      return hash1 == other.hash1 && hash2 == other.hash2;
+    }
+  };
+
+  // Receives the result for a key, or the error that computing it failed
+  // with.
+  typedef std::function<void(folly::Try<Result> result)> Callback;
+  // Completes a missed key, which may happen on any thread. Every waiter
+  // gets the result; it is kept only if it holds a value and cache is true.
+  typedef std::function<void(folly::Try<Result> result, bool cache)> Fill;
+
+  // capacity of 0 disables caching, lookups still coalesce
+  ResultCache(size_t capacity, int shards);
+
+  // 128 bit hash of the image seeded with the model identity. format tells
+  // apart inputs whose bytes alone do not determine the reply, such as
+  // pre-decoded images of different dimensions.
+  static Key key(uint64_t model, const std::string& image,
+      const std::string& format = "");
+
+  // Answers callback from the cache or from an in-flight computation of the
+  // same key. Otherwise calls compute, synchronously, with the Fill that
+  // completes the key.
+  void get(const Key& key, Callback callback,
+      const std::function<void(Fill)>& compute);
+
+  uint64_t hits() const { return hits_.load(std::memory_order_relaxed); }
+  uint64_t misses() const { return misses_.load(std::memory_order_relaxed); }
+  uint64_t coalesced() const {
+    return coalesced_.load(std::memory_order_relaxed);
+  }
+  // One line summary of the counters, for logging.
+  std::string report() const;
+
+ private:
+  struct KeyHash {
+    size_t operator()(const Key& key) const { return key.hash1; }
+  };
+  typedef std::list<std::pair<Key, Result>> Entries;
+  struct Shard {
+    std::mutex mutex;
+    Entries lru;  // most recently used first
+    std::unordered_map<Key, Entries::iterator, KeyHash> index;
+    std::unordered_map<Key, std::vector<Callback>, KeyHash> in_flight;
+  };
+
+  Shard& shard(const Key& key) {
+    return *shards_[key.hash2 % shards_.size()];
+  }
+  void complete(const Key& key, folly::Try<Result> result, bool cache);
+
+  size_t shard_capacity_;
+  std::vector<std::unique_ptr<Shard>> shards_;
+  std::atomic<uint64_t> hits_;
+  std::atomic<uint64_t> misses_;
+  std::atomic<uint64_t> coalesced_;
+};
+
+} // namespace cpp2
@@ -0,0 +1,118 @@
+#include "ScratchArena.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <sstream>
+
+#include <glog/logging.h>
+
+#include "../../common/Stats.h"
+
+namespace cpp2 {
+
+namespace {
+
+const char* kSlotNames[ScratchArena::NUM_SLOTS] = {
+  "pixels", "row_sums", "col_sums", "axis_tables", "quantized", "columns"
+};
+
+std::atomic<size_t> reserved[ScratchArena::NUM_SLOTS];
+std::atomic<size_t> high_water[ScratchArena::NUM_SLOTS];
+std::atomic<size_t> grow_count(0);
+
+void raise(std::atomic<size_t>* value, size_t to) {
+  size_t current = value->load(std::memory_order_relaxed);
+  while (current < to &&
+      !value->compare_exchange_weak(current, to, std::memory_order_relaxed)) {
+  }
+}
+
+// The marks as gauges, so that getCounters() and the SIGUSR1 dump show them
+// and not only the log line of a grow, which should never happen.
+void exportStats() {
+  static std::once_flag once;
+  std::call_once(once, []() {
+    Stats& stats = Stats::instance();
+    for (int i = 0; i < ScratchArena::NUM_SLOTS; ++i) {
+      stats.gauge(std::string("scratch.") + kSlotNames[i] +
+          ".high_water_bytes", [i]() {
+        return (int64_t) ScratchArena::highWater((ScratchArena::Slot) i);
+      });
+    }
+    stats.gauge("scratch.grows",
+        []() { return (int64_t) ScratchArena::grows(); });
+  });
+}
+
+void* allocate(size_t size) {
+  void* p = nullptr;
+  if (size > 0 && posix_memalign(&p, 64, size) != 0) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+} // namespace
+
+ScratchArena& ScratchArena::get() {
+  static thread_local ScratchArena arena;
+  return arena;
+}
+
+void ScratchArena::reserve(Slot slot, size_t bytes) {
+  exportStats();
+  raise(&reserved[slot], bytes);
+}
+
+size_t ScratchArena::highWater(Slot slot) {
+  return high_water[slot].load(std::memory_order_relaxed);
+}
+
+size_t ScratchArena::grows() {
+  return grow_count.load(std::memory_order_relaxed);
+}
+
+std::string ScratchArena::report() {
+  std::ostringstream out;
+  out << "scratch high-water:";
+  for (int i = 0; i < NUM_SLOTS; ++i) {
+    out << " " << kSlotNames[i] << "=" << highWater((Slot) i);
+  }
+  out << " grows=" << grows();
+  return out.str();
+}
+
+ScratchArena::ScratchArena() {
+  exportStats();
+  for (int i = 0; i < NUM_SLOTS; ++i) {
+    capacity_[i] = reserved[i].load(std::memory_order_relaxed);
+    data_[i] = allocate(capacity_[i]);
+  }
+}
+
+ScratchArena::~ScratchArena() {
+  for (int i = 0; i < NUM_SLOTS; ++i) {
+    free(data_[i]);
+  }
+}
+
+void* ScratchArena::bytes(Slot slot, size_t size) {
+  raise(&high_water[slot], size);
+  if (size > capacity_[slot]) {
+    size_t grown = std::max(size, capacity_[slot] + capacity_[slot] / 2);
+    free(data_[slot]);
+    data_[slot] = nullptr;
+    capacity_[slot] = 0;
+    data_[slot] = allocate(grown);
+    capacity_[slot] = grown;
+    ++grow_count;
+    LOG(ERROR) << "Scratch " << kSlotNames[slot] << " grew to " << grown
+               << " bytes, " << report();
+  }
+  return data_[slot];
+}
+
+} // namespace cpp2
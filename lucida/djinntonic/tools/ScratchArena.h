@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace cpp2 {
+
+// Per-thread scratch memory for the request path. Every thread owns one
+// buffer per slot that is reused across requests and only ever grows, so
+// once the reservations below are in place no request touches the
+// allocator. The largest size ever requested per slot (over all threads) is
+// kept as a high-water mark, exported with the number of grows as the
+// scratch.<slot>.high_water_bytes and scratch.grows stats.
+class ScratchArena {
+ public:
+  enum Slot {
+    PIXELS,       // decoded image, interleaved 8-bit
+    ROW_SUMS,     // per source row box sums
+    COL_SUMS,     // per output row box sums
+    AXIS_TABLES,  // resize index tables
+    QUANTIZED,    // int8 layer input
+    COLUMNS,      // int8 convolution patches
+    NUM_SLOTS
+  };
+
+  // Arena of the calling thread, created with the current reservations.
+  static ScratchArena& get();
+
+  // Makes every arena created from now on start with at least bytes in the
+  // slot. Called once per model at startup.
+  static void reserve(Slot slot, size_t bytes);
+
+  // Largest request seen for the slot, in bytes.
+  static size_t highWater(Slot slot);
+  // Number of times any arena had to grow past its reservation.
+  static size_t grows();
+  // One line summary of the above, for logging.
+  static std::string report();
+
+  // Returns a 64-byte aligned buffer of at least count elements. Its
+  // previous content is lost when it grows.
+  template <typename T>
+  T* buffer(Slot slot, size_t count) {
+    return static_cast<T*>(bytes(slot, count * sizeof(T)));
+  }
+
+  ~ScratchArena();
+
+ private:
+  ScratchArena();
+  ScratchArena(const ScratchArena&) = delete;
+  ScratchArena& operator=(const ScratchArena&) = delete;
+
+  void* bytes(Slot slot, size_t size);
+
+  void* data_[NUM_SLOTS];
+  size_t capacity_[NUM_SLOTS];
+};
+
+} // namespace cpp2
@@ -0,0 +1,148 @@
+#include "WeightFile.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+#include <glog/logging.h>
+
+using caffe::Blob;
+using caffe::Net;
+
+namespace cpp2 {
+
+namespace {
+
+const char kMagic[8] = {'D', 'J', 'I', 'N', 'N', 'W', '0', '1'};
+const size_t kPage = 4096;
+const size_t kAlign = 64;
+
+struct Header {
+  char magic[8];
+  uint64_t entries;
+};
+
+struct Entry {
+  char layer[64];
+  uint32_t blob;
+  uint32_t reserved;
+  uint64_t count;
+  uint64_t offset;
+};
+
+size_t roundUp(size_t n, size_t to) {
+  return (n + to - 1) / to * to;
+}
+
+} // namespace
+
+void writeWeightFile(Net<float>* net, const std::string& path) {
+  std::vector<Entry> entries;
+  std::vector<const Blob<float>*> blobs;
+  for (size_t i = 0; i < net->layers().size(); ++i) {
+    const std::string& name = net->layer_names()[i];
+    CHECK_LT(name.size(), sizeof(Entry().layer)) << "layer name too long";
+    const auto& params = net->layers()[i]->blobs();
+    for (size_t b = 0; b < params.size(); ++b) {
+      Entry entry;
+      memset(&entry, 0, sizeof(entry));
+      strncpy(entry.layer, name.c_str(), sizeof(entry.layer) - 1);
+      entry.blob = b;
+      entry.count = params[b]->count();
+      entries.push_back(entry);
+      blobs.push_back(params[b].get());
+    }
+  }
+
+  size_t offset = roundUp(sizeof(Header) + entries.size() * sizeof(Entry),
+      kPage);
+  for (auto& entry : entries) {
+    entry.offset = offset;
+    offset = roundUp(offset + entry.count * sizeof(float), kAlign);
+  }
+
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  Header header;
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.entries = entries.size();
+  out.write((const char*) &header, sizeof(header));
+  out.write((const char*) entries.data(), entries.size() * sizeof(Entry));
+  for (size_t i = 0; i < entries.size(); ++i) {
+    std::vector<char> padding(entries[i].offset - out.tellp(), 0);
+    out.write(padding.data(), padding.size());
+    out.write((const char*) blobs[i]->cpu_data(),
+        entries[i].count * sizeof(float));
+  }
+  if (!out) {
+    throw std::runtime_error("Could not write " + path);
+  }
+}
+
+bool isWeightFile(const std::string& path) {
+  char magic[sizeof(kMagic)];
+  std::ifstream in(path, std::ios::binary);
+  return in.read(magic, sizeof(magic)) &&
+      memcmp(magic, kMagic, sizeof(kMagic)) == 0;
+}
+
+MappedWeights::MappedWeights(const std::string& path)
+    : data_(nullptr), size_(0) {
+  int fd = open(path.c_str(), O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    if (fd >= 0) {
+      close(fd);
+    }
+    throw std::runtime_error("Could not open " + path);
+  }
+  size_ = st.st_size;
+  void* p = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) {
+    throw std::runtime_error("Could not map " + path);
+  }
+  data_ = (const char*) p;
+  if (size_ < sizeof(Header) ||
+      memcmp(((const Header*) data_)->magic, kMagic, sizeof(kMagic)) != 0) {
+    munmap(p, size_);
+    throw std::runtime_error(path + " is not a weight file");
+  }
+  // every page is needed for the first forward anyway
+  madvise(p, size_, MADV_WILLNEED);
+}
+
+MappedWeights::~MappedWeights() {
+  munmap((void*) data_, size_);
+}
+
+void MappedWeights::shareWith(Net<float>* net) const {
+  const Header* header = (const Header*) data_;
+  const Entry* entries = (const Entry*) (data_ + sizeof(Header));
+  size_t next = 0;
+  for (size_t i = 0; i < net->layers().size(); ++i) {
+    const auto& params = net->layers()[i]->blobs();
+    for (size_t b = 0; b < params.size(); ++b, ++next) {
+      if (next >= header->entries ||
+          net->layer_names()[i] != entries[next].layer ||
+          entries[next].blob != b ||
+          entries[next].count != (uint64_t) params[b]->count() ||
+          entries[next].offset + entries[next].count * sizeof(float) >
+              size_) {
+        throw std::runtime_error("Weight file does not match layer " +
+            net->layer_names()[i]);
+      }
+      // the blob drops its own memory and reads the mapping from now on
+      params[b]->set_cpu_data(
+          (float*) (data_ + entries[next].offset));
+    }
+  }
+}
+
+} // namespace cpp2
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#include "caffe/caffe.hpp"
+
+namespace cpp2 {
+
+// Trained weights converted for mapping instead of parsing. The file starts
+// with a magic string and a table naming the layer and blob index, size and
+// offset of every parameter blob, followed by the raw floats, page aligned
+// and every blob 64-byte aligned. Mapped read-only and shared, the weights
+// live in the page cache once per host however many servers use them.
+
+// Writes the parameter blobs of a net with trained weights loaded.
+void writeWeightFile(caffe::Net<float>* net, const std::string& path);
+
+// True if path starts like a file from writeWeightFile.
+bool isWeightFile(const std::string& path);
+
+// A weight file mapped into memory. Nets pointed at it must be destroyed
+// first, and must never write to their parameters.
+class MappedWeights {
+ public:
+  explicit MappedWeights(const std::string& path);
+  ~MappedWeights();
+
+  // Points every parameter blob of net at its data in the file. Throws if the
+  // file does not match the net's layers.
+  void shareWith(caffe::Net<float>* net) const;
+
+ private:
+  MappedWeights(const MappedWeights&) = delete;
+  MappedWeights& operator=(const MappedWeights&) = delete;
+
+  const char* data_;
+  size_t size_;
+};
+
+} // namespace cpp2
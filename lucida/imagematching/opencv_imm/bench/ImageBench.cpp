@@ -0,0 +1,138 @@
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include <gflags/gflags.h>
+
+#include "../server/Image.h"
+#include "../../../common/bench/Benchmark.h"
+
+DEFINE_double(min_time_s, 2.0, "Time every case for at least this long");
+DEFINE_int32(min_iterations, 3, "Run every case at least this many times");
+DEFINE_double(warmup_s, 0, "Run every case untimed for this long first");
+DEFINE_string(images, "../test", "Directory of the JPEGs to extract from");
+DEFINE_string(collection_sizes, "10,100,1000,10000",
+		"Sizes of the synthetic collections to match against");
+DEFINE_int32(descriptors, 64, "Descriptors per synthetic image");
+
+using namespace cv;
+using namespace std;
+using namespace cpp2;
+namespace fs = boost::filesystem;
+
+// Image.cpp logs through print().
+std::mutex cout_lock_cpp;
+
+namespace {
+
+string readFile(const string &path) {
+	ifstream in(path, ios::binary);
+	stringstream ss;
+	ss << in.rdbuf();
+	return ss.str();
+}
+
+// Random SURF-like descriptors: 64 floats per row, like the extractor's.
+unique_ptr<Mat> randomDescriptors(int rows) {
+	unique_ptr<Mat> desc(new Mat(rows, 64, CV_32F));
+	randn(*desc, 0, 0.1);
+	return desc;
+}
+
+}
+
+// Times SURF extraction, the descriptor string format and FLANN matching of
+// server/Image.cpp, one JSON line per case on stdout.
+int main(int argc, char* argv[]) {
+	gflags::ParseCommandLineFlags(&argc, &argv, true);
+	// print() in Image.cpp writes to cout, keep stdout for the results
+	ostream results(cout.rdbuf());
+	cout.rdbuf(cerr.rdbuf());
+	Benchmark bench(FLAGS_min_time_s, FLAGS_min_iterations, FLAGS_warmup_s,
+			results);
+
+	vector<pair<string, string>> images;
+	for (fs::directory_iterator it(FLAGS_images), end; it != end; ++it) {
+		if (it->path().extension() == ".jpg") {
+			images.emplace_back(it->path().filename().string(),
+					readFile(it->path().string()));
+		}
+	}
+	sort(images.begin(), images.end());
+	vector<int> sizes;
+	stringstream ss(FLAGS_collection_sizes);
+	for (string size; getline(ss, size, ','); ) {
+		if (atoi(size.c_str()) > 0) {
+			sizes.push_back(atoi(size.c_str()));
+		}
+	}
+
+	// imageToMatObj() saves every image to the working directory
+	char dir[] = "/tmp/image_bench.XXXXXX";
+	if (!mkdtemp(dir) || chdir(dir) != 0) {
+		cerr << "Cannot create a working directory" << endl;
+		return 1;
+	}
+
+	for (auto &image : images) {
+		const string &data = image.second;
+		Benchmark::Params params = {
+			{"image", image.first},
+			{"jpeg_bytes", to_string(data.size())}};
+		unique_ptr<Mat> desc = Image::imageToMatObj(data);
+		params.emplace_back("descriptors", to_string(desc->rows));
+		bench.run("imageToMatObj", params, [&] {
+			Image::imageToMatObj(data);
+		}, 1, data.size());
+		// extraction and the CSV text stored in MongoDB, then the parse
+		// done for every stored image of a match
+		string mat = Image::imageToMatString(data);
+		params.emplace_back("mat_bytes", to_string(mat.size()));
+		bench.run("imageToMatString", params, [&] {
+			Image::imageToMatString(data);
+		}, 1, data.size());
+		bench.run("matStringToMatObj", params, [&] {
+			Image::matStringToMatObj(mat);
+		}, desc->rows, mat.size());
+	}
+
+	for (int size : sizes) {
+		// the query is a noisy copy of one of them, which should come out
+		// on top
+		int expected = size / 2;
+		Mat query;
+		vector<unique_ptr<StoredImage>> collection;
+		for (int i = 0; i < size; ++i) {
+			unique_ptr<Mat> desc = randomDescriptors(FLAGS_descriptors);
+			if (i == expected) {
+				query = *desc + 0.1 * *randomDescriptors(FLAGS_descriptors);
+			}
+			collection.emplace_back(new StoredImage(to_string(i), move(desc)));
+		}
+		int wrong = 0;
+		bench.run("match", {
+			{"collection", to_string(size)},
+			{"descriptors", to_string(FLAGS_descriptors)}}, [&] {
+			unique_ptr<QueryImage> image(new QueryImage(
+					unique_ptr<Mat>(new Mat(query.clone()))));
+			if (Image::match(collection, move(image)) != expected) {
+				++wrong;
+			}
+		}, 1);
+		if (wrong > 0) {
+			cerr << "match: " << wrong << " wrong results for a collection of "
+					<< size << endl;
+		}
+	}
+
+	if (chdir("/") == 0) {
+		fs::remove_all(dir);
+	}
+	return 0;
+}
@@ -1,4 +1,6 @@
 #include "IMMHandler.h"
+#include "../../../common/CpuExecutor.h"
+#include "../../../common/Stats.h"
 
 #include <cstdlib>
 #include <sstream>
@@ -29,7 +31,10 @@ using std::getenv;
 std::mutex cout_lock_cpp;
 
 namespace cpp2 {
-IMMHandler::IMMHandler() {
+IMMHandler::IMMHandler()
+	: describe_us(Stats::instance().histogram("describe_us")),
+	  mongo_fetch_us(Stats::instance().histogram("mongo_fetch_us")),
+	  flann_match_us(Stats::instance().histogram("flann_match_us")) {
 	// Initialize MongoDB C++ driver.
 	client::initialize();
 	string mongo_addr;
@@ -46,6 +51,8 @@ IMMHandler::IMMHandler() {
 	} catch (const DBException &e) {
 		print("Caught " << e.what());
 	}
+	// Start the compute threads before the first request.
+	CpuExecutor::instance();
 }
 
 
@@ -65,8 +72,8 @@ folly::Future<folly::Unit> IMMHandler::future_learn
 	::cpp2::QuerySpec knowledge_save = *knowledge;
 	folly::MoveWrapper<folly::Promise<folly::Unit>> promise;
 	auto future = promise->getFuture();
-	// Async.
-	folly::RequestEventBase::get()->runInEventBaseThread(
+	// Async, on the CPU executor rather than the I/O thread.
+	CpuExecutor::instance().add(
 			[=]() mutable {
 		try {
 			// Go through all images and store their descriptors matices
@@ -98,44 +105,143 @@ folly::Future<unique_ptr<string>> IMMHandler::future_infer
 	// Save LUCID and query.
 	string LUCID_save = *LUCID;
 	QuerySpec query_save = *query;
-	folly::MoveWrapper<folly::Promise<unique_ptr<string>>> promise;
-	auto future = promise->getFuture();
-	// Async.
-	folly::RequestEventBase::get()->runInEventBaseThread(
-			[=]() mutable {
-		try {
-			if (countImages(LUCID_save) == 0) {
-				promise->setValue(
-						unique_ptr<string>(new string(
-								"Cannot match in empty collection")));
+	Deadline deadline = deadlineAfter(query_save.timeout_ms);
+	return admission.run<unique_ptr<string>>(deadline, [=]() {
+		folly::MoveWrapper<folly::Promise<unique_ptr<string>>> promise;
+		auto future = promise->getFuture();
+		// Async, on the CPU executor rather than the I/O thread.
+		CpuExecutor::instance().add(
+				[=]() mutable {
+			if (expired(deadline)) {
+				promise->setException(expiredError());
 				return;
 			}
-			if (query_save.content.empty()
-					|| query_save.content[0].data.empty()) {
-				throw runtime_error("IMM received empty infer query");
-			}
-			vector<unique_ptr<StoredImage>> images = getImages(LUCID_save);
-			int best_index = Image::match(images,
-					unique_ptr<QueryImage>(new QueryImage(
+			try {
+				if (countImages(LUCID_save) == 0) {
+					promise->setValue(
+							unique_ptr<string>(new string(
+									"Cannot match in empty collection")));
+					return;
+				}
+				if (query_save.content.empty()
+						|| query_save.content[0].data.empty()) {
+					throw runtime_error("IMM received empty infer query");
+				}
+				unique_ptr<QueryImage> query_image;
+				{
+					ScopedTimer timer(describe_us);
+					query_image.reset(new QueryImage(
 							move(Image::imageToMatObj(
-									query_save.content[0].data[0])))));
-			string IMM_result = getImageLabelFromId(
-				LUCID_save, images[best_index]->getImageId());
-			print("Result: " << IMM_result);
+									query_save.content[0].data[0]))));
+				}
+				vector<unique_ptr<StoredImage>> images;
+				{
+					ScopedTimer timer(mongo_fetch_us);
+					images = getImages(LUCID_save);
+				}
+				int best_index;
+				{
+					ScopedTimer timer(flann_match_us);
+					best_index = Image::match(images, move(query_image));
+				}
+				string IMM_result = getImageLabelFromId(
+					LUCID_save, images[best_index]->getImageId());
+				print("Result: " << IMM_result);
 				promise->setValue(unique_ptr<string>(
 						new string(IMM_result)));
 				return;
+			} catch (Exception &e) {
+				print(e.what()); // program aborted although exception is caught
+				promise->setValue(unique_ptr<string>(new string(e.what())));
+				return;
+			}
+		}
+		);
+		return future;
+	});
+}
 
-			
-
-		} catch (Exception &e) {
-			print(e.what()); // program aborted although exception is caught
-			promise->setValue(unique_ptr<string>(new string(e.what())));
-			return;
+folly::Future<unique_ptr<vector<string>>> IMMHandler::future_inferBatch
+(unique_ptr<string> LUCID, unique_ptr< ::cpp2::QuerySpec> query) {
+	print("Infer batch");
+	// Save LUCID and query.
+	string LUCID_save = *LUCID;
+	QuerySpec query_save = *query;
+	Deadline deadline = deadlineAfter(query_save.timeout_ms);
+	return admission.run<unique_ptr<vector<string>>>(deadline, [=]() {
+		folly::MoveWrapper<folly::Promise<unique_ptr<vector<string>>>> promise;
+		auto future = promise->getFuture();
+		// Async, on the CPU executor rather than the I/O thread.
+		CpuExecutor::instance().add(
+				[=]() mutable {
+			if (expired(deadline)) {
+				promise->setException(expiredError());
+				return;
+			}
+			int num_queries = 0;
+			for (const QueryInput &query_input : query_save.content) {
+				num_queries += query_input.data.size();
+			}
+			unique_ptr<vector<string>> results(new vector<string>());
+			try {
+				if (countImages(LUCID_save) == 0) {
+					results->assign(num_queries,
+							"Cannot match in empty collection");
+					promise->setValue(move(results));
+					return;
+				}
+				// Fetch the collection once and match all images in one pass.
+				vector<unique_ptr<QueryImage>> query_images;
+				for (const QueryInput &query_input : query_save.content) {
+					for (const string &data : query_input.data) {
+						ScopedTimer timer(describe_us);
+						query_images.push_back(unique_ptr<QueryImage>(
+								new QueryImage(Image::imageToMatObj(data))));
+					}
+				}
+				vector<unique_ptr<StoredImage>> images;
+				{
+					ScopedTimer timer(mongo_fetch_us);
+					images = getImages(LUCID_save);
+				}
+				vector<int> best_indices;
+				{
+					ScopedTimer timer(flann_match_us);
+					best_indices = Image::matchAll(images, query_images);
+				}
+				for (int best_index : best_indices) {
+					results->push_back(getImageLabelFromId(
+							LUCID_save, images[best_index]->getImageId()));
+				}
+				promise->setValue(move(results));
+				return;
+			} catch (Exception &e) {
+				print(e.what());
+				results->assign(num_queries, e.what());
+				promise->setValue(move(results));
+				return;
+			}
 		}
-	}
-	);
-	return future;
+		);
+		return future;
+	});
+}
+
+folly::Future<unique_ptr<string>> IMMHandler::future_inferFrame
+(unique_ptr<string> LUCID, unique_ptr<string> stream,
+		unique_ptr< ::cpp2::QuerySpec> frame) {
+	return future_infer(move(LUCID), move(frame));
+}
+
+folly::Future<folly::Unit> IMMHandler::future_closeStream
+(unique_ptr<string> LUCID, unique_ptr<string> stream) {
+	return makeFuture();
+}
+
+folly::Future<unique_ptr<map<string, int64_t>>>
+IMMHandler::future_getCounters() {
+	return makeFuture(folly::make_unique<map<string, int64_t>>(
+			Stats::instance().counters()));
 }
 
 int IMMHandler::countImages(const string &LUCID) {
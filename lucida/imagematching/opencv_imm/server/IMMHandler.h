@@ -5,6 +5,8 @@
 
 #include "gen-cpp2/LucidaService.h"
 #include "Image.h"
+#include "../../../common/Admission.h"
+#include "../../../common/Stats.h"
 #include "mongo/client/dbclient.h"
 
 // Define print for simple logging.
@@ -34,9 +36,33 @@ public:
 	(std::unique_ptr<std::string> LUCID,
 			std::unique_ptr< ::cpp2::QuerySpec> query);
 
+	folly::Future<std::unique_ptr<std::vector<std::string>>> future_inferBatch
+	(std::unique_ptr<std::string> LUCID,
+			std::unique_ptr< ::cpp2::QuerySpec> query);
+
+	// Matches every frame, the service keeps no per-stream state.
+	folly::Future<std::unique_ptr<std::string>> future_inferFrame
+	(std::unique_ptr<std::string> LUCID, std::unique_ptr<std::string> stream,
+			std::unique_ptr< ::cpp2::QuerySpec> frame);
+
+	folly::Future<folly::Unit> future_closeStream
+	(std::unique_ptr<std::string> LUCID, std::unique_ptr<std::string> stream);
+
+	folly::Future<std::unique_ptr<std::map<std::string, int64_t>>>
+	future_getCounters();
+
 private:
 	mongo::DBClientConnection conn;
 
+	// Bounds the infer requests worked on and waiting.
+	Admission admission;
+
+	// Time to extract the query descriptors, fetch the stored ones and
+	// match them, in us.
+	Histogram &describe_us;
+	Histogram &mongo_fetch_us;
+	Histogram &flann_match_us;
+
 
 
 	int countImages(const std::string &LUCID);
@@ -9,6 +9,11 @@ DEFINE_int32(num_of_threads,
 
 #include "IMMHandler.h"
 #include "Parser.h"
+#include "../../../common/SignalWatcher.h"
+#include "../../../common/Stats.h"
+#include "../../../common/ThreadBudget.h"
+#include "../../../common/ThriftStats.h"
+#include <csignal>
 #include <string>
 #include <fstream>
 #include <folly/init/Init.h>
@@ -28,7 +33,14 @@ using std::to_string;
 
 int main(int argc, char* argv[]) {
 	folly::init(&argc, &argv);
-	
+	// Before the handler starts any thread.
+	SignalWatcher signals({SIGUSR1});
+	installThriftStats();
+	// kill -USR1 prints the stats.
+	signals.on(SIGUSR1, []() {
+		cout << Stats::instance().dump() << flush;
+	});
+
 	Properties props;
 	props.Read("../../../config.properties");
 	string portVal;
@@ -41,6 +53,8 @@ int main(int argc, char* argv[]) {
 	}
 
 
+	// No nets, the CPU executor gets the whole thread budget.
+	ThreadBudget::setModels(0);
 	auto handler = std::make_shared<IMMHandler>();
 	auto server = folly::make_unique<ThriftServer>();
 
@@ -109,6 +109,14 @@ unique_ptr<Mat> Image::matStringToMatObj(const string &mat) {
 int Image::match(
       vector<unique_ptr<StoredImage>> &train_images,
       unique_ptr<QueryImage> query_image) {
+   vector<unique_ptr<QueryImage>> query_images;
+   query_images.push_back(move(query_image));
+   return matchAll(train_images, query_images)[0];
+}
+
+vector<int> Image::matchAll(
+      vector<unique_ptr<StoredImage>> &train_images,
+      vector<unique_ptr<QueryImage>> &query_images) {
    if (train_images.empty()) {
       throw runtime_error("Error! No images!");
    }
@@ -123,21 +131,43 @@ int Image::match(
    }
    matcher->add(train_mats);
    matcher->train();
+   // Stack the descriptors of all query images, so that the index is only
+   // searched once, and remember where each image starts.
+   Mat query_mat;
+   vector<int> offsets;
+   for (unique_ptr<QueryImage> &image_ptr : query_images) {
+      offsets.push_back(query_mat.rows);
+      if (image_ptr->desc->empty()) {
+         continue;
+      }
+      if (image_ptr->desc->type() != OPENCV_TYPE) {
+         image_ptr->desc->convertTo(*(image_ptr->desc), OPENCV_TYPE);
+      }
+      query_mat.push_back(*(image_ptr->desc));
+   }
    // Prepare to match.
    vector<vector<DMatch>> knn_matches;
-   vector<int> scores(train_images.size(), 0);
+   vector<vector<int>> scores(query_images.size(),
+         vector<int>(train_images.size(), 0));
    int knn = 1;
    // Match.
-   matcher->knnMatch(*(query_image->desc), knn_matches, knn);
+   if (!query_mat.empty()) {
+      matcher->knnMatch(query_mat, knn_matches, knn);
+   }
    // Filter results.
    for (auto &v : knn_matches) {
       for(auto &dMatch : v){
-         ++scores[dMatch.imgIdx];
+         int query = upper_bound(offsets.begin(), offsets.end(),
+               dMatch.queryIdx) - offsets.begin() - 1;
+         ++scores[query][dMatch.imgIdx];
       }
    }
-   // Find the best match.
-   auto best = max_element(scores.begin(), scores.end());
-   return best - scores.begin();
+   // Find the best match of every query image.
+   vector<int> rtn;
+   for (auto &s : scores) {
+      rtn.push_back(max_element(s.begin(), s.end()) - s.begin());
+   }
+   return rtn;
 }
 
 bool Image::matEqual(unique_ptr<Mat> a, unique_ptr<Mat> b) {
@@ -41,6 +41,10 @@ public:
 	static int match(
 			std::vector<std::unique_ptr<StoredImage>> &train_images,
 			std::unique_ptr<QueryImage> query_image);
+	// Matches every query image against one index of the train images.
+	static std::vector<int> matchAll(
+			std::vector<std::unique_ptr<StoredImage>> &train_images,
+			std::vector<std::unique_ptr<QueryImage>> &query_images);
 	static bool matEqual(std::unique_ptr<cv::Mat> a,
 			std::unique_ptr<cv::Mat> b);
 };
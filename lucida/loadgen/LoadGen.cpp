@@ -0,0 +1,431 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <dirent.h>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <folly/futures/Future.h>
+#include <folly/init/Init.h>
+#include <gflags/gflags.h>
+#include <thrift/lib/cpp/TApplicationException.h>
+#include <thrift/lib/cpp/transport/TTransportException.h>
+#include <thrift/lib/cpp2/async/HeaderClientChannel.h>
+
+#include "gen-cpp2/LucidaService.h"
+#include "../common/bench/LatencyHistogram.h"
+#include "Parser.h"
+
+DEFINE_string(hostname, "127.0.0.1",
+              "Hostname of the server (default: localhost)");
+
+DEFINE_int32(port, 0,
+             "Port of the server, 0 to use the port of --service in "
+             "--config (default: 0)");
+
+DEFINE_string(service, "IMC",
+              "Service whose <SERVICE>_PORT is the target when --port is 0 "
+              "(default: IMC)");
+
+DEFINE_string(config, "../config.properties",
+              "Port configuration (default: ../config.properties)");
+
+DEFINE_string(method, "infer",
+              "Method to call, infer or inferBatch (default: infer)");
+
+DEFINE_string(corpus, "../djinntonic/imc/test",
+              "Directory whose files are sent as the data of the requests, "
+              "in turn (default: ../djinntonic/imc/test)");
+
+DEFINE_int32(batch_size, 1,
+             "Files per inferBatch request (default: 1)");
+
+DEFINE_string(lucid, "Johann", "LUCID of the requests (default: Johann)");
+
+DEFINE_string(query_name, "query",
+              "QuerySpec.name of the requests (default: query)");
+
+DEFINE_int64(timeout_ms, 0,
+             "QuerySpec.timeout_ms of the requests, 0 for none (default: 0)");
+
+DEFINE_int32(rpc_timeout_ms, 10000,
+             "Client side timeout of a request (default: 10000)");
+
+DEFINE_double(qps, 0,
+              "Requests per second to send with Poisson arrivals whatever "
+              "the latency (open loop), 0 to keep --concurrency requests "
+              "outstanding instead (closed loop) (default: 0)");
+
+DEFINE_int32(concurrency, 8,
+             "Requests outstanding at any time in closed loop, over all "
+             "connections (default: 8)");
+
+DEFINE_int32(connections, 4,
+             "Connections to the server, each on its own thread "
+             "(default: 4)");
+
+DEFINE_double(warmup_s, 5,
+              "Seconds of load before measuring starts (default: 5)");
+
+DEFINE_double(duration_s, 30,
+              "Seconds of load that is measured (default: 30)");
+
+DEFINE_string(json, "",
+              "File to also write the report to as JSON, - for stdout "
+              "(default: none)");
+
+using namespace folly;
+using namespace apache::thrift;
+using namespace apache::thrift::async;
+using namespace cpp2;
+
+using std::string;
+using std::vector;
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+// requests still open this long after the end are given up on
+const int kDrainMs = 10000;
+
+vector<string> readCorpus(const string& dir) {
+  vector<string> names;
+  if (DIR* d = opendir(dir.c_str())) {
+    while (dirent* entry = readdir(d)) {
+      if (entry->d_name[0] != '.') {
+        names.push_back(entry->d_name);
+      }
+    }
+    closedir(d);
+  }
+  std::sort(names.begin(), names.end());
+  vector<string> files;
+  for (const string& name : names) {
+    std::ifstream in(dir + "/" + name, std::ios::binary);
+    std::ostringstream data;
+    data << in.rdbuf();
+    if (in && !data.str().empty()) {
+      files.push_back(data.str());
+    }
+  }
+  return files;
+}
+
+string errorName(const exception_wrapper& error) {
+  string name = "other";
+  error.with_exception([&](const TApplicationException& e) {
+    switch (e.getType()) {
+      case TApplicationException::LOADSHEDDING:
+        name = "loadshedding";
+        break;
+      case TApplicationException::TIMEOUT:
+        name = "timeout";
+        break;
+      default:
+        name = "application";
+    }
+  });
+  error.with_exception([&](const transport::TTransportException& e) {
+    name = e.getType() == transport::TTransportException::TIMED_OUT ?
+        "client_timeout" : "transport";
+  });
+  return name;
+}
+
+struct Result {
+  LatencyHistogram latency;
+  int64_t ok = 0;
+  int64_t unfinished = 0;
+  std::map<string, int64_t> errors;
+
+  void merge(const Result& other) {
+    latency.merge(other.latency);
+    ok += other.ok;
+    unfinished += other.unfinished;
+    for (const auto& error : other.errors) {
+      errors[error.first] += error.second;
+    }
+  }
+};
+
+// One connection and the thread driving it. Latency is taken from the time
+// a request was meant to be sent, so a server that falls behind in open
+// loop is charged for the queueing it causes. Only requests meant to be
+// sent between the end of the warm-up and the end are recorded.
+class Worker {
+ public:
+  Worker(const vector<string>* corpus, int id, int port,
+      Clock::time_point measure, Clock::time_point end)
+      : corpus_(corpus), next_file_(id * 7919), port_(port),
+        measure_(measure), end_(end), rng_(id + 1), open_(false),
+        in_flight_(0) {
+  }
+
+  // Sends at rate requests per second if it is positive, else keeps
+  // outstanding requests open, until the end. Call on the worker's thread.
+  void run(double rate, int outstanding) {
+    std::shared_ptr<TAsyncSocket> socket(
+        TAsyncSocket::newSocket(&base_, FLAGS_hostname, port_));
+    std::unique_ptr<HeaderClientChannel, DelayedDestruction::Destructor>
+        channel(new HeaderClientChannel(socket));
+    channel->setTimeout(FLAGS_rpc_timeout_ms);
+    client_.reset(new LucidaServiceAsyncClient(std::move(channel)));
+
+    if (rate > 0) {
+      open_ = true;
+      interval_ = std::exponential_distribution<double>(rate);
+      next_ = Clock::now();
+      fire();
+    } else {
+      for (int i = 0; i < outstanding; ++i) {
+        send(Clock::now());
+      }
+    }
+    base_.runAfterDelay([this]() { base_.terminateLoopSoon(); },
+        delayMs(end_) + kDrainMs);
+    base_.loopForever();
+    result_.unfinished = in_flight_;
+    client_.reset();
+  }
+
+  const Result& result() const { return result_; }
+
+ private:
+  // sends every request due by now, then waits for the next one
+  void fire() {
+    Clock::time_point now = Clock::now();
+    while (next_ <= now && next_ < end_) {
+      send(next_);
+      next_ += std::chrono::duration_cast<Clock::duration>(
+          std::chrono::duration<double>(interval_(rng_)));
+    }
+    if (next_ < end_) {
+      base_.runAfterDelay([this]() { fire(); }, delayMs(next_));
+    } else {
+      maybeStop();
+    }
+  }
+
+  QuerySpec query() {
+    QueryInput input;
+    input.type = "image";
+    int n = FLAGS_method == "inferBatch" ? std::max(1, FLAGS_batch_size) : 1;
+    for (int i = 0; i < n; ++i) {
+      input.data.push_back((*corpus_)[next_file_++ % corpus_->size()]);
+    }
+    QuerySpec spec;
+    spec.name = FLAGS_query_name;
+    spec.content.push_back(std::move(input));
+    if (FLAGS_timeout_ms > 0) {
+      spec.__isset.timeout_ms = true;
+      spec.timeout_ms = FLAGS_timeout_ms;
+    }
+    return spec;
+  }
+
+  void send(Clock::time_point intended) {
+    ++in_flight_;
+    if (FLAGS_method == "inferBatch") {
+      client_->future_inferBatch(FLAGS_lucid, query()).then(
+          [this, intended](Try<vector<string>>&& t) {
+        finish(intended, t.hasException() ? errorName(t.exception()) : "");
+      });
+    } else {
+      client_->future_infer(FLAGS_lucid, query()).then(
+          [this, intended](Try<string>&& t) {
+        finish(intended, t.hasException() ? errorName(t.exception()) : "");
+      });
+    }
+  }
+
+  void finish(Clock::time_point intended, const string& error) {
+    --in_flight_;
+    Clock::time_point now = Clock::now();
+    if (intended >= measure_ && intended < end_) {
+      if (error.empty()) {
+        ++result_.ok;
+        result_.latency.record(
+            std::chrono::duration_cast<std::chrono::microseconds>(
+                now - intended).count());
+      } else {
+        ++result_.errors[error];
+      }
+    }
+    // closed loop: every reply makes room for the next request
+    if (!open_ && now < end_) {
+      send(now);
+      return;
+    }
+    maybeStop();
+  }
+
+  static int delayMs(Clock::time_point at) {
+    return std::max<int64_t>(0,
+        std::chrono::duration_cast<std::chrono::milliseconds>(
+            at - Clock::now()).count());
+  }
+
+  void maybeStop() {
+    if (in_flight_ == 0 && Clock::now() >= end_) {
+      base_.terminateLoopSoon();
+    }
+  }
+
+  EventBase base_;
+  std::unique_ptr<LucidaServiceAsyncClient> client_;
+  const vector<string>* corpus_;
+  size_t next_file_;
+  int port_;
+  Clock::time_point measure_;
+  Clock::time_point end_;
+  std::mt19937_64 rng_;
+  bool open_;
+  std::exponential_distribution<double> interval_;
+  Clock::time_point next_;
+  int in_flight_;
+  Result result_;
+};
+
+int targetPort() {
+  if (FLAGS_port > 0) {
+    return FLAGS_port;
+  }
+  Properties props;
+  props.Read(FLAGS_config);
+  string value;
+  if (!props.GetValue(FLAGS_service + "_PORT", value)) {
+    return 0;
+  }
+  return atoi(value.c_str());
+}
+
+double ms(int64_t us) {
+  return us / 1000.0;
+}
+
+void report(const Result& total, double seconds, std::ostream& out) {
+  int64_t errors = 0;
+  for (const auto& error : total.errors) {
+    errors += error.second;
+  }
+  int per_request = FLAGS_method == "inferBatch" ?
+      std::max(1, FLAGS_batch_size) : 1;
+  const LatencyHistogram& latency = total.latency;
+  out << std::fixed << std::setprecision(2)
+      << "requests: " << total.ok << " ok, " << errors << " errors";
+  for (const auto& error : total.errors) {
+    out << ", " << error.second << " " << error.first;
+  }
+  out << ", " << total.unfinished << " unfinished\n"
+      << "throughput: " << total.ok / seconds << " requests/s, "
+      << total.ok * per_request / seconds << " items/s\n"
+      << "latency (ms): min " << ms(latency.min())
+      << " mean " << latency.mean() / 1000
+      << " p50 " << ms(latency.percentile(50))
+      << " p90 " << ms(latency.percentile(90))
+      << " p99 " << ms(latency.percentile(99))
+      << " p99.9 " << ms(latency.percentile(99.9))
+      << " max " << ms(latency.max()) << "\n";
+}
+
+void reportJson(const Result& total, double seconds, std::ostream& out) {
+  const LatencyHistogram& latency = total.latency;
+  out << std::fixed << std::setprecision(3)
+      << "{\"method\": \"" << FLAGS_method << "\", \"mode\": \""
+      << (FLAGS_qps > 0 ? "open" : "closed") << "\", \"target_qps\": "
+      << FLAGS_qps << ", \"concurrency\": " << FLAGS_concurrency
+      << ", \"connections\": " << FLAGS_connections
+      << ", \"batch_size\": " << FLAGS_batch_size
+      << ", \"duration_s\": " << seconds
+      << ", \"ok\": " << total.ok
+      << ", \"unfinished\": " << total.unfinished << ", \"errors\": {";
+  const char* separator = "";
+  for (const auto& error : total.errors) {
+    out << separator << "\"" << error.first << "\": " << error.second;
+    separator = ", ";
+  }
+  out << "}, \"throughput_rps\": " << total.ok / seconds
+      << ", \"latency_ms\": {\"min\": " << ms(latency.min())
+      << ", \"mean\": " << latency.mean() / 1000
+      << ", \"p50\": " << ms(latency.percentile(50))
+      << ", \"p90\": " << ms(latency.percentile(90))
+      << ", \"p99\": " << ms(latency.percentile(99))
+      << ", \"p999\": " << ms(latency.percentile(99.9))
+      << ", \"max\": " << ms(latency.max()) << "}}\n";
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+  folly::init(&argc, &argv);
+
+  vector<string> corpus = readCorpus(FLAGS_corpus);
+  if (corpus.empty()) {
+    std::cerr << "No files in " << FLAGS_corpus << std::endl;
+    return 1;
+  }
+  if (FLAGS_method != "infer" && FLAGS_method != "inferBatch") {
+    std::cerr << "Unknown method " << FLAGS_method << std::endl;
+    return 1;
+  }
+  int port = targetPort();
+  if (port <= 0) {
+    std::cerr << FLAGS_service << " port not defined" << std::endl;
+    return 1;
+  }
+  int connections = std::max(1, FLAGS_connections);
+
+  Clock::time_point start = Clock::now();
+  Clock::time_point measure = start +
+      std::chrono::duration_cast<Clock::duration>(
+          std::chrono::duration<double>(FLAGS_warmup_s));
+  Clock::time_point end = measure +
+      std::chrono::duration_cast<Clock::duration>(
+          std::chrono::duration<double>(FLAGS_duration_s));
+
+  // the connections share the arrival rate or the outstanding requests
+  vector<std::unique_ptr<Worker>> workers;
+  vector<std::thread> threads;
+  for (int i = 0; i < connections; ++i) {
+    workers.emplace_back(new Worker(&corpus, i, port, measure, end));
+  }
+  std::cout << "Sending " << FLAGS_method << " to " << FLAGS_hostname << ":"
+            << port << " over " << connections << " connections, "
+            << (FLAGS_qps > 0 ? std::to_string(FLAGS_qps) + " requests/s" :
+                std::to_string(FLAGS_concurrency) + " outstanding")
+            << std::endl;
+  for (int i = 0; i < connections; ++i) {
+    int outstanding = FLAGS_concurrency / connections +
+        (i < FLAGS_concurrency % connections ? 1 : 0);
+    Worker* worker = workers[i].get();
+    threads.emplace_back([worker, connections, outstanding]() {
+      worker->run(FLAGS_qps / connections, outstanding);
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  Result total;
+  for (const auto& worker : workers) {
+    total.merge(worker->result());
+  }
+  double seconds = std::max(FLAGS_duration_s, 1e-3);
+  report(total, seconds, std::cout);
+  if (FLAGS_json == "-") {
+    reportJson(total, seconds, std::cout);
+  } else if (!FLAGS_json.empty()) {
+    std::ofstream json(FLAGS_json);
+    reportJson(total, seconds, json);
+  }
+  return total.ok > 0 ? 0 : 1;
+}
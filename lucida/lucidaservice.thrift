@@ -9,4 +9,20 @@ service LucidaService {
 
     // ask the intelligence to infer using the data supplied in the query
     string infer(1:string LUCID, 2:lucidatypes.QuerySpec query);
+
+    // ask the intelligence to infer on every item of data in the query,
+    // returning one result per item in order
+    list<string> inferBatch(1:string LUCID, 2:lucidatypes.QuerySpec query);
+
+    // ask the intelligence to infer on the next frame of a video stream, the
+    // first data item of the query; services that keep per-stream state may
+    // answer a frame that looks like an earlier one of the same stream with
+    // that frame's result
+    string inferFrame(1:string LUCID, 2:string stream, 3:lucidatypes.QuerySpec frame);
+
+    // forget the state kept for a stream of inferFrame calls
+    void closeStream(1:string LUCID, 2:string stream);
+
+    // counters and latency percentiles of the service, by name
+    map<string, i64> getCounters();
 }
\ No newline at end of file
@@ -12,4 +12,8 @@ struct QueryInput {
 struct QuerySpec {
     1: string name;
     2: list<QueryInput> content;
+
+    // time budget of the request in ms, counted from its arrival at the
+    // service; the service drops it instead of answering late
+    3: optional i64 timeout_ms;
 }
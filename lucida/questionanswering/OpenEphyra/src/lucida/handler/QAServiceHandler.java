@@ -6,7 +6,9 @@ import info.ephyra.search.Result;
 import info.ephyra.io.MsgPrinter;
 
 // Java packages
+import java.util.HashMap;
 import java.util.List;
+import java.util.Map;
 import java.io.File;
 import java.util.ArrayList;
 import java.util.concurrent.locks.Lock;
@@ -121,6 +123,56 @@ public class QAServiceHandler {
             return answer;
         }
 
+        /**
+         * Answers every question in the query, one after another.
+         * @param LUCID ID of Lucida user
+         * @param query query
+         */
+        @Override
+        public List<String> inferBatch(String LUCID, QuerySpec query) {
+            List<String> answers = new ArrayList<String>();
+            for (QueryInput input : query.content) {
+                for (String question : input.data) {
+                    List<QueryInput> content = new ArrayList<QueryInput>();
+                    List<String> data = new ArrayList<String>();
+                    data.add(question);
+                    content.add(new QueryInput(input.type, data, input.tags));
+                    answers.add(infer(LUCID, new QuerySpec(query.name, content)));
+                }
+            }
+            return answers;
+        }
+
+        /**
+         * Answers every frame of a stream as its own query, the service
+         * keeps no per-stream state.
+         * @param LUCID ID of Lucida user
+         * @param stream name of the stream
+         * @param frame query
+         */
+        @Override
+        public String inferFrame(String LUCID, String stream, QuerySpec frame) {
+            return infer(LUCID, frame);
+        }
+
+        @Override
+        public void closeStream(String LUCID, String stream) {
+        }
+
+        /**
+         * Reports the memory use of the JVM, the service keeps no other
+         * counters.
+         */
+        @Override
+        public Map<String, Long> getCounters() {
+            Runtime runtime = Runtime.getRuntime();
+            Map<String, Long> counters = new HashMap<String, Long>();
+            counters.put("heap_used_bytes",
+                    runtime.totalMemory() - runtime.freeMemory());
+            counters.put("heap_max_bytes", runtime.maxMemory());
+            return counters;
+        }
+
         /** Forwards the client's question to the OpenEphyra object's askFactoid
          * method and collects the response.
          * @param LUCID ID of Lucida user
@@ -180,5 +232,32 @@ public class QAServiceHandler {
             MsgPrinter.printStatusMsg("Async Infer");
             resultHandler.onComplete(handler.infer(LUCID, query));
         }
+
+        @Override
+        public void inferBatch(String LUCID, QuerySpec query, AsyncMethodCallback resultHandler)
+                throws TException {
+            MsgPrinter.printStatusMsg("Async Infer Batch");
+            resultHandler.onComplete(handler.inferBatch(LUCID, query));
+        }
+
+        @Override
+        public void inferFrame(String LUCID, String stream, QuerySpec frame,
+                AsyncMethodCallback resultHandler) throws TException {
+            MsgPrinter.printStatusMsg("Async Infer Frame");
+            resultHandler.onComplete(handler.inferFrame(LUCID, stream, frame));
+        }
+
+        @Override
+        public void closeStream(String LUCID, String stream, AsyncMethodCallback resultHandler)
+                throws TException {
+            handler.closeStream(LUCID, stream);
+            resultHandler.onComplete(null);
+        }
+
+        @Override
+        public void getCounters(AsyncMethodCallback resultHandler)
+                throws TException {
+            resultHandler.onComplete(handler.getCounters());
+        }
     }
 }